@@ -0,0 +1,137 @@
+// Compares the BVH builders on build time, tree quality and query time, and refit against rebuild after small moves
+//
+// Build against Cinder, which provides AxisAlignedBox, Ray and Sphere, for example
+//   c++ -std=c++14 -O3 -pthread -I../blocks/SpacePartitioning/include -I$CINDER_PATH/include BVHBuild.cpp -L$CINDER_PATH/lib -lcinder -o BVHBuild
+// then run ./BVHBuild > bvh.csv, one line per distribution, size and builder
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "sp/BVH.h"
+
+using namespace std;
+using Clock = chrono::high_resolution_clock;
+
+namespace {
+
+//! A small box, which is all the BVH needs from an object
+class Box {
+public:
+	Box( const ci::vec3 &center, float halfSize ) : mBounds( center - ci::vec3( halfSize ), center + ci::vec3( halfSize ) ) {}
+	
+	ci::AxisAlignedBox getBounds() const { return mBounds; }
+	ci::vec3 getCentroid() const { return mBounds.getCenter(); }
+	void move( const ci::vec3 &offset ) { mBounds = ci::AxisAlignedBox( mBounds.getMin() + offset, mBounds.getMax() + offset ); }
+	bool intersect( const ci::Ray &ray, float *dist ) const
+	{
+		float tmin, tmax;
+		if( mBounds.intersect( ray, &tmin, &tmax ) > 0 && tmax >= 0.0f ) {
+			*dist = tmin > 0.0f ? tmin : tmax;
+			return true;
+		}
+		return false;
+	}
+protected:
+	ci::AxisAlignedBox mBounds;
+};
+
+//! Boxes scattered over a cube
+vector<Box> uniformBoxes( size_t count, mt19937 &rng )
+{
+	uniform_real_distribution<float> position( -1000.0f, 1000.0f );
+	vector<Box> boxes;
+	boxes.reserve( count );
+	for( size_t i = 0; i < count; ++i )
+		boxes.emplace_back( ci::vec3( position( rng ), position( rng ), position( rng ) ), 1.0f );
+	return boxes;
+}
+
+//! Boxes gathered in a few dense clusters, where midpoint splits do poorly
+vector<Box> clusteredBoxes( size_t count, mt19937 &rng )
+{
+	uniform_real_distribution<float> position( -1000.0f, 1000.0f );
+	normal_distribution<float> spread( 0.0f, 20.0f );
+	vector<ci::vec3> centers( 16 );
+	for( auto &center : centers )
+		center = ci::vec3( position( rng ), position( rng ), position( rng ) );
+	
+	vector<Box> boxes;
+	boxes.reserve( count );
+	for( size_t i = 0; i < count; ++i ) {
+		const ci::vec3 &center = centers[rng() % centers.size()];
+		boxes.emplace_back( center + ci::vec3( spread( rng ), spread( rng ), spread( rng ) ), 1.0f );
+	}
+	return boxes;
+}
+
+double millisecondsSince( Clock::time_point start )
+{
+	return chrono::duration<double, milli>( Clock::now() - start ).count();
+}
+
+void run( const char *distribution, const vector<Box> &boxes, sp::BVH<Box>::BuildMethod method, const char *methodName )
+{
+	// keep the best of a few builds, the objects are copied each time as the build reorders them
+	vector<Box> objects;
+	double buildMs = numeric_limits<double>::max();
+	sp::BVH<Box> bvh;
+	for( int i = 0; i < 3; ++i ) {
+		objects = boxes;
+		const auto start = Clock::now();
+		bvh = sp::BVH<Box>( &objects, 4, method );
+		buildMs = min( buildMs, millisecondsSince( start ) );
+	}
+	
+	// closest hits of rays through the scene
+	mt19937 rng( 1 );
+	uniform_real_distribution<float> position( -1000.0f, 1000.0f );
+	const size_t numQueries = 10000;
+	size_t hits = 0;
+	auto start = Clock::now();
+	for( size_t i = 0; i < numQueries; ++i ) {
+		const ci::vec3 origin( position( rng ), position( rng ), -1500.0f );
+		const ci::vec3 target = boxes[rng() % boxes.size()].getCentroid();
+		sp::BVH<Box>::RaycastResult result;
+		hits += bvh.raycast( ci::Ray( origin, glm::normalize( target - origin ) ), &result );
+	}
+	const double raycastMs = millisecondsSince( start );
+	
+	// spheres around the objects themselves
+	size_t found = 0;
+	start = Clock::now();
+	for( size_t i = 0; i < numQueries; ++i ) {
+		bvh.rangeSearch( boxes[rng() % boxes.size()].getCentroid(), 10.0f, [&found]( Box* ) { found++; } );
+	}
+	const double rangeMs = millisecondsSince( start );
+	
+	// a tick of motion, a little under the size of the boxes
+	uniform_real_distribution<float> offset( -0.5f, 0.5f );
+	for( Box &box : objects )
+		box.move( ci::vec3( offset( rng ), offset( rng ), offset( rng ) ) );
+	start = Clock::now();
+	const bool rebuilt = bvh.refit();
+	const double refitMs = millisecondsSince( start );
+	
+	printf( "%s,%zu,%s,%u,%.3f,%u,%u,%.3f,%.3f,%.3f,%.3f,%d,%zu,%zu\n", distribution, boxes.size(), methodName, thread::hardware_concurrency(), buildMs, bvh.getNumNodes(), bvh.getNumLeafs(), raycastMs, rangeMs, refitMs, bvh.getCostRatio(), rebuilt, hits, found );
+	fflush( stdout );
+}
+
+} // anonymous namespace
+
+int main()
+{
+	printf( "distribution,objects,builder,threads,build_ms,nodes,leafs,raycast_ms,range_ms,refit_ms,refit_cost_ratio,refit_rebuilt,hits,found\n" );
+	for( size_t count : { 1000, 10000, 100000, 1000000 } ) {
+		mt19937 rng( static_cast<uint32_t>( count ) );
+		const vector<Box> uniform = uniformBoxes( count, rng );
+		const vector<Box> clustered = clusteredBoxes( count, rng );
+		run( "uniform", uniform, sp::BVH<Box>::MIDPOINT, "midpoint" );
+		run( "uniform", uniform, sp::BVH<Box>::BINNED_SAH, "binned_sah" );
+		run( "clustered", clustered, sp::BVH<Box>::MIDPOINT, "midpoint" );
+		run( "clustered", clustered, sp::BVH<Box>::BINNED_SAH, "binned_sah" );
+	}
+	return 0;
+}
@@ -0,0 +1,358 @@
+// Measures the spatial structures on the point sets the ecosystem produces: build, nearest neighbor, range, k nearest
+// and batched nearest neighbor queries, with the time and the heap allocations of each phase
+//
+// Build against Cinder, for example
+//   c++ -std=c++14 -O3 -pthread -I../blocks/SpacePartitioning/include -I$CINDER_PATH/include SpatialQueries.cpp -L$CINDER_PATH/lib -lcinder -o SpatialQueries
+// then run ./SpatialQueries > spatial.csv, one line per distribution, size and structure. The structures are set up as
+// SpatialIndex sets them up for a 1920x1080 world, and the world keeps that size as the point count grows. Queries come
+// from vehicles scattered over the world and look as far as a vehicle sees. nn_checksum is the sum of the nearest
+// distances, it should be the same for every structure of a row group. Columns a structure doesn't support are empty
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <new>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "sp/KdTree.h"
+#include "sp/Grid.h"
+#include "sp/HashTable.h"
+#include "sp/BVH2.h"
+#include "sp/Batch.h"
+
+using namespace std;
+using Clock = chrono::high_resolution_clock;
+
+// MARK: Allocation counting
+
+namespace {
+atomic<size_t> sNumAllocations( 0 );
+atomic<size_t> sAllocatedBytes( 0 );
+}
+
+namespace {
+void* countedMalloc( size_t size ) noexcept
+{
+	sNumAllocations.fetch_add( 1, memory_order_relaxed );
+	sAllocatedBytes.fetch_add( size, memory_order_relaxed );
+	return malloc( size ? size : 1 );
+}
+}
+
+// every replaced form allocates with malloc and frees with free, g++ can't see that the pairs match once they are inlined
+#if defined( __GNUC__ ) && ! defined( __clang__ ) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void* operator new( size_t size )
+{
+	if( void *ptr = countedMalloc( size ) )
+		return ptr;
+	throw bad_alloc();
+}
+void* operator new[]( size_t size )
+{
+	if( void *ptr = countedMalloc( size ) )
+		return ptr;
+	throw bad_alloc();
+}
+void* operator new( size_t size, const nothrow_t& ) noexcept { return countedMalloc( size ); }
+void* operator new[]( size_t size, const nothrow_t& ) noexcept { return countedMalloc( size ); }
+void operator delete( void *ptr ) noexcept { free( ptr ); }
+void operator delete[]( void *ptr ) noexcept { free( ptr ); }
+void operator delete( void *ptr, size_t ) noexcept { free( ptr ); }
+void operator delete[]( void *ptr, size_t ) noexcept { free( ptr ); }
+void operator delete( void *ptr, const nothrow_t& ) noexcept { free( ptr ); }
+void operator delete[]( void *ptr, const nothrow_t& ) noexcept { free( ptr ); }
+#if defined( __GNUC__ ) && ! defined( __clang__ ) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+namespace {
+
+//! Counts the allocations made between its construction and the calls to getCount and getBytes
+class AllocationScope {
+public:
+	AllocationScope() : mCount( sNumAllocations.load() ), mBytes( sAllocatedBytes.load() ) {}
+	size_t getCount() const { return sNumAllocations.load() - mCount; }
+	size_t getBytes() const { return sAllocatedBytes.load() - mBytes; }
+protected:
+	size_t mCount, mBytes;
+};
+
+double millisecondsSince( Clock::time_point start )
+{
+	return chrono::duration<double, milli>( Clock::now() - start ).count();
+}
+
+// MARK: Distributions
+
+const ci::vec2	kWorldSize( 1920.0f, 1080.0f );
+const float		kSightDist = 100.0f;	// Vehicle::mSightDist
+const size_t	kNumQueries = 10000;
+const size_t	kNumNeighbors = 8;
+
+ci::vec2 randPoint( mt19937 &rng )
+{
+	uniform_real_distribution<float> x( 0.0f, kWorldSize.x ), y( 0.0f, kWorldSize.y );
+	return ci::vec2( x( rng ), y( rng ) );
+}
+
+//! Food scattered over the world, as at startup
+vector<ci::vec2> uniformFood( size_t count, mt19937 &rng )
+{
+	vector<ci::vec2> points( count );
+	for( auto &point : points )
+		point = randPoint( rng );
+	return points;
+}
+
+//! Food respawned around the food spawns, favouring the oldest ones, as Ecosystem::chooseSpawn and addNoise do
+vector<ci::vec2> clusteredFood( size_t count, mt19937 &rng )
+{
+	vector<ci::vec2> spawns( 10 );
+	for( auto &spawn : spawns )
+		spawn = randPoint( rng );
+
+	uniform_real_distribution<float> unit( 0.0f, 1.0f ), noise( -180.0f, 180.0f );
+	vector<ci::vec2> points( count );
+	for( auto &point : points ) {
+		const float bias = 1.5f;
+		const size_t spawn = static_cast<size_t>( spawns.size() * ( 1.0f - ( 1.0f / bias ) * pow( unit( rng ), bias ) ) );
+		point = spawns[min( spawn, spawns.size() - 1 )] + ci::vec2( noise( rng ), noise( rng ) );
+	}
+	return points;
+}
+
+//! Corpses left along the wandering paths of a population of vehicles
+vector<ci::vec2> corpseTrails( size_t count, mt19937 &rng )
+{
+	const size_t numVehicles = 50;
+	normal_distribution<float> turn( 0.0f, 0.3f );
+	uniform_real_distribution<float> heading( 0.0f, 6.2831853f );
+	vector<ci::vec2> positions( numVehicles );
+	vector<float> headings( numVehicles );
+	for( size_t i = 0; i < numVehicles; ++i ) {
+		positions[i] = randPoint( rng );
+		headings[i] = heading( rng );
+	}
+
+	vector<ci::vec2> points( count );
+	for( size_t i = 0; i < count; ++i ) {
+		const size_t v = i % numVehicles;
+		headings[v] += turn( rng );
+		ci::vec2 next = positions[v] + 6.0f * ci::vec2( cos( headings[v] ), sin( headings[v] ) );
+		// turn back at the edges of the world
+		if( next.x < 0.0f || next.x > kWorldSize.x || next.y < 0.0f || next.y > kWorldSize.y ) {
+			headings[v] += 3.1415927f;
+			next = positions[v];
+		}
+		positions[v] = points[i] = next;
+	}
+	return points;
+}
+
+// MARK: Structures
+
+//! Food as the BVH sees it, a small circle
+class Food {
+public:
+	Food( const ci::vec2 &position, uint32_t index ) : mPosition( position ), mIndex( index ) {}
+	ci::Rectf getBounds() const { return ci::Rectf( mPosition - ci::vec2( 3.0f ), mPosition + ci::vec2( 3.0f ) ); }
+	ci::vec2 getCentroid() const { return mPosition; }
+	ci::vec2	mPosition;
+	uint32_t	mIndex;
+};
+
+//! Wraps a point structure with the calls the benchmark makes
+template<class SpatialStruct>
+class PointStructure {
+public:
+	static const bool hasNearest = true;
+	using Node = typename SpatialStruct::Node;
+	using NodePair = typename SpatialStruct::NodePair;
+
+	void build( const vector<ci::vec2> &points );
+	Node* nearest( const ci::vec2 &position, float *distanceSq ) const { return mStruct->nearestNeighborSearch( position, distanceSq ); }
+	template<class Visitor>
+	void range( const ci::vec2 &position, float radius, Visitor &&visitor ) const { mStruct->rangeSearch( position, radius, [&visitor]( Node*, float ) { visitor(); } ); }
+	size_t kNearest( const ci::vec2 &position, size_t k, NodePair *results ) const { return mStruct->kNearest( position, k, kSightDist, results ); }
+	void batch( const ci::vec2 *positions, size_t count, Node **nodes, float *distancesSq ) const { sp::nearestNeighborSearchBatch( *mStruct, positions, count, nodes, distancesSq ); }
+
+protected:
+	unique_ptr<SpatialStruct> mStruct;
+};
+
+template<>
+void PointStructure<sp::KdTree2<uint32_t>>::build( const vector<ci::vec2> &points )
+{
+	vector<uint32_t> data( points.size() );
+	for( size_t i = 0; i < data.size(); ++i )
+		data[i] = static_cast<uint32_t>( i );
+	mStruct.reset( new sp::KdTree2<uint32_t>() );
+	mStruct->build( points.data(), data.data(), points.size() );
+}
+
+template<>
+void PointStructure<sp::Grid2<uint32_t>>::build( const vector<ci::vec2> &points )
+{
+	// 128 unit bins
+	mStruct.reset( new sp::Grid2<uint32_t>( ci::vec2( 0.0f ), kWorldSize, 7 ) );
+	for( size_t i = 0; i < points.size(); ++i )
+		mStruct->insert( points[i], static_cast<uint32_t>( i ) );
+}
+
+template<>
+void PointStructure<sp::HashTable2<uint32_t>>::build( const vector<ci::vec2> &points )
+{
+	mStruct.reset( new sp::HashTable2<uint32_t>( ci::vec2( 0.0f ), kWorldSize, ci::vec2( 128.0f ), 509 ) );
+	for( size_t i = 0; i < points.size(); ++i )
+		mStruct->insert( points[i], static_cast<uint32_t>( i ) );
+}
+
+//! The BVH only answers overlap queries, its range search tests the food centers against the sight disc
+class BVHStructure {
+public:
+	static const bool hasNearest = false;
+	using Node = void;
+	using NodePair = pair<void*,float>;
+
+	void build( const vector<ci::vec2> &points )
+	{
+		mFood.clear();
+		mFood.reserve( points.size() );
+		for( size_t i = 0; i < points.size(); ++i )
+			mFood.emplace_back( points[i], static_cast<uint32_t>( i ) );
+		mBvh.reset( new sp::BVH2<Food>( &mFood ) );
+	}
+	template<class Visitor>
+	void range( const ci::vec2 &position, float radius, Visitor &&visitor ) const
+	{
+		mBvh->overlapSearch( position, radius, [&]( Food *food ) {
+			const ci::vec2 d = food->mPosition - position;
+			if( d.x * d.x + d.y * d.y <= radius * radius )
+				visitor();
+		} );
+	}
+	void* nearest( const ci::vec2&, float* ) const { return nullptr; }
+	size_t kNearest( const ci::vec2&, size_t, NodePair* ) const { return 0; }
+	void batch( const ci::vec2*, size_t, void**, float* ) const {}
+
+protected:
+	vector<Food>			mFood;
+	unique_ptr<sp::BVH2<Food>>	mBvh;
+};
+
+// MARK: Benchmark
+
+template<class Structure>
+void run( const char *distribution, const char *name, const vector<ci::vec2> &points, const vector<ci::vec2> &queries )
+{
+	// keep the best of a few builds
+	Structure structure;
+	double buildMs = numeric_limits<double>::max();
+	size_t buildAllocations = 0, buildBytes = 0;
+	for( int i = 0; i < 3; ++i ) {
+		AllocationScope allocations;
+		const auto start = Clock::now();
+		structure.build( points );
+		buildMs = min( buildMs, millisecondsSince( start ) );
+		buildAllocations = allocations.getCount();
+		buildBytes = allocations.getBytes();
+	}
+
+	// the nearest food of each vehicle
+	double nnMs = 0.0, nnChecksum = 0.0;
+	size_t nnAllocations = 0;
+	if( Structure::hasNearest ) {
+		AllocationScope allocations;
+		const auto start = Clock::now();
+		for( const auto &query : queries ) {
+			float distanceSq = 0.0f;
+			if( structure.nearest( query, &distanceSq ) )
+				nnChecksum += sqrt( distanceSq );
+		}
+		nnMs = millisecondsSince( start );
+		nnAllocations = allocations.getCount();
+	}
+
+	// everything a vehicle sees
+	size_t found = 0;
+	AllocationScope rangeAllocations;
+	auto start = Clock::now();
+	for( const auto &query : queries )
+		structure.range( query, kSightDist, [&found] { found++; } );
+	const double rangeMs = millisecondsSince( start );
+	const size_t rangeAllocationCount = rangeAllocations.getCount();
+
+	// a few nearest within sight
+	double knnMs = 0.0;
+	size_t knnAllocations = 0, knnFound = 0;
+	if( Structure::hasNearest ) {
+		typename Structure::NodePair results[kNumNeighbors];
+		AllocationScope allocations;
+		start = Clock::now();
+		for( const auto &query : queries )
+			knnFound += structure.kNearest( query, kNumNeighbors, results );
+		knnMs = millisecondsSince( start );
+		knnAllocations = allocations.getCount();
+	}
+
+	// the nearest food of every vehicle at once
+	double batchMs = 0.0;
+	size_t batchAllocations = 0;
+	if( Structure::hasNearest ) {
+		vector<typename Structure::Node*> nodes( queries.size() );
+		vector<float> distancesSq( queries.size() );
+		AllocationScope allocations;
+		start = Clock::now();
+		structure.batch( queries.data(), queries.size(), nodes.data(), distancesSq.data() );
+		batchMs = millisecondsSince( start );
+		batchAllocations = allocations.getCount();
+	}
+
+	printf( "%s,%s,%zu,%zu,%u,%.3f,%zu,%zu,", distribution, name, points.size(), queries.size(), thread::hardware_concurrency(), buildMs, buildAllocations, buildBytes );
+	if( Structure::hasNearest )
+		printf( "%.3f,%zu,", nnMs, nnAllocations );
+	else
+		printf( ",," );
+	printf( "%.3f,%zu,", rangeMs, rangeAllocationCount );
+	if( Structure::hasNearest )
+		printf( "%.3f,%zu,%.3f,%zu,%.3f,%zu,%zu\n", knnMs, knnAllocations, batchMs, batchAllocations, nnChecksum, found, knnFound );
+	else
+		printf( ",,,,,%zu,\n", found );
+	fflush( stdout );
+}
+
+} // anonymous namespace
+
+int main()
+{
+	printf( "distribution,structure,points,queries,threads,build_ms,build_allocs,build_bytes,nn_ms,nn_allocs,range_ms,range_allocs,knn_ms,knn_allocs,batch_ms,batch_allocs,nn_checksum,range_found,knn_found\n" );
+	for( size_t count : { 10, 100, 1000, 10000, 100000, 1000000 } ) {
+		mt19937 rng( static_cast<uint32_t>( count ) );
+		vector<ci::vec2> queries( kNumQueries );
+		for( auto &query : queries )
+			query = randPoint( rng );
+
+		const pair<const char*, vector<ci::vec2>> distributions[] = {
+			{ "uniform_food", uniformFood( count, rng ) },
+			{ "clustered_food", clusteredFood( count, rng ) },
+			{ "corpse_trails", corpseTrails( count, rng ) }
+		};
+		for( const auto &distribution : distributions ) {
+			run<PointStructure<sp::KdTree2<uint32_t>>>( distribution.first, "kd_tree", distribution.second, queries );
+			run<PointStructure<sp::Grid2<uint32_t>>>( distribution.first, "grid", distribution.second, queries );
+			run<PointStructure<sp::HashTable2<uint32_t>>>( distribution.first, "hash_table", distribution.second, queries );
+			run<BVHStructure>( distribution.first, "bvh2", distribution.second, queries );
+		}
+	}
+	return 0;
+}
@@ -24,12 +24,448 @@
 
 #pragma once
 
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include "cinder/Vector.h"
+
 namespace SpacePartitioning {
 
-// TODO: Implement BSPTrees
-//! Represents a Binary Space Partitioning Tree
+//! Represents a 2D Binary Space Partitioning Tree over line segments. Each node splits the plane along the line of one of the segments, segments crossing it are stored on both sides, so a query only visits the regions its own segment passes through, nearest first. Segments can be inserted, moved and removed one at a time, the tree is rebuilt once half of its fragments are stale
+template<class T, class DataT>
 class BSPTree {
 public:
+	using vec_t = typename ci::VECDIM<2, T>::TYPE;
+	//! Identifies a segment for move and remove, stays valid until the segment is removed
+	using Handle = uint32_t;
+
+	//! Constructs an empty tree. Points within tolerance of a splitting line are treated as lying on it
+	BSPTree( T tolerance = T( 1e-4 ) );
+
+	//! Inserts a segment with optional user data and returns its handle, invalidates previously returned Segments
+	Handle insert( const vec_t &a, const vec_t &b, const DataT &data = DataT() );
+	//! Removes a segment, its handle can be reused by the next insert
+	void remove( Handle handle );
+	//! Moves the end points of a segment
+	void move( Handle handle, const vec_t &a, const vec_t &b );
+	//! Replaces the user data of a segment
+	void setData( Handle handle, const DataT &data ) { mSegments[handle].mData = data; }
+	//! Rebuilds the tree from its segments, choosing splitting lines that cut few of them
+	void rebuild();
+	//! Removes all the segments, keeping the allocated storage
+	void clear();
+	//! Returns the number of segments
+	size_t size() const { return mSegments.size() - mFreeSegments.size(); }
+
+	//! Represents a single segment of the BSPTree
+	class Segment {
+	public:
+		//! Returns the first end point of the segment
+		vec_t getA() const { return mA; }
+		//! Returns the second end point of the segment
+		vec_t getB() const { return mB; }
+		//! Returns the user data
+		const DataT& getData() const { return mData; }
+
+		Segment( const vec_t &a, const vec_t &b, const DataT &data );
+	protected:
+		vec_t		mA, mB;
+		DataT		mData;
+		uint32_t	mGeneration;	// bumped when moved or removed, older fragments are stale
+		uint32_t	mNumFragments;	// fragments of the current generation
+		friend class BSPTree;
+	};
+
+	//! Returns the Segment of a handle
+	Segment* getSegment( Handle handle ) const { return const_cast<Segment*>( &mSegments[handle] ); }
+
+	//! Returns true if the segment ab touches or crosses any segment of the tree
+	bool		segmentIntersectsAny( const vec_t &a, const vec_t &b ) const;
+	//! Returns the first Segment hit going from a to b, or nullptr if there is none. t receives the hit as a fraction of ab
+	Segment*	firstSegmentHit( const vec_t &a, const vec_t &b, T *t = nullptr ) const;
+
+	//! Returns the number of nodes of the tree
+	size_t getNumNodes() const { return mNodes.size(); }
+
+protected:
+	//! Index of a missing node or fragment
+	enum : uint32_t { NO_NODE = 0xffffffff };
+
+	struct Node {
+		Node( const vec_t &a, const vec_t &b );
+		//! Returns the signed distance of a point to the splitting line, positive in front
+		T side( const vec_t &p ) const { return glm::dot( p - mPoint, mNormal ); }
+
+		vec_t		mPoint, mNormal;
+		uint32_t	mFront, mBack;
+		uint32_t	mFirst;		// fragments lying on the splitting line
+	};
+	//! Part of a segment, the query tests the whole segment so only the segment is kept
+	struct Fragment {
+		uint32_t	mSegment, mGeneration, mNext;
+	};
+	struct BuildFragment {
+		vec_t		mA, mB;
+		uint32_t	mSegment;
+	};
+	//! Parameter range of a query on one side of a node
+	struct Interval {
+		T mMin, mMax;
+		bool empty() const { return mMin > mMax; }
+	};
+
+	uint32_t createNode( const vec_t &a, const vec_t &b );
+	void addFragment( uint32_t node, uint32_t segment );
+	void insertImpl( uint32_t node, const vec_t &a, const vec_t &b, uint32_t segment );
+	void insertSide( uint32_t node, bool front, const vec_t &a, const vec_t &b, uint32_t segment );
+	uint32_t buildImpl( std::vector<BuildFragment> &fragments );
+	void retire( Handle handle );
+	Interval clip( T sideMin, T sideMax, T tMin, T tMax, T sign ) const;
+	bool intersect( const vec_t &a, const vec_t &b, const Segment &segment, T *t ) const;
+	bool segmentHitImpl( uint32_t node, const vec_t &a, const vec_t &b, T tMin, T tMax, bool any, uint32_t *result, T *resultT ) const;
+
+	std::vector<Node>	mNodes;		// the root is the first node
+	std::vector<Fragment>	mFragments;
+	std::vector<Segment>	mSegments;	// indexed by handle
+	std::vector<Handle>	mFreeSegments;
+	uint32_t		mNumStale;	// fragments of moved or removed segments
+	T			mTolerance;
+};
+
+// MARK: BSPTree Impl.
+
+// https://en.wikipedia.org/wiki/Binary_space_partitioning
+// http://www.cs.utah.edu/~jsnider/SeniorProj/BSP/default.htm
+
+template<class T, class DataT>
+BSPTree<T,DataT>::Segment::Segment( const vec_t &a, const vec_t &b, const DataT &data )
+: mA( a ), mB( b ), mData( data ), mGeneration( 0 ), mNumFragments( 0 )
+{
+}
+
+//! The splitting line goes through a and b, a degenerate segment splits along x
+template<class T, class DataT>
+BSPTree<T,DataT>::Node::Node( const vec_t &a, const vec_t &b )
+: mPoint( a ), mNormal( T( 1 ), T( 0 ) ), mFront( NO_NODE ), mBack( NO_NODE ), mFirst( NO_NODE )
+{
+	const T length = glm::length( b - a );
+	if( length > 0 )
+		mNormal = vec_t( a.y - b.y, b.x - a.x ) / length;
+}
+
+template<class T, class DataT>
+BSPTree<T,DataT>::BSPTree( T tolerance )
+: mNumStale( 0 ), mTolerance( tolerance )
+{
+}
+
+template<class T, class DataT>
+void BSPTree<T,DataT>::clear()
+{
+	mNodes.clear();
+	mFragments.clear();
+	mSegments.clear();
+	mFreeSegments.clear();
+	mNumStale = 0;
+}
+
+template<class T, class DataT>
+typename BSPTree<T,DataT>::Handle BSPTree<T,DataT>::insert( const vec_t &a, const vec_t &b, const DataT &data )
+{
+	Handle handle;
+	if( mFreeSegments.empty() ) {
+		handle = static_cast<Handle>( mSegments.size() );
+		mSegments.emplace_back( a, b, data );
+	}
+	else {
+		handle = mFreeSegments.back();
+		mFreeSegments.pop_back();
+		const uint32_t generation = mSegments[handle].mGeneration;
+		mSegments[handle] = Segment( a, b, data );
+		mSegments[handle].mGeneration = generation;
+	}
+
+	if( mNodes.empty() )
+		createNode( a, b );
+	insertImpl( 0, a, b, handle );
+	return handle;
+}
+template<class T, class DataT>
+void BSPTree<T,DataT>::remove( Handle handle )
+{
+	retire( handle );
+	mFreeSegments.push_back( handle );
+	if( mNumStale * 2 > mFragments.size() )
+		rebuild();
+}
+template<class T, class DataT>
+void BSPTree<T,DataT>::move( Handle handle, const vec_t &a, const vec_t &b )
+{
+	retire( handle );
+	mSegments[handle].mA = a;
+	mSegments[handle].mB = b;
+	insertImpl( 0, a, b, handle );
+	if( mNumStale * 2 > mFragments.size() )
+		rebuild();
+}
+//! Makes the fragments of a segment stale, they are skipped by queries until the next rebuild
+template<class T, class DataT>
+void BSPTree<T,DataT>::retire( Handle handle )
+{
+	Segment &segment = mSegments[handle];
+	mNumStale += segment.mNumFragments;
+	segment.mNumFragments = 0;
+	segment.mGeneration++;
+}
+
+template<class T, class DataT>
+uint32_t BSPTree<T,DataT>::createNode( const vec_t &a, const vec_t &b )
+{
+	mNodes.emplace_back( a, b );
+	return static_cast<uint32_t>( mNodes.size() - 1 );
+}
+template<class T, class DataT>
+void BSPTree<T,DataT>::addFragment( uint32_t node, uint32_t segment )
+{
+	mFragments.push_back( Fragment{ segment, mSegments[segment].mGeneration, mNodes[node].mFirst } );
+	mNodes[node].mFirst = static_cast<uint32_t>( mFragments.size() - 1 );
+	mSegments[segment].mNumFragments++;
+}
+//! Pushes the part ab of a segment down the tree, splitting it where it crosses a splitting line. Parts reaching an empty side start a new node there
+template<class T, class DataT>
+void BSPTree<T,DataT>::insertImpl( uint32_t node, const vec_t &a, const vec_t &b, uint32_t segment )
+{
+	const T da = mNodes[node].side( a );
+	const T db = mNodes[node].side( b );
+	if( glm::abs( da ) <= mTolerance && glm::abs( db ) <= mTolerance ) {
+		addFragment( node, segment );
+		return;
+	}
+
+	const bool inFront	= da >= -mTolerance && db >= -mTolerance;
+	const bool inBack	= da <= mTolerance && db <= mTolerance;
+	if( inFront || inBack ) {
+		insertSide( node, inFront, a, b, segment );
+		return;
+	}
+
+	// the segment crosses the line, insert each part on its side
+	const vec_t split = a + ( b - a ) * ( da / ( da - db ) );
+	insertSide( node, da > 0, a, split, segment );
+	insertSide( node, da < 0, split, b, segment );
+}
+template<class T, class DataT>
+void BSPTree<T,DataT>::insertSide( uint32_t node, bool front, const vec_t &a, const vec_t &b, uint32_t segment )
+{
+	uint32_t child = front ? mNodes[node].mFront : mNodes[node].mBack;
+	if( child == NO_NODE ) {
+		child = createNode( a, b );
+		( front ? mNodes[node].mFront : mNodes[node].mBack ) = child;
+	}
+	insertImpl( child, a, b, segment );
+}
+
+template<class T, class DataT>
+void BSPTree<T,DataT>::rebuild()
+{
+	std::vector<BuildFragment> fragments;
+	std::vector<bool> isFree( mSegments.size(), false );
+	for( Handle handle : mFreeSegments )
+		isFree[handle] = true;
+	for( uint32_t i = 0; i < mSegments.size(); ++i ) {
+		mSegments[i].mNumFragments = 0;
+		if( ! isFree[i] )
+			fragments.push_back( BuildFragment{ mSegments[i].mA, mSegments[i].mB, i } );
+	}
+
+	mNodes.clear();
+	mFragments.clear();
+	mNumStale = 0;
+	buildImpl( fragments );
+}
+//! Builds the subtree of the fragments and returns its root. The splitting line is the one of a few candidates cutting the fewest fragments, ties going to the most balanced
+template<class T, class DataT>
+uint32_t BSPTree<T,DataT>::buildImpl( std::vector<BuildFragment> &fragments )
+{
+	if( fragments.empty() )
+		return NO_NODE;
+
+	const size_t numCandidates = std::min<size_t>( fragments.size(), 8 );
+	size_t best = 0;
+	size_t bestCost = std::numeric_limits<size_t>::max();
+	for( size_t c = 0; c < numCandidates; ++c ) {
+		const size_t candidate = c * fragments.size() / numCandidates;
+		const Node line( fragments[candidate].mA, fragments[candidate].mB );
+		size_t front = 0, back = 0, splits = 0;
+		for( const BuildFragment &fragment : fragments ) {
+			const T da = line.side( fragment.mA );
+			const T db = line.side( fragment.mB );
+			if( glm::abs( da ) <= mTolerance && glm::abs( db ) <= mTolerance )
+				continue;
+			if( da >= -mTolerance && db >= -mTolerance )
+				front++;
+			else if( da <= mTolerance && db <= mTolerance )
+				back++;
+			else
+				splits++;
+		}
+		const size_t cost = 8 * splits + ( front > back ? front - back : back - front );
+		if( cost < bestCost ) {
+			bestCost	= cost;
+			best		= candidate;
+		}
+	}
+
+	const uint32_t node = createNode( fragments[best].mA, fragments[best].mB );
+	std::vector<BuildFragment> front, back;
+	for( const BuildFragment &fragment : fragments ) {
+		const T da = mNodes[node].side( fragment.mA );
+		const T db = mNodes[node].side( fragment.mB );
+		if( glm::abs( da ) <= mTolerance && glm::abs( db ) <= mTolerance )
+			addFragment( node, fragment.mSegment );
+		else if( da >= -mTolerance && db >= -mTolerance )
+			front.push_back( fragment );
+		else if( da <= mTolerance && db <= mTolerance )
+			back.push_back( fragment );
+		else {
+			const vec_t split = fragment.mA + ( fragment.mB - fragment.mA ) * ( da / ( da - db ) );
+			front.push_back( BuildFragment{ da > 0 ? fragment.mA : split, da > 0 ? split : fragment.mB, fragment.mSegment } );
+			back.push_back( BuildFragment{ da > 0 ? split : fragment.mA, da > 0 ? fragment.mB : split, fragment.mSegment } );
+		}
+	}
+	std::vector<BuildFragment>().swap( fragments );
+
+	const uint32_t frontNode	= buildImpl( front );
+	const uint32_t backNode		= buildImpl( back );
+	mNodes[node].mFront	= frontNode;
+	mNodes[node].mBack	= backNode;
+	return node;
+}
+
+template<class T, class DataT>
+bool BSPTree<T,DataT>::segmentIntersectsAny( const vec_t &a, const vec_t &b ) const
+{
+	uint32_t result;
+	T t = std::numeric_limits<T>::max();
+	return ! mNodes.empty() && segmentHitImpl( 0, a, b, 0, 1, true, &result, &t );
+}
+template<class T, class DataT>
+typename BSPTree<T,DataT>::Segment* BSPTree<T,DataT>::firstSegmentHit( const vec_t &a, const vec_t &b, T *t ) const
+{
+	uint32_t result	= NO_NODE;
+	T resultT		= std::numeric_limits<T>::max();
+	if( mNodes.empty() || ! segmentHitImpl( 0, a, b, 0, 1, false, &result, &resultT ) )
+		return nullptr;
+	if( t != nullptr )
+		*t = resultT;
+	return getSegment( result );
+}
+//! Returns the part of [tMin, tMax] where the query reaches the fragments of one side, sign is 1 for the front and -1 for the back
+template<class T, class DataT>
+typename BSPTree<T,DataT>::Interval BSPTree<T,DataT>::clip( T sideMin, T sideMax, T tMin, T tMax, T sign ) const
+{
+	// fragments of a side extend up to the tolerance past the line
+	const T g0 = sign * sideMin + mTolerance;
+	const T g1 = sign * sideMax + mTolerance;
+	if( g0 >= 0 && g1 >= 0 )
+		return Interval{ tMin, tMax };
+	if( g0 < 0 && g1 < 0 )
+		return Interval{ 1, 0 };
+	const T t = tMin + ( tMax - tMin ) * ( g0 / ( g0 - g1 ) );
+	return g0 >= 0 ? Interval{ tMin, t } : Interval{ t, tMax };
+}
+//! Returns true if ab touches the segment, with the first contact as a fraction of ab
+template<class T, class DataT>
+bool BSPTree<T,DataT>::intersect( const vec_t &a, const vec_t &b, const Segment &segment, T *t ) const
+{
+	const vec_t r = b - a;
+	const vec_t s = segment.mB - segment.mA;
+	const vec_t ac = segment.mA - a;
+	const T denominator = r.x * s.y - r.y * s.x;
+	const T acCrossR = ac.x * r.y - ac.y * r.x;
+
+	if( denominator != 0 ) {
+		const T u = ( ac.x * s.y - ac.y * s.x ) / denominator;
+		const T v = acCrossR / denominator;
+		if( u < 0 || u > 1 || v < 0 || v > 1 )
+			return false;
+		*t = u;
+		return true;
+	}
+
+	// parallel, only collinear segments can touch
+	if( acCrossR != 0 )
+		return false;
+	const T rr = glm::dot( r, r );
+	if( rr == 0 ) {
+		// the query is a point, it touches if it lies within the segment's bounds
+		if( ( ac.x * s.y - ac.y * s.x ) != 0 || glm::dot( ac, segment.mB - a ) > 0 )
+			return false;
+		*t = 0;
+		return true;
+	}
+	const T t0 = glm::dot( ac, r ) / rr;
+	const T t1 = glm::dot( segment.mB - a, r ) / rr;
+	const T first	= std::max<T>( std::min( t0, t1 ), 0 );
+	const T last	= std::min<T>( std::max( t0, t1 ), 1 );
+	if( first > last )
+		return false;
+	*t = first;
+	return true;
+}
+//! Visits the nodes along the part [tMin, tMax] of ab, the side ab starts in first. Returns true once a hit is found when any is set, otherwise keeps the nearest hit and skips the regions starting past it
+template<class T, class DataT>
+bool BSPTree<T,DataT>::segmentHitImpl( uint32_t index, const vec_t &a, const vec_t &b, T tMin, T tMax, bool any, uint32_t *result, T *resultT ) const
+{
+	const Node &node = mNodes[index];
+	const T sideMin = node.side( a + ( b - a ) * tMin );
+	const T sideMax = node.side( a + ( b - a ) * tMax );
+
+	bool hit = false;
+	if( glm::abs( sideMin ) <= mTolerance || glm::abs( sideMax ) <= mTolerance || ( sideMin > 0 ) != ( sideMax > 0 ) ) {
+		for( uint32_t f = node.mFirst; f != NO_NODE; f = mFragments[f].mNext ) {
+			const Fragment &fragment = mFragments[f];
+			const Segment &segment = mSegments[fragment.mSegment];
+			T t;
+			if( fragment.mGeneration != segment.mGeneration || ! intersect( a, b, segment, &t ) )
+				continue;
+			hit = true;
+			if( any )
+				return true;
+			if( t < *resultT ) {
+				*resultT	= t;
+				*result		= fragment.mSegment;
+			}
+		}
+	}
+
+	const Interval front	= clip( sideMin, sideMax, tMin, tMax, 1 );
+	const Interval back		= clip( sideMin, sideMax, tMin, tMax, -1 );
+	const bool frontFirst	= sideMin >= sideMax;
+	const uint32_t nearNode	= frontFirst ? node.mFront : node.mBack;
+	const uint32_t farNode	= frontFirst ? node.mBack : node.mFront;
+	const Interval &near	= frontFirst ? front : back;
+	const Interval &far		= frontFirst ? back : front;
+
+	if( nearNode != NO_NODE && ! near.empty() && near.mMin <= *resultT ) {
+		if( segmentHitImpl( nearNode, a, b, near.mMin, near.mMax, any, result, resultT ) ) {
+			hit = true;
+			if( any )
+				return true;
+		}
+	}
+	if( farNode != NO_NODE && ! far.empty() && far.mMin <= *resultT ) {
+		if( segmentHitImpl( farNode, a, b, far.mMin, far.mMax, any, result, resultT ) )
+			hit = true;
+	}
+	return hit;
+}
+
+//! Represents a 2D float BSP Tree over line segments
+template<class DataT=uint32_t> using BSPTree2 = BSPTree<float,DataT>;
+//! Represents a 2D double BSP Tree over line segments
+template<class DataT=uint32_t> using dBSPTree2 = BSPTree<double,DataT>;
+
 };
 
-};
\ No newline at end of file
+namespace sp = SpacePartitioning;
@@ -26,12 +26,19 @@
 #pragma once
 
 #include <vector>
+#include <deque>
 #include <stack>
+#include <atomic>
 #include <limits>
+#include <algorithm>
+#include <functional>
 #include <type_traits>
 
 #include "cinder/AxisAlignedBox.h"
 #include "cinder/Ray.h"
+#include "cinder/Sphere.h"
+#include "sp/Parallel.h"
+#include "sp/Visitor.h"
 
 namespace SpacePartitioning {
 
@@ -39,23 +46,53 @@ namespace SpacePartitioning {
 template<class T>
 class BVH {
 public:	
+	//! How nodes are split when building the hierarchy
+	enum BuildMethod {
+		//! Splits at the middle of the centroids along their widest axis, on the calling thread
+		MIDPOINT,
+		//! Splits where the surface area heuristic is lowest over binned centroids, building large subtrees in parallel
+		BINNED_SAH
+	};
+	
 	//! Constructs an empty Bounding Volume Hierarchy object
 	BVH( uint32_t leafSize = 4 );
-	//! Constructs a Bounding Volume Hierarchy object from a set of objects pointers
-	BVH( std::vector<T> *objects, uint32_t leafSize = 4 );
+	//! Constructs a Bounding Volume Hierarchy object from a set of objects pointers, the objects are reordered
+	BVH( std::vector<T> *objects, uint32_t leafSize = 4, BuildMethod method = BINNED_SAH );
+	
+	//! Rebuilds the hierarchy over the objects, which may have been moved, added or removed since. The objects are reordered
+	void build( BuildMethod method = BINNED_SAH );
+	//! Recomputes the bounds of the nodes bottom-up after objects moved in place, keeping the topology. Rebuilds when objects were added or removed, or when the cost of the tree grows past maxCostRatio times its cost after the last build. Returns whether it rebuilt
+	bool refit( float maxCostRatio = 1.5f );
+	//! Returns the surface area heuristic cost of the tree, the expected number of nodes and objects visited by a random ray relative to the root
+	float getCost() const { return mCost; }
+	//! Returns the cost of the tree relative to its cost after the last build. A tree built over a flat or empty root has no cost, any cost it gains since counts as infinitely worse
+	float getCostRatio() const;
+	//! Returns the number of nodes of the hierarchy
+	uint32_t getNumNodes() const { return mNumNodes; }
+	//! Returns the number of leaves of the hierarchy
+	uint32_t getNumLeafs() const { return mNumLeafs; }
 		
 	//! Returns the list of objects found within a radius around a position
 	std::deque<T*>	rangeSearch( const ci::vec3 &position, float radius );
 	//! Returns the list of objects found within a radius around a position
 	void			rangeSearch( const ci::vec3 &position, float radius, const std::function<bool(T*)> &rangeVisitor );
+	//! Calls visitor( T* ) with the objects found within a radius around a position, a visitor returning bool stops the search by returning true
+	template<class Visitor>
+	void			rangeSearch( const ci::vec3 &position, float radius, Visitor &&visitor );
 	//! Returns the list of objects found within the range of a Sphere
 	std::deque<T*>	rangeSearch( const ci::Sphere &range );
 	//! Returns the list of objects found within the range of a Sphere
 	void			rangeSearch( const ci::Sphere &range, const std::function<bool(T*)> &rangeVisitor );
+	//! Calls visitor( T* ) with the objects found within the range of a Sphere, a visitor returning bool stops the search by returning true
+	template<class Visitor>
+	void			rangeSearch( const ci::Sphere &range, Visitor &&visitor );
 	//! Returns the list of objects found within the bounds of an AxisAlignedBox
 	std::deque<T*>	rangeSearch( const ci::AxisAlignedBox &range );
 	//! Returns the list of objects found within the bounds of an AxisAlignedBox
 	void			rangeSearch( const ci::AxisAlignedBox &range, const std::function<bool(T*)> &rangeVisitor );
+	//! Calls visitor( T* ) with the objects found within the bounds of an AxisAlignedBox, a visitor returning bool stops the search by returning true
+	template<class Visitor>
+	void			rangeSearch( const ci::AxisAlignedBox &range, Visitor &&visitor );
 	
 	//! Represents the result of a raycasting test
 	class RaycastResult {
@@ -77,19 +114,24 @@ public:
 	bool raycast( const ci::Ray &ray, RaycastResult* result, bool earlyExit = false ) const;
 
 protected:
-	void build();
+	//! Centroid bins of the surface area heuristic
+	enum : uint32_t { NUM_BINS = 16 };
+	//! Subtrees smaller than this are built on the calling thread
+	enum : uint32_t { PARALLEL_BUILD_SIZE = 1 << 12 };
+	
+	void buildImpl( uint32_t index, uint32_t begin, uint32_t end, BuildMethod method, std::atomic<uint32_t> *numNodes, uint32_t parallelDepth );
+	uint32_t splitMidpoint( uint32_t begin, uint32_t end, const ci::AxisAlignedBox &centroidBounds );
+	uint32_t splitBinnedSah( uint32_t begin, uint32_t end, const ci::AxisAlignedBox &centroidBounds );
+	float calcCost() const;
+	template<class Range, class Contains, class Visitor>
+	bool rangeSearchImpl( const Range &range, const Contains &contains, Visitor &visitor );
 	
 	struct Node {
+	  bool isLeaf() const { return mNumObjects != 0; }
+	  
 	  ci::AxisAlignedBox	mBounds;
-	  uint32_t				mStart;
-	  uint32_t				mNumObjects;
-	  int32_t				mRightOffset;
-	};
-	struct BuildNode {
-		BuildNode( int32_t parent, uint32_t start, uint32_t end ) : mParentIndex( parent ), mStartIndex( start ), mEndIndex( end ) {}
-		uint32_t	mStartIndex;
-		uint32_t	mEndIndex;
-		int32_t		mParentIndex;
+	  uint32_t				mStart;			// first object of a leaf, or first of the two children of an inner node
+	  uint32_t				mNumObjects;	// zero for inner nodes
 	};
 	struct TraversalNode {
 		TraversalNode( int index, float minDist ) : mIndex( index ), mMinDist( minDist ) {}
@@ -100,23 +142,34 @@ protected:
 	uint32_t			mNumNodes;
 	uint32_t			mNumLeafs;
 	uint32_t			mLeafSize;
-	std::vector<Node>	mNodes;
+	uint32_t			mNumObjects;	// object count at the last build
+	BuildMethod			mBuildMethod;
+	float				mBuildCost;
+	float				mCost;
+	std::vector<Node>	mNodes;		// the root is the first node, siblings are next to each other
 	std::vector<T>		*mObjects;
+	
+	std::vector<ci::AxisAlignedBox>	mObjectBounds;	// scratch used by build, indexed like the objects before reordering
+	std::vector<ci::vec3>			mCentroids;
+	std::vector<uint32_t>			mBuildOrder;
 };
 
 // MARK: BVH Impl.
 
+// https://www.sci.utah.edu/~wald/Publications/2007/ParallelBVHBuild/fastbuild.pdf
+// http://www.pbr-book.org/3ed-2018/Primitives_and_Intersection_Acceleration/Bounding_Volume_Hierarchies.html
+
 template<class T>
 BVH<T>::BVH( uint32_t leafSize )
-: mNumNodes( 0 ), mNumLeafs( 0 ), mLeafSize( leafSize ), mObjects( nullptr )
+: mNumNodes( 0 ), mNumLeafs( 0 ), mLeafSize( std::max( leafSize, 1u ) ), mNumObjects( 0 ), mBuildMethod( BINNED_SAH ), mBuildCost( 0.0f ), mCost( 0.0f ), mObjects( nullptr )
 {
 }
 
 template<class T>
-BVH<T>::BVH( std::vector<T>* objects, uint32_t leafSize )
-: mNumNodes( 0 ), mNumLeafs( 0 ), mLeafSize( leafSize ), mObjects( objects )
+BVH<T>::BVH( std::vector<T>* objects, uint32_t leafSize, BuildMethod method )
+: mNumNodes( 0 ), mNumLeafs( 0 ), mLeafSize( std::max( leafSize, 1u ) ), mNumObjects( 0 ), mBuildMethod( method ), mBuildCost( 0.0f ), mCost( 0.0f ), mObjects( objects )
 {
-	build();
+	build( method );
 }
 
 namespace details {
@@ -156,9 +209,9 @@ namespace details {
 	template<class T> 
 	class BVHObjectTraits {
 	public:
-		static ci::AxisAlignedBox getBounds( const T &obj ) { static_assert( sizeof(T) == -1, "If the BVH template type doesn't have a \"getBounds\" member function, you need to specialize SpacePartitioning::details::BVHObjectTraits<> to provide an alternative." ); }
-		static ci::vec3 getCentroid( const T &obj ) { static_assert( sizeof(T) == -1, "If the BVH template type doesn't have a \"getCentroid\" member function, you need to specialize SpacePartitioning::details::BVHObjectTraits<> to provide an alternative." ); }
-		static bool intersect( const T &obj, const ci::Ray &ray, float *dist ) { static_assert( sizeof(T) == -1, "If the BVH template type doesn't have a \"intersect\" member function, you need to specialize SpacePartitioning::details::BVHObjectTraits<> to provide an alternative." ); }
+		static ci::AxisAlignedBox getBounds( const T &obj ) { static_assert( sizeof(T) == -1, "If the BVH template type doesn't have a \"getBounds\" member function, you need to specialize SpacePartitioning::details::BVHObjectTraits<> to provide an alternative." ); return {}; }
+		static ci::vec3 getCentroid( const T &obj ) { static_assert( sizeof(T) == -1, "If the BVH template type doesn't have a \"getCentroid\" member function, you need to specialize SpacePartitioning::details::BVHObjectTraits<> to provide an alternative." ); return {}; }
+		static bool intersect( const T &obj, const ci::Ray &ray, float *dist ) { static_assert( sizeof(T) == -1, "If the BVH template type doesn't have a \"intersect\" member function, you need to specialize SpacePartitioning::details::BVHObjectTraits<> to provide an alternative." ); return false; }
 	};
 	
 	template<typename T, typename std::enable_if<BVHObjectHasGetBounds<T>::value,int>::type = 0>
@@ -175,89 +228,259 @@ namespace details {
 	inline bool BVHObjectIntersect( const T &obj, const ci::Ray &ray, float *dist ) { return obj.intersect( ray, dist ); }
 	template<typename T, typename std::enable_if<!BVHObjectHasIntersect<T>::value,int>::type = 0>
 	inline bool BVHObjectIntersect( const T &obj, const ci::Ray &ray, float *dist ) { return BVHObjectTraits<T>::intersect( obj, ray, dist ); }
+	
+	//! Returns half the surface area of a box, which is all the heuristic needs
+	inline float halfSurfaceArea( const ci::vec3 &min, const ci::vec3 &max )
+	{
+		const ci::vec3 size = max - min;
+		return size.x * size.y + size.y * size.z + size.z * size.x;
+	}
 }
 
 template<class T>
-void BVH<T>::build()
+void BVH<T>::build( BuildMethod method )
 {
-	// create the working structures
-	Node node;
-	std::stack<BuildNode> stack;
-	std::vector<Node> nodes;
-	nodes.reserve( mObjects->size() * 2 );
+	mNodes.clear();
+	mNumNodes = mNumLeafs = mNumObjects = 0;
+	mBuildMethod = method;
+	mBuildCost = mCost = 0.0f;
+	if( mObjects == nullptr || mObjects->empty() )
+		return;
 	
-	// push the root node
-	BuildNode root( -1, 0, static_cast<uint32_t>( mObjects->size() ) );
-	stack.push( root );
-
-	while( ! stack.empty() ) {
-		// get the next item from the stack
-		BuildNode buildNode = stack.top();
-		stack.pop();
-		uint32_t startIndex = buildNode.mStartIndex;
-		uint32_t endIndex = buildNode.mEndIndex;
-		uint32_t numObjects = endIndex - startIndex;
-
-		node.mStart = startIndex;
-		node.mNumObjects = numObjects;
-		node.mRightOffset = 2;
-		mNumNodes++;
-
-		// get the bounding box and centroid for the current node
-		ci::AxisAlignedBox boundingBox( details::BVHObjectGetBounds( (*mObjects)[startIndex] ) );
-		ci::AxisAlignedBox boundingCentroid( details::BVHObjectGetCentroid( (*mObjects)[startIndex] ), details::BVHObjectGetCentroid( (*mObjects)[startIndex] ) );
-		for( uint32_t i = startIndex + 1; i < endIndex; ++i ) {
-			boundingBox.include( details::BVHObjectGetBounds( (*mObjects)[i] ) );
-			boundingCentroid.include( details::BVHObjectGetCentroid( (*mObjects)[i] ) );
+	// gather the bounds and centroids once, the build only moves indices around
+	const uint32_t count = static_cast<uint32_t>( mObjects->size() );
+	mObjectBounds.resize( count );
+	mCentroids.resize( count );
+	mBuildOrder.resize( count );
+	for( uint32_t i = 0; i < count; ++i ) {
+		mObjectBounds[i]	= details::BVHObjectGetBounds( (*mObjects)[i] );
+		mCentroids[i]		= details::BVHObjectGetCentroid( (*mObjects)[i] );
+		mBuildOrder[i]		= i;
+	}
+	
+	// a binary tree with count leaves at most has 2 * count - 1 nodes, children are written straight into place
+	mNodes.resize( 2 * count - 1 );
+	std::atomic<uint32_t> numNodes( 1 );
+	buildImpl( 0, 0, count, method, &numNodes, method == BINNED_SAH ? details::parallelDepth() : 0 );
+	mNumNodes = numNodes;
+	mNumLeafs = ( mNumNodes + 1 ) / 2;
+	mNumObjects = count;
+	mNodes.resize( mNumNodes );
+	mBuildCost = mCost = calcCost();
+	
+	// move the objects to the build order, following the cycles of the permutation
+	std::vector<T> &objects = *mObjects;
+	for( uint32_t i = 0; i < count; ++i ) {
+		if( mBuildOrder[i] == i )
+			continue;
+		T object = std::move( objects[i] );
+		uint32_t j = i;
+		while( mBuildOrder[j] != i ) {
+			const uint32_t next = mBuildOrder[j];
+			objects[j] = std::move( objects[next] );
+			mBuildOrder[j] = j;
+			j = next;
 		}
-		node.mBounds = boundingBox;
+		objects[j] = std::move( object );
+		mBuildOrder[j] = j;
+	}
+}
 
-		// current node is a leaf
-		if( numObjects <= mLeafSize ) {
-			node.mRightOffset = 0;
-			mNumLeafs++;
+template<class T>
+void BVH<T>::buildImpl( uint32_t index, uint32_t begin, uint32_t end, BuildMethod method, std::atomic<uint32_t> *numNodes, uint32_t parallelDepth )
+{
+	// get the bounding box and centroid for the current node
+	const uint32_t* order = mBuildOrder.data();
+	ci::AxisAlignedBox boundingBox( mObjectBounds[order[begin]] );
+	ci::AxisAlignedBox boundingCentroid( mCentroids[order[begin]], mCentroids[order[begin]] );
+	for( uint32_t i = begin + 1; i < end; ++i ) {
+		boundingBox.include( mObjectBounds[order[i]] );
+		boundingCentroid.include( mCentroids[order[i]] );
+	}
+	
+	Node &node		= mNodes[index];
+	node.mBounds	= boundingBox;
+	if( end - begin <= mLeafSize ) {
+		node.mStart			= begin;
+		node.mNumObjects	= end - begin;
+		return;
+	}
+	
+	const uint32_t split = method == MIDPOINT ? splitMidpoint( begin, end, boundingCentroid ) : splitBinnedSah( begin, end, boundingCentroid );
+	const uint32_t children	= numNodes->fetch_add( 2 );
+	node.mStart				= children;
+	node.mNumObjects		= 0;
+	
+	const uint32_t childDepth = parallelDepth ? parallelDepth - 1 : 0;
+	details::parallelInvoke( parallelDepth > 0 && end - begin >= PARALLEL_BUILD_SIZE,
+		[=] { buildImpl( children, begin, split, method, numNodes, childDepth ); },
+		[=] { buildImpl( children + 1, split, end, method, numNodes, childDepth ); } );
+}
+
+template<class T>
+bool BVH<T>::refit( float maxCostRatio )
+{
+	if( mObjects == nullptr || mObjects->size() != mNumObjects ) {
+		build( mBuildMethod );
+		return true;
+	}
+	if( mNodes.empty() )
+		return false;
+	
+	// children always come after their parent, walking the nodes backward visits them first
+	for( uint32_t i = mNumNodes; i-- > 0; ) {
+		Node &node = mNodes[i];
+		if( node.isLeaf() ) {
+			node.mBounds = details::BVHObjectGetBounds( (*mObjects)[node.mStart] );
+			for( uint32_t j = 1; j < node.mNumObjects; ++j )
+				node.mBounds.include( details::BVHObjectGetBounds( (*mObjects)[node.mStart+j] ) );
+		}
+		else {
+			node.mBounds = mNodes[node.mStart].mBounds;
+			node.mBounds.include( mNodes[node.mStart+1].mBounds );
 		}
+	}
+	
+	// the topology only fits the objects as long as the boxes did not grow or overlap much
+	mCost = calcCost();
+	if( getCostRatio() > maxCostRatio ) {
+		build( mBuildMethod );
+		return true;
+	}
+	return false;
+}
+
+template<class T>
+float BVH<T>::getCostRatio() const
+{
+	if( mBuildCost > 0.0f )
+		return mCost / mBuildCost;
+	return mCost > 0.0f ? std::numeric_limits<float>::infinity() : 1.0f;
+}
+
+//! Returns the sum of the areas of the inner nodes plus the areas of the leaves weighted by their object counts, relative to the area of the root
+template<class T>
+float BVH<T>::calcCost() const
+{
+	const ci::AxisAlignedBox &root	= mNodes.front().mBounds;
+	const float rootArea			= details::halfSurfaceArea( root.getMin(), root.getMax() );
+	if( rootArea <= 0.0f )
+		return 0.0f;
+	
+	float cost = 0.0f;
+	for( const Node &node : mNodes ) {
+		const float area = details::halfSurfaceArea( node.mBounds.getMin(), node.mBounds.getMax() );
+		cost += node.isLeaf() ? area * node.mNumObjects : area;
+	}
+	return cost / rootArea;
+}
 
-		nodes.push_back( node );
+//! Partitions the objects around the middle of their centroids along the widest axis and returns the split, halving the range when that leaves a side empty
+template<class T>
+uint32_t BVH<T>::splitMidpoint( uint32_t begin, uint32_t end, const ci::AxisAlignedBox &centroidBounds )
+{
+	// find on which axis to make the split
+	const ci::vec3 extents = centroidBounds.getExtents();
+	uint32_t splitAxis = 0;
+	if( extents.y > extents.x ) splitAxis = 1;
+	if( extents.z > extents[splitAxis] ) splitAxis = 2;
+	const float splitAxisCenter = 0.5f * ( centroidBounds.getMin()[splitAxis] + centroidBounds.getMax()[splitAxis] );
+	
+	uint32_t* order = mBuildOrder.data();
+	const uint32_t split = static_cast<uint32_t>( std::partition( order + begin, order + end, [this, splitAxis, splitAxisCenter]( uint32_t i ) {
+		return mCentroids[i][splitAxis] < splitAxisCenter;
+	} ) - order );
+	if( split == begin || split == end )
+		return begin + ( end - begin ) / 2;
+	return split;
+}
 
-		// if this is not the root find out the node's right child
-		if( buildNode.mParentIndex != -1 ) {
-			nodes[buildNode.mParentIndex].mRightOffset--;
-			if( nodes[buildNode.mParentIndex].mRightOffset == 0 ) {
-				nodes[buildNode.mParentIndex].mRightOffset = mNumNodes - 1 - buildNode.mParentIndex;
+//! Partitions the objects where the surface area heuristic is lowest, bins of centroids along each axis being the candidate splits
+template<class T>
+uint32_t BVH<T>::splitBinnedSah( uint32_t begin, uint32_t end, const ci::AxisAlignedBox &centroidBounds )
+{
+	struct Bin {
+		ci::vec3	mMin;
+		ci::vec3	mMax;
+		uint32_t	mCount;
+	};
+	
+	// bin the objects by centroid along the three axes in a single pass
+	const ci::vec3 min		= centroidBounds.getMin();
+	const ci::vec3 extent	= centroidBounds.getMax() - min;
+	ci::vec3 scale;
+	Bin bins[3][NUM_BINS];
+	for( uint32_t axis = 0; axis < 3; ++axis ) {
+		scale[axis] = extent[axis] > 0.0f ? NUM_BINS / extent[axis] : 0.0f;
+		for( Bin &bin : bins[axis] ) {
+			bin.mMin	= ci::vec3( std::numeric_limits<float>::max() );
+			bin.mMax	= ci::vec3( std::numeric_limits<float>::lowest() );
+			bin.mCount	= 0;
+		}
+	}
+	const uint32_t* order = mBuildOrder.data();
+	for( uint32_t i = begin; i < end; ++i ) {
+		const uint32_t object			= order[i];
+		const ci::AxisAlignedBox &bounds	= mObjectBounds[object];
+		for( uint32_t axis = 0; axis < 3; ++axis ) {
+			Bin &bin	= bins[axis][std::min( static_cast<uint32_t>( ( mCentroids[object][axis] - min[axis] ) * scale[axis] ), NUM_BINS - 1 )];
+			bin.mMin	= glm::min( bin.mMin, bounds.getMin() );
+			bin.mMax	= glm::max( bin.mMax, bounds.getMax() );
+			bin.mCount++;
+		}
+	}
+	
+	float bestCost		= std::numeric_limits<float>::max();
+	uint32_t bestAxis	= 3;
+	uint32_t bestBin	= 0;
+	for( uint32_t axis = 0; axis < 3; ++axis ) {
+		if( extent[axis] <= 0.0f )
+			continue;
+		
+		// sweep from the left keeping the cost of each left side, then from the right to complete it
+		float leftCost[NUM_BINS];
+		uint32_t leftCount = 0;
+		ci::vec3 leftMin( std::numeric_limits<float>::max() ), leftMax( std::numeric_limits<float>::lowest() );
+		for( uint32_t b = 0; b < NUM_BINS - 1; ++b ) {
+			const Bin &bin = bins[axis][b];
+			if( bin.mCount ) {
+				leftMin		= glm::min( leftMin, bin.mMin );
+				leftMax		= glm::max( leftMax, bin.mMax );
+				leftCount	+= bin.mCount;
 			}
+			leftCost[b] = leftCount ? leftCount * details::halfSurfaceArea( leftMin, leftMax ) : -1.0f;
 		}
-
-		// subdivide only if the current node is a leaf
-		if( node.mRightOffset != 0 ) {
-			// find on which axis to make the split
-			uint32_t splitAxis = 0;
-			if( boundingCentroid.getExtents().y > boundingCentroid.getExtents().x ) splitAxis = 1;
-			if( boundingCentroid.getExtents().z > boundingCentroid.getExtents().y ) splitAxis = 2;
-			float splitAxisCenter = 0.5f * ( boundingCentroid.getMin()[splitAxis] + boundingCentroid.getMax()[splitAxis] );
-
-			// find the center split index
-			uint32_t splitIndex = startIndex;
-			for( uint32_t i = startIndex; i < endIndex; ++i ) {
-				if( details::BVHObjectGetCentroid( (*mObjects)[i] )[splitAxis] < splitAxisCenter ) {
-					std::swap( (*mObjects)[i], (*mObjects)[splitIndex] );
-					++splitIndex;
-				}
+		uint32_t rightCount = 0;
+		ci::vec3 rightMin( std::numeric_limits<float>::max() ), rightMax( std::numeric_limits<float>::lowest() );
+		for( uint32_t b = NUM_BINS - 1; b > 0; --b ) {
+			const Bin &bin = bins[axis][b];
+			if( bin.mCount ) {
+				rightMin	= glm::min( rightMin, bin.mMin );
+				rightMax	= glm::max( rightMax, bin.mMax );
+				rightCount	+= bin.mCount;
 			}
-			if( splitIndex == startIndex || splitIndex == endIndex ) {
-				splitIndex = startIndex + ( endIndex - startIndex ) / 2;
+			// splitting before bin b, both sides have to hold objects
+			if( ! rightCount || leftCost[b - 1] < 0.0f )
+				continue;
+			const float cost = leftCost[b - 1] + rightCount * details::halfSurfaceArea( rightMin, rightMax );
+			if( cost < bestCost ) {
+				bestCost	= cost;
+				bestAxis	= axis;
+				bestBin		= b;
 			}
-
-			// push left & right children to the stack
-			stack.push( BuildNode( mNumNodes - 1, startIndex, splitIndex ) );
-			stack.push( BuildNode( mNumNodes - 1, splitIndex, endIndex ) );
 		}
 	}
-
-	// Copy the temp node data to a flat array
-	for( size_t i = 0; i < mNumNodes; ++i ) { 
-		mNodes.push_back( nodes[i] );
-	}
+	
+	// every centroid is at the same place
+	if( bestAxis == 3 )
+		return begin + ( end - begin ) / 2;
+	
+	const float axisMin		= min[bestAxis];
+	const float axisScale	= scale[bestAxis];
+	uint32_t* first			= mBuildOrder.data();
+	return static_cast<uint32_t>( std::partition( first + begin, first + end, [this, bestAxis, bestBin, axisMin, axisScale]( uint32_t i ) {
+		return std::min( static_cast<uint32_t>( ( mCentroids[i][bestAxis] - axisMin ) * axisScale ), NUM_BINS - 1 ) < bestBin;
+	} ) - first );
 }
 
 template<class T>
@@ -280,28 +503,28 @@ bool BVH<T>::raycast( const ci::Ray &ray, RaycastResult* result, bool earlyExit
 	stack.push( TraversalNode( 0, std::numeric_limits<float>::lowest() ) );
 
 	while( ! stack.empty() ) {
-		// pop the current node
-		const TraversalNode &traversalNode = stack.top();
+		// pop the current node, by value as the pushes below would invalidate a reference
+		const TraversalNode traversalNode = stack.top();
 		const Node &node( mNodes[traversalNode.mIndex] );
 		stack.pop();
 		
 		// if this node is closer than the closest found intersection
 		if( traversalNode.mMinDist <= result->mDistance ) {
 			// if the node is a leaf check its objects for intersection
-			if( node.mRightOffset == 0 ) {
+			if( node.isLeaf() ) {
 				for( uint32_t i = 0; i < node.mNumObjects; ++i ) {
 					const T& obj = (*mObjects)[node.mStart+i];
 					if( details::BVHObjectIntersect( obj, ray, &intersectionDist ) ) {
-						result->mObject = &(*mObjects)[node.mStart+i];
-
 						// exit early if we're not interested in the closest intersection
 						if( earlyExit ) {
+							result->mObject = &(*mObjects)[node.mStart+i];
 							result->mDistance = intersectionDist;
 							result->mPosition = ray.calcPosition( intersectionDist );
 							return true;
 						}
-						// otherwise keep the intersection results
+						// otherwise keep the closest intersection results
 						if( intersectionDist < result->mDistance ) {
+							result->mObject = &(*mObjects)[node.mStart+i];
 							result->mDistance = intersectionDist;
 						}
 					}
@@ -309,12 +532,12 @@ bool BVH<T>::raycast( const ci::Ray &ray, RaycastResult* result, bool earlyExit
 			} 
 			else {
 				// check if intersecting with both bounding boxes
-				bool hit0 = mNodes[traversalNode.mIndex+1].mBounds.intersect( ray, &aabIntersectDist[0], &aabIntersectDist[1] ) > 0;
-				bool hit1 = mNodes[traversalNode.mIndex+node.mRightOffset].mBounds.intersect( ray, &aabIntersectDist[2], &aabIntersectDist[3] ) > 0;
+				bool hit0 = mNodes[node.mStart].mBounds.intersect( ray, &aabIntersectDist[0], &aabIntersectDist[1] ) > 0;
+				bool hit1 = mNodes[node.mStart+1].mBounds.intersect( ray, &aabIntersectDist[2], &aabIntersectDist[3] ) > 0;
 				if( hit0 && hit1 ) {
 					// find out which node is farther
-					closer = traversalNode.mIndex+1;
-					farther = traversalNode.mIndex+node.mRightOffset;
+					closer = node.mStart;
+					farther = node.mStart+1;
 					if( aabIntersectDist[2] < aabIntersectDist[0] ) {
 						std::swap( aabIntersectDist[0], aabIntersectDist[2] );
 						std::swap( aabIntersectDist[1], aabIntersectDist[3] );
@@ -325,10 +548,10 @@ bool BVH<T>::raycast( const ci::Ray &ray, RaycastResult* result, bool earlyExit
 					stack.push( TraversalNode( closer, aabIntersectDist[0] ) );
 				}
 				else if( hit0 ) {
-					stack.push( TraversalNode( traversalNode.mIndex + 1, aabIntersectDist[0] ) );
+					stack.push( TraversalNode( node.mStart, aabIntersectDist[0] ) );
 				}
 				else if( hit1 ) {
-					stack.push( TraversalNode( traversalNode.mIndex + node.mRightOffset, aabIntersectDist[2] ) );
+					stack.push( TraversalNode( node.mStart + 1, aabIntersectDist[2] ) );
 				}
 			}
 		}
@@ -351,195 +574,79 @@ std::deque<T*> BVH<T>::rangeSearch( const ci::vec3 &position, float radius )
 template<class T>
 void BVH<T>::rangeSearch( const ci::vec3 &position, float radius, const std::function<bool( T* )> &rangeVisitor )
 {
-	return rangeSearch( ci::Sphere( position, radius, rangeVisitor ) );
+	rangeSearch( ci::Sphere( position, radius ), rangeVisitor );
+}
+
+template<class T>
+template<class Visitor>
+void BVH<T>::rangeSearch( const ci::vec3 &position, float radius, Visitor &&visitor )
+{
+	rangeSearch( ci::Sphere( position, radius ), std::forward<Visitor>( visitor ) );
 }
 
 template<class T>
 std::deque<T*> BVH<T>::rangeSearch( const ci::Sphere &sphere )
 {
 	std::deque<T*> results;
-	
-	// return an empty vector if BVH has not been initialized
-	if( mNodes.empty() ) {
-		return results;
-	}
-
-	// initialize the working structure and temp values
-	std::stack<TraversalNode> stack;
-	uint32_t closer, farther;
-	float sqRadius = sphere.getRadius() * sphere.getRadius();
-	
-	// push the root node
-	stack.push( TraversalNode( 0, std::numeric_limits<float>::lowest() ) );
-	
-	while( ! stack.empty() ) {
-		// pop the current node
-		const TraversalNode &traversalNode = stack.top();
-		const Node &node( mNodes[traversalNode.mIndex] );
-		stack.pop();
-		
-		// if the node is a leaf check its objects are within the range
-		if( node.mRightOffset == 0 ) {
-			for( uint32_t i = 0; i < node.mNumObjects; ++i ) {
-				const T& obj = (*mObjects)[node.mStart+i];
-				if( glm::distance2( obj.getCentroid(), sphere.getCenter() ) < sqRadius ) {
-					results.emplace_back( &(*mObjects)[node.mStart+i] );
-				}
-			}
-		} 
-		else {
-			// check if intersecting with both bounding boxes
-			bool hit0 = mNodes[traversalNode.mIndex+1].mBounds.intersects( sphere );
-			bool hit1 = mNodes[traversalNode.mIndex+node.mRightOffset].mBounds.intersects( sphere );
-			if( hit0 && hit1 ) {
-				// find out which node is farther
-				closer = traversalNode.mIndex+1;
-				farther = traversalNode.mIndex+node.mRightOffset;
-				if( glm::distance2( mNodes[traversalNode.mIndex+node.mRightOffset].mBounds.getCenter(), sphere.getCenter() ) < glm::distance2( mNodes[traversalNode.mIndex+1].mBounds.getCenter(), sphere.getCenter() ) ) {
-					std::swap( closer, farther );
-				}
-				// and push it first
-				stack.push( TraversalNode( farther, 0.0f ) );
-				stack.push( TraversalNode( closer, 0.0f ) );
-			}
-			else if( hit0 ) {
-				stack.push( TraversalNode( traversalNode.mIndex + 1, 0.0f ) );
-			}
-			else if( hit1 ) {
-				stack.push( TraversalNode( traversalNode.mIndex + node.mRightOffset, 0.0f ) );
-			}
-		}
-		
-	}
-
+	rangeSearch( sphere, [&results]( T* obj ) {
+		results.emplace_back( obj );
+	} );
 	return results;
 }
 
 template<class T>
 void BVH<T>::rangeSearch( const ci::Sphere &sphere, const std::function<bool( T* )> &rangeVisitor )
 {
-	// return an empty vector if BVH has not been initialized
-	if( mNodes.empty() ) {
-		return;
-	}
+	const float sqRadius = sphere.getRadius() * sphere.getRadius();
+	rangeSearchImpl( sphere, [&sphere, sqRadius]( const T &obj ) {
+		return glm::distance2( details::BVHObjectGetCentroid( obj ), sphere.getCenter() ) < sqRadius;
+	}, rangeVisitor );
+}
 
-	// initialize the working structure and temp values
-	std::stack<TraversalNode> stack;
-	uint32_t closer, farther;
-	float sqRadius = sphere.getRadius() * sphere.getRadius();
-	
-	// push the root node
-	stack.push( TraversalNode( 0, std::numeric_limits<float>::lowest() ) );
-	
-	while( ! stack.empty() ) {
-		// pop the current node
-		const TraversalNode &traversalNode = stack.top();
-		const Node &node( mNodes[traversalNode.mIndex] );
-		stack.pop();
-		
-		// if the node is a leaf check its objects are within the range
-		if( node.mRightOffset == 0 ) {
-			for( uint32_t i = 0; i < node.mNumObjects; ++i ) {
-				const T& obj = (*mObjects)[node.mStart+i];
-				if( glm::distance2( obj.getCentroid(), sphere.getCenter() ) < sqRadius ) {
-					if( rangeVisitor( &(*mObjects)[node.mStart+i] ) ) {
-						return;
-					}
-				}
-			}
-		} 
-		else {
-			// check if intersecting with both bounding boxes
-			bool hit0 = mNodes[traversalNode.mIndex+1].mBounds.intersects( sphere );
-			bool hit1 = mNodes[traversalNode.mIndex+node.mRightOffset].mBounds.intersects( sphere );
-			if( hit0 && hit1 ) {
-				// find out which node is farther
-				closer = traversalNode.mIndex+1;
-				farther = traversalNode.mIndex+node.mRightOffset;
-				if( glm::distance2( mNodes[traversalNode.mIndex+node.mRightOffset].mBounds.getCenter(), sphere.getCenter() ) < glm::distance2( mNodes[traversalNode.mIndex+1].mBounds.getCenter(), sphere.getCenter() ) ) {
-					std::swap( closer, farther );
-				}
-				// and push it first
-				stack.push( TraversalNode( farther, 0.0f ) );
-				stack.push( TraversalNode( closer, 0.0f ) );
-			}
-			else if( hit0 ) {
-				stack.push( TraversalNode( traversalNode.mIndex + 1, 0.0f ) );
-			}
-			else if( hit1 ) {
-				stack.push( TraversalNode( traversalNode.mIndex + node.mRightOffset, 0.0f ) );
-			}
-		}
-		
-	}
+template<class T>
+template<class Visitor>
+void BVH<T>::rangeSearch( const ci::Sphere &sphere, Visitor &&visitor )
+{
+	const float sqRadius = sphere.getRadius() * sphere.getRadius();
+	rangeSearchImpl( sphere, [&sphere, sqRadius]( const T &obj ) {
+		return glm::distance2( details::BVHObjectGetCentroid( obj ), sphere.getCenter() ) < sqRadius;
+	}, visitor );
 }
 
 template<class T>
 std::deque<T*> BVH<T>::rangeSearch( const ci::AxisAlignedBox &range )
 {
 	std::deque<T*> results;
-	
-	// return an empty vector if BVH has not been initialized
-	if( mNodes.empty() ) {
-		return results;
-	}
-
-	// initialize the working structure and temp values
-	std::stack<TraversalNode> stack;
-	uint32_t closer, farther;
-	
-	// push the root node
-	stack.push( TraversalNode( 0, std::numeric_limits<float>::lowest() ) );
-	
-	while( ! stack.empty() ) {
-		// pop the current node
-		const TraversalNode &traversalNode = stack.top();
-		const Node &node( mNodes[traversalNode.mIndex] );
-		stack.pop();
-		
-		// if the node is a leaf check its objects are within the range
-		if( node.mRightOffset == 0 ) {
-			for( uint32_t i = 0; i < node.mNumObjects; ++i ) {
-				const T& obj = (*mObjects)[node.mStart+i];
-				if( obj.getBounds().intersects( range ) ) {
-					results.emplace_back( &(*mObjects)[node.mStart+i] );
-				}
-			}
-		} 
-		else {
-			// check if intersecting with both bounding boxes
-			bool hit0 = mNodes[traversalNode.mIndex+1].mBounds.intersects( range );
-			bool hit1 = mNodes[traversalNode.mIndex+node.mRightOffset].mBounds.intersects( range );
-			if( hit0 && hit1 ) {
-				// find out which node is farther
-				closer = traversalNode.mIndex+1;
-				farther = traversalNode.mIndex+node.mRightOffset;
-				if( glm::distance2( mNodes[traversalNode.mIndex+node.mRightOffset].mBounds.getCenter(), range.getCenter() ) < glm::distance2( mNodes[traversalNode.mIndex+1].mBounds.getCenter(), range.getCenter() ) ) {
-					std::swap( closer, farther );
-				}
-				// and push it first
-				stack.push( TraversalNode( farther, 0.0f ) );
-				stack.push( TraversalNode( closer, 0.0f ) );
-			}
-			else if( hit0 ) {
-				stack.push( TraversalNode( traversalNode.mIndex + 1, 0.0f ) );
-			}
-			else if( hit1 ) {
-				stack.push( TraversalNode( traversalNode.mIndex + node.mRightOffset, 0.0f ) );
-			}
-		}
-		
-	}
-
+	rangeSearch( range, [&results]( T* obj ) {
+		results.emplace_back( obj );
+	} );
 	return results;
 }
 
 template<class T>
 void BVH<T>::rangeSearch( const ci::AxisAlignedBox &range, const std::function<bool( T* )> &rangeVisitor )
 {
-	// return an empty vector if BVH has not been initialized
+	rangeSearchImpl( range, [&range]( const T &obj ) {
+		return details::BVHObjectGetBounds( obj ).intersects( range );
+	}, rangeVisitor );
+}
+
+template<class T>
+template<class Visitor>
+void BVH<T>::rangeSearch( const ci::AxisAlignedBox &range, Visitor &&visitor )
+{
+	rangeSearchImpl( range, [&range]( const T &obj ) {
+		return details::BVHObjectGetBounds( obj ).intersects( range );
+	}, visitor );
+}
+
+template<class T>
+template<class Range, class Contains, class Visitor>
+bool BVH<T>::rangeSearchImpl( const Range &range, const Contains &contains, Visitor &visitor )
+{
+	// return early if BVH has not been initialized
 	if( mNodes.empty() ) {
-		return;
+		return false;
 	}
 
 	// initialize the working structure and temp values
@@ -550,31 +657,29 @@ void BVH<T>::rangeSearch( const ci::AxisAlignedBox &range, const std::function<b
 	stack.push( TraversalNode( 0, std::numeric_limits<float>::lowest() ) );
 	
 	while( ! stack.empty() ) {
-		// pop the current node
-		const TraversalNode &traversalNode = stack.top();
+		// pop the current node, by value as the pushes below would invalidate a reference
+		const TraversalNode traversalNode = stack.top();
 		const Node &node( mNodes[traversalNode.mIndex] );
 		stack.pop();
 		
 		// if the node is a leaf check its objects are within the range
-		if( node.mRightOffset == 0 ) {
+		if( node.isLeaf() ) {
 			for( uint32_t i = 0; i < node.mNumObjects; ++i ) {
-				const T& obj = (*mObjects)[node.mStart+i];
-				if( obj.getBounds().intersects( range ) ) {
-					if( rangeVisitor( &(*mObjects)[node.mStart+i] ) ) {
-						return;
-					}
+				T* obj = &(*mObjects)[node.mStart+i];
+				if( contains( *obj ) && details::visit( visitor, obj ) ) {
+					return true;
 				}
 			}
 		} 
 		else {
 			// check if intersecting with both bounding boxes
-			bool hit0 = mNodes[traversalNode.mIndex+1].mBounds.intersects( range );
-			bool hit1 = mNodes[traversalNode.mIndex+node.mRightOffset].mBounds.intersects( range );
+			bool hit0 = mNodes[node.mStart].mBounds.intersects( range );
+			bool hit1 = mNodes[node.mStart+1].mBounds.intersects( range );
 			if( hit0 && hit1 ) {
 				// find out which node is farther
-				closer = traversalNode.mIndex+1;
-				farther = traversalNode.mIndex+node.mRightOffset;
-				if( glm::distance2( mNodes[traversalNode.mIndex+node.mRightOffset].mBounds.getCenter(), range.getCenter() ) < glm::distance2( mNodes[traversalNode.mIndex+1].mBounds.getCenter(), range.getCenter() ) ) {
+				closer = node.mStart;
+				farther = node.mStart+1;
+				if( glm::distance2( mNodes[farther].mBounds.getCenter(), range.getCenter() ) < glm::distance2( mNodes[closer].mBounds.getCenter(), range.getCenter() ) ) {
 					std::swap( closer, farther );
 				}
 				// and push it first
@@ -582,14 +687,15 @@ void BVH<T>::rangeSearch( const ci::AxisAlignedBox &range, const std::function<b
 				stack.push( TraversalNode( closer, 0.0f ) );
 			}
 			else if( hit0 ) {
-				stack.push( TraversalNode( traversalNode.mIndex + 1, 0.0f ) );
+				stack.push( TraversalNode( node.mStart, 0.0f ) );
 			}
 			else if( hit1 ) {
-				stack.push( TraversalNode( traversalNode.mIndex + node.mRightOffset, 0.0f ) );
+				stack.push( TraversalNode( node.mStart + 1, 0.0f ) );
 			}
 		}
 		
 	}
+	return false;
 }
 
 };
@@ -0,0 +1,560 @@
+/*
+ BVH2 - Space Partitioning algorithms for Cinder
+ 
+ Copyright (c) 2016, Simon Geilfus, All rights reserved.
+ This code is intended for use with the Cinder C++ library: http://libcinder.org
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+	the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+	the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <limits>
+#include <algorithm>
+#include <type_traits>
+
+#include "cinder/Rect.h"
+#include "cinder/Vector.h"
+#include "sp/Parallel.h"
+#include "sp/Visitor.h"
+
+namespace SpacePartitioning {
+
+//! Represents a 2D Bounding Volume Hierarchy over axis aligned rectangles, for segment casts and overlap tests. T needs to implement "ci::Rectf getBounds() const", "vec2 getCentroid() const" and "bool intersect( const vec2 &a, const vec2 &b, float *t ) const", t being the first contact as a fraction of ab, or you need to specialize BVH2ObjectTraits with the relevant functions. Queries don't allocate
+template<class T>
+class BVH2 {
+public:
+	//! Constructs an empty 2D Bounding Volume Hierarchy object
+	BVH2( uint32_t leafSize = 4 );
+	//! Constructs a 2D Bounding Volume Hierarchy object from a set of objects pointers, the objects are reordered
+	BVH2( std::vector<T> *objects, uint32_t leafSize = 4 );
+	
+	//! Rebuilds the hierarchy over the objects, which may have been moved, added or removed since. The objects are reordered
+	void build();
+	//! Returns the number of nodes of the hierarchy
+	uint32_t getNumNodes() const { return static_cast<uint32_t>( mNodes.size() ); }
+	//! Returns the number of leaves of the hierarchy
+	uint32_t getNumLeafs() const { return static_cast<uint32_t>( ( mNodes.size() + 1 ) / 2 ); }
+	
+	//! Returns true if the segment ab intersects any object
+	bool	segmentIntersectsAny( const ci::vec2 &a, const ci::vec2 &b ) const;
+	//! Returns the first object hit going from a to b, or nullptr if there is none. t receives the hit as a fraction of ab
+	T*		firstSegmentHit( const ci::vec2 &a, const ci::vec2 &b, float *t = nullptr ) const;
+	//! Calls visitor( T* ) with the objects whose bounds overlap a rectangle, a visitor returning bool stops the search by returning true
+	template<class Visitor>
+	void	overlapSearch( const ci::Rectf &range, Visitor &&visitor ) const;
+	//! Calls visitor( T* ) with the objects whose bounds overlap a disc, a visitor returning bool stops the search by returning true
+	template<class Visitor>
+	void	overlapSearch( const ci::vec2 &position, float radius, Visitor &&visitor ) const;
+	
+protected:
+	//! Centroid bins of the surface area heuristic
+	enum : uint32_t { NUM_BINS = 16 };
+	//! Subtrees smaller than this are built on the calling thread
+	enum : uint32_t { PARALLEL_BUILD_SIZE = 1 << 12 };
+	//! Depth after which nodes are split at the median, which bounds the depth of the tree by MAX_DEPTH and the traversal stack by STACK_SIZE
+	enum : uint32_t { MAX_SAH_DEPTH = 32, MAX_DEPTH = MAX_SAH_DEPTH + 32, STACK_SIZE = MAX_DEPTH + 1 };
+	
+	struct Node {
+		bool isLeaf() const { return mNumObjects != 0; }
+		
+		ci::vec2	mMin;
+		ci::vec2	mMax;
+		uint32_t	mStart;			// first object of a leaf, or first of the two children of an inner node
+		uint32_t	mNumObjects;	// zero for inner nodes
+	};
+	//! Segment from a to b with the inverse of its direction precomputed for the slab tests
+	struct Segment {
+		Segment( const ci::vec2 &a, const ci::vec2 &b );
+		//! Returns whether the segment crosses a box before tMax, with the fraction of ab where it enters it
+		bool intersects( const ci::vec2 &min, const ci::vec2 &max, float tMax, float *tEnter ) const;
+		
+		ci::vec2	mA;
+		ci::vec2	mB;
+		ci::vec2	mInvDir;
+		bool		mFlat[2];	// the segment is parallel to the axis
+	};
+	
+	void buildImpl( uint32_t index, uint32_t begin, uint32_t end, uint32_t depth, std::atomic<uint32_t> *numNodes, uint32_t parallelDepth );
+	uint32_t splitBinnedSah( uint32_t begin, uint32_t end, const ci::vec2 &centroidMin, const ci::vec2 &centroidMax );
+	uint32_t splitMedian( uint32_t begin, uint32_t end, const ci::vec2 &centroidMin, const ci::vec2 &centroidMax );
+	template<class Overlaps, class Visitor>
+	bool overlapSearchImpl( const Overlaps &overlaps, Visitor &visitor ) const;
+	
+	uint32_t			mLeafSize;
+	std::vector<Node>	mNodes;		// the root is the first node, siblings are next to each other
+	std::vector<T>		*mObjects;
+	
+	std::vector<ci::Rectf>	mObjectBounds;	// scratch used by build, indexed like the objects before reordering
+	std::vector<ci::vec2>	mCentroids;
+	std::vector<uint32_t>	mBuildOrder;
+};
+
+// MARK: BVH2 Impl.
+
+// https://www.sci.utah.edu/~wald/Publications/2007/ParallelBVHBuild/fastbuild.pdf
+// https://tavianator.com/2011/ray_box.html
+
+namespace details {
+	
+	//! Detects if a class has a ci::Rectf getBounds() function
+	template<typename C>
+	struct BVH2ObjectHasGetBounds {
+	private:
+		template<typename T> static constexpr auto check(T*) -> typename std::is_same<decltype( std::declval<T>().getBounds() ),ci::Rectf>::type;
+		template<typename> static constexpr std::false_type check(...);
+		typedef decltype(check<C>(0)) type;
+	public:
+		static constexpr bool value = type::value;
+	};
+	//! Detects if a class has a ci::vec2 getCentroid() function
+	template<typename C>
+	struct BVH2ObjectHasGetCentroid {
+	private:
+		template<typename T> static constexpr auto check(T*) -> typename std::is_same<decltype( std::declval<T>().getCentroid() ),ci::vec2>::type;
+		template<typename> static constexpr std::false_type check(...);
+		typedef decltype(check<C>(0)) type;
+	public:
+		static constexpr bool value = type::value;
+	};
+	//! Detects if a class has a bool intersect( const ci::vec2 &, const ci::vec2 &, float* ) function
+	template<typename C>
+	struct BVH2ObjectHasIntersect {
+	private:
+		template<typename T> static constexpr auto check(T*) -> typename std::is_same<decltype( std::declval<T>().intersect( std::declval<const ci::vec2&>(), std::declval<const ci::vec2&>(), std::declval<float*>() ) ),bool>::type;
+		template<typename> static constexpr std::false_type check(...);
+		typedef decltype(check<C>(0)) type;
+	public:
+		static constexpr bool value = type::value;
+	};
+	
+	//! Traits class used if one of the 3 methods are not found in the BVH2 template type
+	template<class T>
+	class BVH2ObjectTraits {
+	public:
+		static ci::Rectf getBounds( const T &obj ) { static_assert( sizeof(T) == -1, "If the BVH2 template type doesn't have a \"getBounds\" member function, you need to specialize SpacePartitioning::details::BVH2ObjectTraits<> to provide an alternative." ); return {}; }
+		static ci::vec2 getCentroid( const T &obj ) { static_assert( sizeof(T) == -1, "If the BVH2 template type doesn't have a \"getCentroid\" member function, you need to specialize SpacePartitioning::details::BVH2ObjectTraits<> to provide an alternative." ); return {}; }
+		static bool intersect( const T &obj, const ci::vec2 &a, const ci::vec2 &b, float *t ) { static_assert( sizeof(T) == -1, "If the BVH2 template type doesn't have a \"intersect\" member function, you need to specialize SpacePartitioning::details::BVH2ObjectTraits<> to provide an alternative." ); return false; }
+	};
+	
+	template<typename T, typename std::enable_if<BVH2ObjectHasGetBounds<T>::value,int>::type = 0>
+	inline ci::Rectf BVH2ObjectGetBounds( const T &obj ) { return obj.getBounds(); }
+	template<typename T, typename std::enable_if<!BVH2ObjectHasGetBounds<T>::value,int>::type = 0>
+	inline ci::Rectf BVH2ObjectGetBounds( const T &obj ) { return BVH2ObjectTraits<T>::getBounds( obj ); }
+	
+	template<typename T, typename std::enable_if<BVH2ObjectHasGetCentroid<T>::value,int>::type = 0>
+	inline ci::vec2 BVH2ObjectGetCentroid( const T &obj ) { return obj.getCentroid(); }
+	template<typename T, typename std::enable_if<!BVH2ObjectHasGetCentroid<T>::value,int>::type = 0>
+	inline ci::vec2 BVH2ObjectGetCentroid( const T &obj ) { return BVH2ObjectTraits<T>::getCentroid( obj ); }
+	
+	template<typename T, typename std::enable_if<BVH2ObjectHasIntersect<T>::value,int>::type = 0>
+	inline bool BVH2ObjectIntersect( const T &obj, const ci::vec2 &a, const ci::vec2 &b, float *t ) { return obj.intersect( a, b, t ); }
+	template<typename T, typename std::enable_if<!BVH2ObjectHasIntersect<T>::value,int>::type = 0>
+	inline bool BVH2ObjectIntersect( const T &obj, const ci::vec2 &a, const ci::vec2 &b, float *t ) { return BVH2ObjectTraits<T>::intersect( obj, a, b, t ); }
+	
+	//! Returns half the perimeter of a rectangle, the 2D surface area heuristic only needs it
+	inline float halfPerimeter( const ci::vec2 &min, const ci::vec2 &max )
+	{
+		const ci::vec2 size = max - min;
+		return size.x + size.y;
+	}
+}
+
+template<class T>
+BVH2<T>::BVH2( uint32_t leafSize )
+: mLeafSize( std::max( leafSize, 1u ) ), mObjects( nullptr )
+{
+}
+
+template<class T>
+BVH2<T>::BVH2( std::vector<T>* objects, uint32_t leafSize )
+: mLeafSize( std::max( leafSize, 1u ) ), mObjects( objects )
+{
+	build();
+}
+
+template<class T>
+void BVH2<T>::build()
+{
+	mNodes.clear();
+	if( mObjects == nullptr || mObjects->empty() )
+		return;
+	
+	// gather the bounds and centroids once, the build only moves indices around
+	const uint32_t count = static_cast<uint32_t>( mObjects->size() );
+	mObjectBounds.resize( count );
+	mCentroids.resize( count );
+	mBuildOrder.resize( count );
+	for( uint32_t i = 0; i < count; ++i ) {
+		mObjectBounds[i]	= details::BVH2ObjectGetBounds( (*mObjects)[i] );
+		mCentroids[i]		= details::BVH2ObjectGetCentroid( (*mObjects)[i] );
+		mBuildOrder[i]		= i;
+	}
+	
+	// a binary tree with count leaves at most has 2 * count - 1 nodes, children are written straight into place
+	mNodes.resize( 2 * count - 1 );
+	std::atomic<uint32_t> numNodes( 1 );
+	buildImpl( 0, 0, count, 0, &numNodes, details::parallelDepth() );
+	mNodes.resize( numNodes );
+	
+	// move the objects to the build order, following the cycles of the permutation
+	std::vector<T> &objects = *mObjects;
+	for( uint32_t i = 0; i < count; ++i ) {
+		if( mBuildOrder[i] == i )
+			continue;
+		T object = std::move( objects[i] );
+		uint32_t j = i;
+		while( mBuildOrder[j] != i ) {
+			const uint32_t next = mBuildOrder[j];
+			objects[j] = std::move( objects[next] );
+			mBuildOrder[j] = j;
+			j = next;
+		}
+		objects[j] = std::move( object );
+		mBuildOrder[j] = j;
+	}
+}
+
+template<class T>
+void BVH2<T>::buildImpl( uint32_t index, uint32_t begin, uint32_t end, uint32_t depth, std::atomic<uint32_t> *numNodes, uint32_t parallelDepth )
+{
+	// get the bounding box and centroid for the current node
+	const uint32_t* order = mBuildOrder.data();
+	ci::vec2 min( mObjectBounds[order[begin]].getUpperLeft() ), max( mObjectBounds[order[begin]].getLowerRight() );
+	ci::vec2 centroidMin( mCentroids[order[begin]] ), centroidMax( centroidMin );
+	for( uint32_t i = begin + 1; i < end; ++i ) {
+		const ci::Rectf &bounds = mObjectBounds[order[i]];
+		min			= glm::min( min, bounds.getUpperLeft() );
+		max			= glm::max( max, bounds.getLowerRight() );
+		centroidMin	= glm::min( centroidMin, mCentroids[order[i]] );
+		centroidMax	= glm::max( centroidMax, mCentroids[order[i]] );
+	}
+	
+	Node &node	= mNodes[index];
+	node.mMin	= min;
+	node.mMax	= max;
+	if( end - begin <= mLeafSize ) {
+		node.mStart			= begin;
+		node.mNumObjects	= end - begin;
+		return;
+	}
+	
+	const uint32_t split	= depth < MAX_SAH_DEPTH ? splitBinnedSah( begin, end, centroidMin, centroidMax ) : splitMedian( begin, end, centroidMin, centroidMax );
+	const uint32_t children	= numNodes->fetch_add( 2 );
+	node.mStart				= children;
+	node.mNumObjects		= 0;
+	
+	const uint32_t childDepth = parallelDepth ? parallelDepth - 1 : 0;
+	details::parallelInvoke( parallelDepth > 0 && end - begin >= PARALLEL_BUILD_SIZE,
+		[=] { buildImpl( children, begin, split, depth + 1, numNodes, childDepth ); },
+		[=] { buildImpl( children + 1, split, end, depth + 1, numNodes, childDepth ); } );
+}
+
+//! Partitions the objects where the surface area heuristic is lowest, bins of centroids along each axis being the candidate splits. Falls back to the median when every centroid is at the same place
+template<class T>
+uint32_t BVH2<T>::splitBinnedSah( uint32_t begin, uint32_t end, const ci::vec2 &centroidMin, const ci::vec2 &centroidMax )
+{
+	struct Bin {
+		ci::vec2	mMin;
+		ci::vec2	mMax;
+		uint32_t	mCount;
+	};
+	
+	// bin the objects by centroid along both axes in a single pass
+	const ci::vec2 extent = centroidMax - centroidMin;
+	ci::vec2 scale;
+	Bin bins[2][NUM_BINS];
+	for( uint32_t axis = 0; axis < 2; ++axis ) {
+		scale[axis] = extent[axis] > 0.0f ? NUM_BINS / extent[axis] : 0.0f;
+		for( Bin &bin : bins[axis] ) {
+			bin.mMin	= ci::vec2( std::numeric_limits<float>::max() );
+			bin.mMax	= ci::vec2( std::numeric_limits<float>::lowest() );
+			bin.mCount	= 0;
+		}
+	}
+	const uint32_t* order = mBuildOrder.data();
+	for( uint32_t i = begin; i < end; ++i ) {
+		const uint32_t object		= order[i];
+		const ci::Rectf &bounds		= mObjectBounds[object];
+		for( uint32_t axis = 0; axis < 2; ++axis ) {
+			Bin &bin	= bins[axis][std::min( static_cast<uint32_t>( ( mCentroids[object][axis] - centroidMin[axis] ) * scale[axis] ), NUM_BINS - 1 )];
+			bin.mMin	= glm::min( bin.mMin, bounds.getUpperLeft() );
+			bin.mMax	= glm::max( bin.mMax, bounds.getLowerRight() );
+			bin.mCount++;
+		}
+	}
+	
+	float bestCost		= std::numeric_limits<float>::max();
+	uint32_t bestAxis	= 2;
+	uint32_t bestBin	= 0;
+	for( uint32_t axis = 0; axis < 2; ++axis ) {
+		if( extent[axis] <= 0.0f )
+			continue;
+		
+		// sweep from the left keeping the cost of each left side, then from the right to complete it
+		float leftCost[NUM_BINS];
+		uint32_t leftCount = 0;
+		ci::vec2 leftMin( std::numeric_limits<float>::max() ), leftMax( std::numeric_limits<float>::lowest() );
+		for( uint32_t b = 0; b < NUM_BINS - 1; ++b ) {
+			const Bin &bin = bins[axis][b];
+			if( bin.mCount ) {
+				leftMin		= glm::min( leftMin, bin.mMin );
+				leftMax		= glm::max( leftMax, bin.mMax );
+				leftCount	+= bin.mCount;
+			}
+			leftCost[b] = leftCount ? leftCount * details::halfPerimeter( leftMin, leftMax ) : -1.0f;
+		}
+		uint32_t rightCount = 0;
+		ci::vec2 rightMin( std::numeric_limits<float>::max() ), rightMax( std::numeric_limits<float>::lowest() );
+		for( uint32_t b = NUM_BINS - 1; b > 0; --b ) {
+			const Bin &bin = bins[axis][b];
+			if( bin.mCount ) {
+				rightMin	= glm::min( rightMin, bin.mMin );
+				rightMax	= glm::max( rightMax, bin.mMax );
+				rightCount	+= bin.mCount;
+			}
+			// splitting before bin b, both sides have to hold objects
+			if( ! rightCount || leftCost[b - 1] < 0.0f )
+				continue;
+			const float cost = leftCost[b - 1] + rightCount * details::halfPerimeter( rightMin, rightMax );
+			if( cost < bestCost ) {
+				bestCost	= cost;
+				bestAxis	= axis;
+				bestBin		= b;
+			}
+		}
+	}
+	
+	// every centroid is at the same place
+	if( bestAxis == 2 )
+		return splitMedian( begin, end, centroidMin, centroidMax );
+	
+	const float axisMin		= centroidMin[bestAxis];
+	const float axisScale	= scale[bestAxis];
+	uint32_t* first			= mBuildOrder.data();
+	return static_cast<uint32_t>( std::partition( first + begin, first + end, [this, bestAxis, bestBin, axisMin, axisScale]( uint32_t i ) {
+		return std::min( static_cast<uint32_t>( ( mCentroids[i][bestAxis] - axisMin ) * axisScale ), NUM_BINS - 1 ) < bestBin;
+	} ) - first );
+}
+
+//! Partitions the objects in two halves along the widest axis of their centroids
+template<class T>
+uint32_t BVH2<T>::splitMedian( uint32_t begin, uint32_t end, const ci::vec2 &centroidMin, const ci::vec2 &centroidMax )
+{
+	const uint32_t axis = centroidMax.y - centroidMin.y > centroidMax.x - centroidMin.x ? 1 : 0;
+	const uint32_t mid	= begin + ( end - begin ) / 2;
+	uint32_t* order		= mBuildOrder.data();
+	std::nth_element( order + begin, order + mid, order + end, [this, axis]( uint32_t a, uint32_t b ) {
+		return mCentroids[a][axis] < mCentroids[b][axis];
+	} );
+	return mid;
+}
+
+template<class T>
+BVH2<T>::Segment::Segment( const ci::vec2 &a, const ci::vec2 &b )
+: mA( a ), mB( b )
+{
+	const ci::vec2 dir = b - a;
+	for( int axis = 0; axis < 2; ++axis ) {
+		mFlat[axis]		= dir[axis] == 0.0f;
+		mInvDir[axis]	= mFlat[axis] ? 0.0f : 1.0f / dir[axis];
+	}
+}
+
+template<class T>
+bool BVH2<T>::Segment::intersects( const ci::vec2 &min, const ci::vec2 &max, float tMax, float *tEnter ) const
+{
+	float t0 = 0.0f;
+	float t1 = tMax;
+	for( int axis = 0; axis < 2; ++axis ) {
+		// a segment parallel to the slab is either always or never inside it
+		if( mFlat[axis] ) {
+			if( mA[axis] < min[axis] || mA[axis] > max[axis] )
+				return false;
+			continue;
+		}
+		float tNear	= ( min[axis] - mA[axis] ) * mInvDir[axis];
+		float tFar	= ( max[axis] - mA[axis] ) * mInvDir[axis];
+		if( tNear > tFar )
+			std::swap( tNear, tFar );
+		t0 = std::max( t0, tNear );
+		t1 = std::min( t1, tFar );
+		if( t0 > t1 )
+			return false;
+	}
+	*tEnter = t0;
+	return true;
+}
+
+template<class T>
+bool BVH2<T>::segmentIntersectsAny( const ci::vec2 &a, const ci::vec2 &b ) const
+{
+	if( mNodes.empty() )
+		return false;
+	
+	const Segment segment( a, b );
+	uint32_t stack[STACK_SIZE];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = 0;
+	float tEnter, t;
+	while( stackSize ) {
+		const Node &node = mNodes[stack[--stackSize]];
+		if( ! segment.intersects( node.mMin, node.mMax, 1.0f, &tEnter ) )
+			continue;
+		
+		if( node.isLeaf() ) {
+			for( uint32_t i = 0; i < node.mNumObjects; ++i ) {
+				if( details::BVH2ObjectIntersect( (*mObjects)[node.mStart+i], a, b, &t ) )
+					return true;
+			}
+		}
+		else {
+			stack[stackSize++] = node.mStart + 1;
+			stack[stackSize++] = node.mStart;
+		}
+	}
+	return false;
+}
+
+template<class T>
+T* BVH2<T>::firstSegmentHit( const ci::vec2 &a, const ci::vec2 &b, float *t ) const
+{
+	if( mNodes.empty() )
+		return nullptr;
+	
+	struct TraversalNode {
+		uint32_t	mIndex;
+		float		mEnter;
+	};
+	
+	const Segment segment( a, b );
+	float tEnter;
+	if( ! segment.intersects( mNodes.front().mMin, mNodes.front().mMax, 1.0f, &tEnter ) )
+		return nullptr;
+	
+	// visit the nodes nearest first, skipping the ones entered past the nearest hit so far
+	TraversalNode stack[STACK_SIZE];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = { 0, tEnter };
+	float nearest	= std::numeric_limits<float>::max();
+	T* result		= nullptr;
+	while( stackSize ) {
+		const TraversalNode traversalNode = stack[--stackSize];
+		if( traversalNode.mEnter > nearest )
+			continue;
+		
+		const Node &node = mNodes[traversalNode.mIndex];
+		if( node.isLeaf() ) {
+			float hit;
+			for( uint32_t i = 0; i < node.mNumObjects; ++i ) {
+				T &obj = (*mObjects)[node.mStart+i];
+				if( details::BVH2ObjectIntersect( obj, a, b, &hit ) && hit < nearest ) {
+					nearest	= hit;
+					result	= &obj;
+				}
+			}
+		}
+		else {
+			const float tMax = std::min( nearest, 1.0f );
+			float enter0, enter1;
+			const bool hit0 = segment.intersects( mNodes[node.mStart].mMin, mNodes[node.mStart].mMax, tMax, &enter0 );
+			const bool hit1 = segment.intersects( mNodes[node.mStart+1].mMin, mNodes[node.mStart+1].mMax, tMax, &enter1 );
+			if( hit0 && hit1 ) {
+				// push the farther child first
+				if( enter1 < enter0 ) {
+					stack[stackSize++] = { node.mStart, enter0 };
+					stack[stackSize++] = { node.mStart + 1, enter1 };
+				}
+				else {
+					stack[stackSize++] = { node.mStart + 1, enter1 };
+					stack[stackSize++] = { node.mStart, enter0 };
+				}
+			}
+			else if( hit0 ) {
+				stack[stackSize++] = { node.mStart, enter0 };
+			}
+			else if( hit1 ) {
+				stack[stackSize++] = { node.mStart + 1, enter1 };
+			}
+		}
+	}
+	
+	if( result && t )
+		*t = nearest;
+	return result;
+}
+
+template<class T>
+template<class Visitor>
+void BVH2<T>::overlapSearch( const ci::Rectf &range, Visitor &&visitor ) const
+{
+	const ci::vec2 rangeMin = range.getUpperLeft();
+	const ci::vec2 rangeMax = range.getLowerRight();
+	const auto overlaps = [&rangeMin, &rangeMax]( const ci::vec2 &min, const ci::vec2 &max ) {
+		return min.x <= rangeMax.x && max.x >= rangeMin.x && min.y <= rangeMax.y && max.y >= rangeMin.y;
+	};
+	overlapSearchImpl( overlaps, visitor );
+}
+
+template<class T>
+template<class Visitor>
+void BVH2<T>::overlapSearch( const ci::vec2 &position, float radius, Visitor &&visitor ) const
+{
+	const float radiusSq = radius * radius;
+	const auto overlaps = [&position, radiusSq]( const ci::vec2 &min, const ci::vec2 &max ) {
+		return glm::distance2( glm::clamp( position, min, max ), position ) <= radiusSq;
+	};
+	overlapSearchImpl( overlaps, visitor );
+}
+
+template<class T>
+template<class Overlaps, class Visitor>
+bool BVH2<T>::overlapSearchImpl( const Overlaps &overlaps, Visitor &visitor ) const
+{
+	if( mNodes.empty() )
+		return false;
+	
+	uint32_t stack[STACK_SIZE];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = 0;
+	while( stackSize ) {
+		const Node &node = mNodes[stack[--stackSize]];
+		if( ! overlaps( node.mMin, node.mMax ) )
+			continue;
+		
+		if( node.isLeaf() ) {
+			for( uint32_t i = 0; i < node.mNumObjects; ++i ) {
+				T* obj = &(*mObjects)[node.mStart+i];
+				const ci::Rectf bounds = details::BVH2ObjectGetBounds( *obj );
+				if( overlaps( bounds.getUpperLeft(), bounds.getLowerRight() ) && details::visit( visitor, obj ) )
+					return true;
+			}
+		}
+		else {
+			stack[stackSize++] = node.mStart + 1;
+			stack[stackSize++] = node.mStart;
+		}
+	}
+	return false;
+}
+
+};
+
+namespace sp = SpacePartitioning;
@@ -0,0 +1,209 @@
+/*
+ Batch - Space Partitioning algorithms for Cinder
+ 
+ Copyright (c) 2016, Simon Geilfus, All rights reserved.
+ This code is intended for use with the Cinder C++ library: http://libcinder.org
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+	the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+	the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <vector>
+#include <limits>
+#include <cstdint>
+#include <numeric>
+#include <algorithm>
+#include <type_traits>
+#include "cinder/Vector.h"
+#include "sp/Parallel.h"
+
+#if defined( _MSC_VER )
+	#include <intrin.h>
+#endif
+
+namespace SpacePartitioning {
+
+//! Queries answered together by a single traversal, at most 64 so that they fit the bits of a mask
+enum : uint32_t { BATCH_PACKET_SIZE = 64 };
+//! Below this many queries left in a packet, following them one at a time is cheaper
+enum : uint32_t { BATCH_PACKET_MIN_SIZE = 16 };
+
+//! Writes the nearest Node of each of count positions and its square distance to nodes and distancesSq, which must hold count elements. Nodes are nullptr if the structure is empty. The positions are answered in Morton order, in packets sharing the upper levels of the traversal when the structure has a nearestNeighborSearchPacket function, and large batches are split across threads
+template<class SpatialStruct>
+void nearestNeighborSearchBatch( const SpatialStruct &spatialStruct, const typename SpatialStruct::vec_t *positions, size_t count, typename SpatialStruct::Node **nodes, typename SpatialStruct::NodePair::second_type *distancesSq );
+
+// MARK: Batch Impl.
+
+// https://en.wikipedia.org/wiki/Z-order_curve
+// https://fgiesen.wordpress.com/2009/12/13/decoding-morton-codes/
+
+namespace details {
+	
+	//! Returns the index of the lowest set bit, mask can't be zero
+	inline uint32_t countTrailingZeros( uint64_t mask )
+	{
+#if defined( _MSC_VER ) && defined( _M_X64 )
+		unsigned long index;
+		_BitScanForward64( &index, mask );
+		return index;
+#elif defined( _MSC_VER )
+		unsigned long index;
+		if( _BitScanForward( &index, static_cast<uint32_t>( mask ) ) )
+			return index;
+		_BitScanForward( &index, static_cast<uint32_t>( mask >> 32 ) );
+		return index + 32;
+#else
+		return static_cast<uint32_t>( __builtin_ctzll( mask ) );
+#endif
+	}
+	
+	//! Returns the number of set bits
+	inline uint32_t countBits( uint64_t mask )
+	{
+#if defined( _MSC_VER ) && defined( _M_X64 )
+		return static_cast<uint32_t>( __popcnt64( mask ) );
+#elif defined( _MSC_VER )
+		return __popcnt( static_cast<uint32_t>( mask ) ) + __popcnt( static_cast<uint32_t>( mask >> 32 ) );
+#else
+		return static_cast<uint32_t>( __builtin_popcountll( mask ) );
+#endif
+	}
+	
+	//! Spreads the lower 16 bits of x to the even bits
+	inline uint32_t mortonSpread2( uint32_t x )
+	{
+		x &= 0x0000ffff;
+		x = ( x | ( x << 8 ) ) & 0x00ff00ff;
+		x = ( x | ( x << 4 ) ) & 0x0f0f0f0f;
+		x = ( x | ( x << 2 ) ) & 0x33333333;
+		x = ( x | ( x << 1 ) ) & 0x55555555;
+		return x;
+	}
+	//! Spreads the lower 10 bits of x to every third bit
+	inline uint32_t mortonSpread3( uint32_t x )
+	{
+		x &= 0x000003ff;
+		x = ( x | ( x << 16 ) ) & 0xff0000ff;
+		x = ( x | ( x << 8 ) ) & 0x0300f00f;
+		x = ( x | ( x << 4 ) ) & 0x030c30c3;
+		x = ( x | ( x << 2 ) ) & 0x09249249;
+		return x;
+	}
+	
+	//! Returns the Morton code of a position quantized to the cells of a grid starting at min
+	template<class T>
+	uint32_t mortonCode( const glm::tvec2<T> &position, const glm::tvec2<T> &min, const glm::tvec2<T> &scale )
+	{
+		const glm::tvec2<T> cell = ( position - min ) * scale;
+		return mortonSpread2( static_cast<uint32_t>( cell.x ) ) | ( mortonSpread2( static_cast<uint32_t>( cell.y ) ) << 1 );
+	}
+	template<class T>
+	uint32_t mortonCode( const glm::tvec3<T> &position, const glm::tvec3<T> &min, const glm::tvec3<T> &scale )
+	{
+		const glm::tvec3<T> cell = ( position - min ) * scale;
+		return mortonSpread3( static_cast<uint32_t>( cell.x ) ) | ( mortonSpread3( static_cast<uint32_t>( cell.y ) ) << 1 ) | ( mortonSpread3( static_cast<uint32_t>( cell.z ) ) << 2 );
+	}
+	//! Returns the cells per axis of mortonCode
+	inline uint32_t mortonResolution( const glm::vec2& ) { return 1 << 16; }
+	inline uint32_t mortonResolution( const glm::dvec2& ) { return 1 << 16; }
+	inline uint32_t mortonResolution( const glm::vec3& ) { return 1 << 10; }
+	inline uint32_t mortonResolution( const glm::dvec3& ) { return 1 << 10; }
+	
+	//! Writes the indices of count positions to order, sorted along the Z-order curve over their bounds
+	template<class vec_t>
+	void mortonOrder( const vec_t *positions, size_t count, std::vector<uint32_t> *order )
+	{
+		using T = typename std::decay<decltype( positions[0][0] )>::type;
+		order->resize( count );
+		std::iota( order->begin(), order->end(), 0 );
+		if( count < 2 )
+			return;
+		
+		vec_t min( positions[0] ), max( positions[0] );
+		for( size_t i = 1; i < count; ++i ) {
+			min = glm::min( min, positions[i] );
+			max = glm::max( max, positions[i] );
+		}
+		// keep the upper bound inside the last cell
+		const T cells	= static_cast<T>( mortonResolution( min ) - 1 );
+		vec_t scale;
+		for( int axis = 0; axis < scale.length(); ++axis )
+			scale[axis] = max[axis] > min[axis] ? cells / ( max[axis] - min[axis] ) : T( 0 );
+		
+		// the code in the upper half and the index in the lower one, sorted as plain integers
+		std::vector<uint64_t> codes( count );
+		for( size_t i = 0; i < count; ++i )
+			codes[i] = ( static_cast<uint64_t>( mortonCode( positions[i], min, scale ) ) << 32 ) | i;
+		std::sort( codes.begin(), codes.end() );
+		for( size_t i = 0; i < count; ++i )
+			(*order)[i] = static_cast<uint32_t>( codes[i] );
+	}
+	
+	//! Detects if a class has a nearestNeighborSearchPacket( const vec_t*, const uint32_t*, uint32_t, Node**, T* ) function
+	template<typename C>
+	struct HasNearestNeighborSearchPacket {
+	private:
+		template<typename S> static constexpr auto check(S*) -> decltype( std::declval<const S>().nearestNeighborSearchPacket( std::declval<const typename S::vec_t*>(), std::declval<const uint32_t*>(), uint32_t(), std::declval<typename S::Node**>(), std::declval<typename S::NodePair::second_type*>() ), std::true_type() );
+		template<typename> static constexpr std::false_type check(...);
+		typedef decltype(check<C>(0)) type;
+	public:
+		static constexpr bool value = type::value;
+	};
+	
+	template<class SpatialStruct, typename std::enable_if<HasNearestNeighborSearchPacket<SpatialStruct>::value,int>::type = 0>
+	void nearestNeighborSearchPacket( const SpatialStruct &spatialStruct, const typename SpatialStruct::vec_t *positions, const uint32_t *indices, uint32_t count, typename SpatialStruct::Node **nodes, typename SpatialStruct::NodePair::second_type *distancesSq )
+	{
+		spatialStruct.nearestNeighborSearchPacket( positions, indices, count, nodes, distancesSq );
+	}
+	//! Falls back to one query at a time, still in Morton order
+	template<class SpatialStruct, typename std::enable_if<!HasNearestNeighborSearchPacket<SpatialStruct>::value,int>::type = 0>
+	void nearestNeighborSearchPacket( const SpatialStruct &spatialStruct, const typename SpatialStruct::vec_t *positions, const uint32_t *indices, uint32_t count, typename SpatialStruct::Node **nodes, typename SpatialStruct::NodePair::second_type *distancesSq )
+	{
+		using T = typename SpatialStruct::NodePair::second_type;
+		for( uint32_t i = 0; i < count; ++i ) {
+			const uint32_t index	= indices[i];
+			distancesSq[index]		= std::numeric_limits<T>::max();
+			nodes[index]			= spatialStruct.nearestNeighborSearch( positions[index], &distancesSq[index] );
+		}
+	}
+}
+
+template<class SpatialStruct>
+void nearestNeighborSearchBatch( const SpatialStruct &spatialStruct, const typename SpatialStruct::vec_t *positions, size_t count, typename SpatialStruct::Node **nodes, typename SpatialStruct::NodePair::second_type *distancesSq )
+{
+	// batches below this size are answered on the calling thread
+	const size_t parallelSize = 16 * BATCH_PACKET_SIZE;
+	
+	std::vector<uint32_t> order;
+	details::mortonOrder( positions, count, &order );
+	
+	const size_t numPackets = ( count + BATCH_PACKET_SIZE - 1 ) / BATCH_PACKET_SIZE;
+	const auto answer = [&]( size_t begin, size_t end ) {
+		for( size_t packet = begin; packet < end; ++packet ) {
+			const size_t first = packet * BATCH_PACKET_SIZE;
+			const uint32_t size = static_cast<uint32_t>( std::min<size_t>( BATCH_PACKET_SIZE, count - first ) );
+			details::nearestNeighborSearchPacket( spatialStruct, positions, order.data() + first, size, nodes, distancesSq );
+		}
+	};
+	details::parallelFor( 0, numPackets, parallelSize / BATCH_PACKET_SIZE, count >= parallelSize ? details::parallelDepth() : 0, answer );
+}
+
+};
+
+namespace sp = SpacePartitioning;
@@ -0,0 +1,285 @@
+/*
+ BruteForce - Space Partitioning algorithms for Cinder
+ 
+ Copyright (c) 2016, Simon Geilfus, All rights reserved.
+ This code is intended for use with the Cinder C++ library: http://libcinder.org
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+	the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+	the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <vector>
+#include <limits>
+#include <functional>
+#include "cinder/Vector.h"
+#include "sp/Filter.h"
+#include "sp/KNearest.h"
+#include "sp/Simd.h"
+#include "sp/Visitor.h"
+
+namespace SpacePartitioning {
+
+template<uint8_t DIM, class T> struct BruteForceTraits;
+
+//! Represents a flat array of points searched exhaustively. With a few hundred points or less a vectorized scan beats building and walking a tree
+template<uint8_t DIM, class T, class DataT>
+class BruteForce {
+public:
+	using vec_t = typename ci::VECDIM<DIM, T>::TYPE;
+
+	//! Inserts a new point with optional user data, invalidates previously returned Nodes
+	void insert( const vec_t &position, const DataT &data = DataT() );
+	//! Removes all the points, keeping the allocated storage
+	void clear();
+	//! Returns the number of points
+	size_t size() const { return mNodes.size(); }
+	//! Reserves storage for n points
+	void reserve( size_t n );
+
+	//! Represents a single element of the BruteForce structure
+	class Node {
+	public:
+		//! Returns the position of the node
+		vec_t getPosition() const { return mPosition; }
+		//! Returns the user data
+		const DataT& getData() const { return mData; }
+
+		Node( const vec_t &position, const DataT &data );
+	protected:
+		vec_t	mPosition;
+		DataT	mData;
+		friend class BruteForce;
+	};
+
+	using NodePair = std::pair<Node*,T>;
+
+	//! Returns a pointer to the nearest Node with its square distance to the position, or nullptr if empty
+	Node*			nearestNeighborSearch( const vec_t &position, T *distanceSq = nullptr ) const;
+	//! Returns a vector of Nodes within a radius along with their square distances to the position
+	std::vector<NodePair>	rangeSearch( const vec_t &position, T radius ) const;
+	//! Returns a vector of Nodes within a radius along with their square distances to the position
+	void			rangeSearch( const vec_t &position, T radius, const std::function<void(Node*,T)> &visitor ) const;
+	//! Calls visitor( Node*, T distanceSq ) with the Nodes within a radius, a visitor returning bool stops the search by returning true
+	template<class Visitor>
+	void			rangeSearch( const vec_t &position, T radius, Visitor &&visitor ) const;
+	//! Writes the k nearest Nodes within maxRadius to results, nearest first, and returns how many were found. results must hold k pairs, nothing is allocated
+	size_t			kNearest( const vec_t &position, size_t k, T maxRadius, NodePair *results ) const;
+
+	//! Returns the nearest Node for which predicate( Node* ) returns true, or nullptr if there is none
+	template<class Predicate>
+	Node*			nearestNeighborSearchIf( const vec_t &position, T *distanceSq, Predicate predicate ) const;
+	//! Returns a vector of the Nodes within a radius for which predicate( Node* ) returns true
+	template<class Predicate>
+	std::vector<NodePair>	rangeSearchIf( const vec_t &position, T radius, Predicate predicate ) const;
+	//! Calls visitor with the Nodes within a radius for which predicate( Node* ) returns true
+	template<class Predicate, class Visitor>
+	void			rangeSearchIf( const vec_t &position, T radius, Predicate predicate, Visitor &&visitor ) const;
+	//! Writes the k nearest Nodes within maxRadius for which predicate( Node* ) returns true to results, nearest first, and returns how many were found
+	template<class Predicate>
+	size_t			kNearestIf( const vec_t &position, size_t k, T maxRadius, NodePair *results, Predicate predicate ) const;
+
+	//! Returns the packed coordinates along an axis
+	const std::vector<T>& getCoordinates( uint8_t axis ) const { return mCoordinates[axis]; }
+
+protected:
+	std::vector<Node>	mNodes;
+	std::vector<T>		mCoordinates[DIM];	// one packed array per axis
+	friend struct BruteForceTraits<DIM,T>;
+};
+
+// MARK: BruteForce Impl.
+
+//! Scans the points [begin, end) of packed per-axis coordinate arrays, indices passed back are absolute
+template<uint8_t DIM, class T>
+struct BruteForceTraits {
+	static size_t nearest( const std::vector<T> *coordinates, size_t begin, size_t end, const typename ci::VECDIM<DIM,T>::TYPE &position, T *distanceSq )
+	{
+		size_t nearest	= begin;
+		T nearestDistSq	= std::numeric_limits<T>::max();
+		for( size_t i = begin; i < end; ++i ) {
+			T distSq = 0;
+			for( uint8_t axis = 0; axis < DIM; ++axis ) {
+				const T d = coordinates[axis][i] - position[axis];
+				distSq += d * d;
+			}
+			if( distSq < nearestDistSq ) {
+				nearestDistSq	= distSq;
+				nearest			= i;
+			}
+		}
+		*distanceSq = nearestDistSq;
+		return nearest;
+	}
+	template<class Visitor>
+	static bool within( const std::vector<T> *coordinates, size_t begin, size_t end, const typename ci::VECDIM<DIM,T>::TYPE &position, T radiusSq, Visitor &&visitor )
+	{
+		for( size_t i = begin; i < end; ++i ) {
+			T distSq = 0;
+			for( uint8_t axis = 0; axis < DIM; ++axis ) {
+				const T d = coordinates[axis][i] - position[axis];
+				distSq += d * d;
+			}
+			if( distSq < radiusSq && details::visit( visitor, i, distSq ) )
+				return true;
+		}
+		return false;
+	}
+};
+template<>
+struct BruteForceTraits<2,float> {
+	static size_t nearest( const std::vector<float> *coordinates, size_t begin, size_t end, const ci::vec2 &position, float *distanceSq )
+	{
+		return begin + simd::nearest2( coordinates[0].data() + begin, coordinates[1].data() + begin, end - begin, position.x, position.y, distanceSq );
+	}
+	template<class Visitor>
+	static bool within( const std::vector<float> *coordinates, size_t begin, size_t end, const ci::vec2 &position, float radiusSq, Visitor &&visitor )
+	{
+		return simd::within2( coordinates[0].data() + begin, coordinates[1].data() + begin, end - begin, position.x, position.y, radiusSq, [begin, &visitor]( size_t i, float distSq ) {
+			return details::visit( visitor, begin + i, distSq );
+		} );
+	}
+};
+
+template<uint8_t DIM, class T, class DataT>
+BruteForce<DIM,T,DataT>::Node::Node( const vec_t &position, const DataT &data )
+: mPosition( position ), mData( data )
+{
+}
+
+template<uint8_t DIM, class T, class DataT>
+void BruteForce<DIM,T,DataT>::insert( const vec_t &position, const DataT &data )
+{
+	mNodes.emplace_back( position, data );
+	for( uint8_t axis = 0; axis < DIM; ++axis )
+		mCoordinates[axis].push_back( position[axis] );
+}
+template<uint8_t DIM, class T, class DataT>
+void BruteForce<DIM,T,DataT>::clear()
+{
+	mNodes.clear();
+	for( auto &coordinates : mCoordinates )
+		coordinates.clear();
+}
+template<uint8_t DIM, class T, class DataT>
+void BruteForce<DIM,T,DataT>::reserve( size_t n )
+{
+	mNodes.reserve( n );
+	for( auto &coordinates : mCoordinates )
+		coordinates.reserve( n );
+}
+
+template<uint8_t DIM, class T, class DataT>
+typename BruteForce<DIM,T,DataT>::Node* BruteForce<DIM,T,DataT>::nearestNeighborSearch( const vec_t &position, T *distanceSq ) const
+{
+	if( mNodes.empty() )
+		return nullptr;
+
+	T dSq;
+	size_t nearest = BruteForceTraits<DIM,T>::nearest( mCoordinates, 0, mNodes.size(), position, &dSq );
+	if( distanceSq )
+		*distanceSq = dSq;
+	return const_cast<Node*>( &mNodes[nearest] );
+}
+template<uint8_t DIM, class T, class DataT>
+std::vector<typename BruteForce<DIM,T,DataT>::NodePair> BruteForce<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius ) const
+{
+	return rangeSearchIf( position, radius, details::AcceptAll() );
+}
+template<uint8_t DIM, class T, class DataT>
+void BruteForce<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius, const std::function<void(Node*,T)> &visitor ) const
+{
+	rangeSearchIf( position, radius, details::AcceptAll(), visitor );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Visitor>
+void BruteForce<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius, Visitor &&visitor ) const
+{
+	rangeSearchIf( position, radius, details::AcceptAll(), std::forward<Visitor>( visitor ) );
+}
+
+template<uint8_t DIM, class T, class DataT>
+size_t BruteForce<DIM,T,DataT>::kNearest( const vec_t &position, size_t k, T maxRadius, NodePair *results ) const
+{
+	return kNearestIf( position, k, maxRadius, results, details::AcceptAll() );
+}
+
+// the filtered queries test the distance first, so the predicate only runs on candidates
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+typename BruteForce<DIM,T,DataT>::Node* BruteForce<DIM,T,DataT>::nearestNeighborSearchIf( const vec_t &position, T *distanceSq, Predicate predicate ) const
+{
+	NodePair nearest;
+	if( ! kNearestIf( position, 1, std::numeric_limits<T>::max(), &nearest, predicate ) )
+		return nullptr;
+	if( distanceSq )
+		*distanceSq = nearest.second;
+	return nearest.first;
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+std::vector<typename BruteForce<DIM,T,DataT>::NodePair> BruteForce<DIM,T,DataT>::rangeSearchIf( const vec_t &position, T radius, Predicate predicate ) const
+{
+	std::vector<NodePair> results;
+	rangeSearchIf( position, radius, predicate, [&results]( Node* node, T distSq ) {
+		results.emplace_back( node, distSq );
+	} );
+	return results;
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate, class Visitor>
+void BruteForce<DIM,T,DataT>::rangeSearchIf( const vec_t &position, T radius, Predicate predicate, Visitor &&visitor ) const
+{
+	BruteForceTraits<DIM,T>::within( mCoordinates, 0, mNodes.size(), position, radius * radius, [&]( size_t i, T distSq ) {
+		Node* node = const_cast<Node*>( &mNodes[i] );
+		return predicate( node ) && details::visit( visitor, node, distSq );
+	} );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+size_t BruteForce<DIM,T,DataT>::kNearestIf( const vec_t &position, size_t k, T maxRadius, NodePair *results, Predicate predicate ) const
+{
+	if( ! k )
+		return 0;
+
+	details::KNearestHeap<NodePair> heap( results, k, maxRadius );
+	for( size_t i = 0; i < mNodes.size(); ++i ) {
+		T distSq = 0;
+		for( uint8_t axis = 0; axis < DIM; ++axis ) {
+			const T d = mCoordinates[axis][i] - position[axis];
+			distSq += d * d;
+		}
+		Node* node = const_cast<Node*>( &mNodes[i] );
+		if( distSq <= heap.bound() && predicate( node ) )
+			heap.push( node, distSq );
+	}
+	return heap.finish();
+}
+
+//! Represents a 2D float brute-force search structure, vectorized with SSE2 where available
+template<class DataT> using BruteForce2 = BruteForce<2,float,DataT>;
+//! Represents a 3D float brute-force search structure
+template<class DataT> using BruteForce3 = BruteForce<3,float,DataT>;
+//! Represents a 2D double brute-force search structure
+template<class DataT> using dBruteForce2 = BruteForce<2,double,DataT>;
+//! Represents a 3D double brute-force search structure
+template<class DataT> using dBruteForce3 = BruteForce<3,double,DataT>;
+
+};
+
+namespace sp = SpacePartitioning;
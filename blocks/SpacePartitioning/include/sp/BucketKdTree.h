@@ -0,0 +1,443 @@
+/*
+ BucketKdTree - Space Partitioning algorithms for Cinder
+ 
+ Copyright (c) 2016, Simon Geilfus, All rights reserved.
+ This code is intended for use with the Cinder C++ library: http://libcinder.org
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+	the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+	the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <vector>
+#include <limits>
+#include <numeric>
+#include <algorithm>
+#include <functional>
+#include "cinder/Vector.h"
+#include "sp/BruteForce.h"
+#include "sp/Filter.h"
+#include "sp/KNearest.h"
+#include "sp/Parallel.h"
+#include "sp/Visitor.h"
+
+namespace SpacePartitioning {
+
+//! Represents a static K-D Tree whose leaves hold buckets of points instead of single points. Coordinates are stored per axis in leaf order, so the tree stays shallow and each leaf is scanned with the vectorized brute-force kernels. The tree is rebuilt as a whole with build()
+template<uint8_t DIM, class T, class DataT>
+class BucketKdTree {
+public:
+	using vec_t = typename ci::VECDIM<DIM, T>::TYPE;
+
+	//! Constructs an empty tree whose leaves hold up to bucketSize points, 8 to 32 works best
+	BucketKdTree( uint32_t bucketSize = 16 );
+
+	//! Replaces the content of the tree with count points, data can be null. Large inputs are built in parallel
+	void build( const vec_t *positions, const DataT *data, size_t count );
+	//! Replaces the content of the tree with ( position, data ) pairs
+	template<class InputIt>
+	void build( InputIt first, InputIt last );
+	//! Removes all the points from the structure, keeping the storage allocated
+	void clear();
+	//! Returns the number of points
+	size_t size() const { return mNodes.size(); }
+	//! Returns the maximum number of points in a leaf
+	uint32_t getBucketSize() const { return mBucketSize; }
+
+	//! Represents a single element of the BucketKdTree
+	class Node {
+	public:
+		//! Returns the position of the node
+		vec_t getPosition() const { return mPosition; }
+		//! Returns the user data
+		const DataT& getData() const { return mData; }
+
+		Node( const vec_t &position, const DataT &data );
+	protected:
+		vec_t	mPosition;
+		DataT	mData;
+		friend class BucketKdTree;
+	};
+
+	using NodePair = std::pair<Node*,T>;
+
+	//! Returns a pointer to the nearest Node with its square distance to the position, or nullptr if empty
+	Node*			nearestNeighborSearch( const vec_t &position, T *distanceSq = nullptr ) const;
+	//! Returns a vector of Nodes within a radius along with their square distances to the position
+	std::vector<NodePair>	rangeSearch( const vec_t &position, T radius ) const;
+	//! Returns a vector of Nodes within a radius along with their square distances to the position
+	void			rangeSearch( const vec_t &position, T radius, const std::function<void(Node*,T)> &visitor ) const;
+	//! Calls visitor( Node*, T distanceSq ) with the Nodes within a radius, a visitor returning bool stops the search by returning true
+	template<class Visitor>
+	void			rangeSearch( const vec_t &position, T radius, Visitor &&visitor ) const;
+	//! Writes the k nearest Nodes within maxRadius to results, nearest first, and returns how many were found. results must hold k pairs, nothing is allocated
+	size_t			kNearest( const vec_t &position, size_t k, T maxRadius, NodePair *results ) const;
+
+	//! Returns the nearest Node for which predicate( Node* ) returns true, or nullptr if there is none. Rejected nodes don't narrow the search
+	template<class Predicate>
+	Node*			nearestNeighborSearchIf( const vec_t &position, T *distanceSq, Predicate predicate ) const;
+	//! Returns a vector of the Nodes within a radius for which predicate( Node* ) returns true
+	template<class Predicate>
+	std::vector<NodePair>	rangeSearchIf( const vec_t &position, T radius, Predicate predicate ) const;
+	//! Calls visitor with the Nodes within a radius for which predicate( Node* ) returns true, a visitor returning bool stops the search by returning true
+	template<class Predicate, class Visitor>
+	void			rangeSearchIf( const vec_t &position, T radius, Predicate predicate, Visitor &&visitor ) const;
+	//! Writes the k nearest Nodes within maxRadius for which predicate( Node* ) returns true to results, nearest first, and returns how many were found
+	template<class Predicate>
+	size_t			kNearestIf( const vec_t &position, size_t k, T maxRadius, NodePair *results, Predicate predicate ) const;
+
+protected:
+	//! Index of a missing cell or result
+	enum : uint32_t { NO_NODE = 0xffffffff };
+	//! Subtrees smaller than this are built on the calling thread
+	enum : uint32_t { PARALLEL_BUILD_SIZE = 1 << 14 };
+
+	//! Represents either a split, whose left child is the next cell, or a leaf owning the points [mBegin, mEnd)
+	struct Cell {
+		T		mSplit;
+		uint32_t	mAxis;
+		uint32_t	mRight;
+		uint32_t	mBegin, mEnd;
+
+		bool isLeaf() const { return mRight == NO_NODE; }
+	};
+
+	Node* getNode( uint32_t i ) const { return const_cast<Node*>( &mNodes[i] ); }
+	uint32_t getNumCells( uint32_t count ) const;
+	void buildImpl( const vec_t *positions, uint32_t begin, uint32_t end, uint32_t index, uint32_t parallelDepth );
+
+	template<class Predicate>
+	void nearestNeighborSearchImpl( uint32_t index, const vec_t &position, vec_t *offsets, T offsetDistanceSq, Predicate &predicate, uint32_t *result, T *resultDistanceSq ) const;
+	template<class Predicate>
+	void leafNearest( const Cell &cell, const vec_t &position, Predicate &predicate, uint32_t *result, T *resultDistanceSq ) const;
+	void leafNearest( const Cell &cell, const vec_t &position, details::AcceptAll &predicate, uint32_t *result, T *resultDistanceSq ) const;
+	template<class Predicate, class Visitor>
+	bool rangeSearchImpl( uint32_t index, const vec_t &position, vec_t *offsets, T offsetDistanceSq, T radius, Predicate &predicate, Visitor &visitor ) const;
+	template<class Predicate>
+	void kNearestImpl( uint32_t index, const vec_t &position, vec_t *offsets, T offsetDistanceSq, Predicate &predicate, details::KNearestHeap<NodePair> *heap ) const;
+
+	uint32_t		mBucketSize;
+	std::vector<Cell>	mCells;			// the root is the first cell, laid out in depth-first order
+	std::vector<Node>	mNodes;			// positions and user data in leaf order
+	std::vector<T>		mCoordinates[DIM];	// one packed array per axis, in leaf order
+	std::vector<uint32_t>	mBuildOrder;		// scratch permutation used by build
+};
+
+// MARK: BucketKdTree Impl.
+
+// https://www.cs.umd.edu/~mount/ANN/
+// http://www.cs.umd.edu/~mount/Papers/DCC_93_kdtree.pdf
+
+template<uint8_t DIM, class T, class DataT>
+BucketKdTree<DIM,T,DataT>::Node::Node( const vec_t &position, const DataT &data )
+: mPosition( position ), mData( data )
+{
+}
+
+template<uint8_t DIM, class T, class DataT>
+BucketKdTree<DIM,T,DataT>::BucketKdTree( uint32_t bucketSize )
+: mBucketSize( std::max( bucketSize, 1u ) )
+{
+}
+
+template<uint8_t DIM, class T, class DataT>
+void BucketKdTree<DIM,T,DataT>::build( const vec_t *positions, const DataT *data, size_t count )
+{
+	clear();
+	if( ! count )
+		return;
+
+	// split the points into leaves, then gather them in leaf order
+	mBuildOrder.resize( count );
+	std::iota( mBuildOrder.begin(), mBuildOrder.end(), 0 );
+	mCells.resize( getNumCells( static_cast<uint32_t>( count ) ) );
+	buildImpl( positions, 0, static_cast<uint32_t>( count ), 0, details::parallelDepth() );
+
+	mNodes.reserve( count );
+	for( auto &coordinates : mCoordinates )
+		coordinates.reserve( count );
+	for( uint32_t i : mBuildOrder ) {
+		mNodes.emplace_back( positions[i], data ? data[i] : DataT() );
+		for( uint8_t axis = 0; axis < DIM; ++axis )
+			mCoordinates[axis].push_back( positions[i][axis] );
+	}
+}
+template<uint8_t DIM, class T, class DataT>
+template<class InputIt>
+void BucketKdTree<DIM,T,DataT>::build( InputIt first, InputIt last )
+{
+	std::vector<vec_t> positions;
+	std::vector<DataT> data;
+	for( ; first != last; ++first ) {
+		positions.push_back( first->first );
+		data.push_back( first->second );
+	}
+	build( positions.data(), data.data(), positions.size() );
+}
+//! Returns the number of cells of a subtree holding count points
+template<uint8_t DIM, class T, class DataT>
+uint32_t BucketKdTree<DIM,T,DataT>::getNumCells( uint32_t count ) const
+{
+	if( count <= mBucketSize )
+		return 1;
+	return 1 + getNumCells( count / 2 ) + getNumCells( count - count / 2 );
+}
+template<uint8_t DIM, class T, class DataT>
+void BucketKdTree<DIM,T,DataT>::buildImpl( const vec_t *positions, uint32_t begin, uint32_t end, uint32_t index, uint32_t parallelDepth )
+{
+	Cell &cell	= mCells[index];
+	cell.mBegin	= begin;
+	cell.mEnd	= end;
+	if( end - begin <= mBucketSize ) {
+		cell.mAxis	= 0;
+		cell.mSplit	= 0;
+		cell.mRight	= NO_NODE;
+		return;
+	}
+
+	// split the widest axis at the median, the left half is [begin, mid) and the right half [mid, end)
+	uint32_t* order = mBuildOrder.data();
+	vec_t min = positions[order[begin]];
+	vec_t max = min;
+	for( uint32_t i = begin + 1; i < end; ++i ) {
+		min = glm::min( min, positions[order[i]] );
+		max = glm::max( max, positions[order[i]] );
+	}
+	uint32_t axis = 0;
+	for( uint32_t i = 1; i < DIM; ++i ) {
+		if( max[i] - min[i] > max[axis] - min[axis] )
+			axis = i;
+	}
+	const uint32_t mid = begin + ( end - begin ) / 2;
+	std::nth_element( order + begin, order + mid, order + end, [positions, axis]( uint32_t a, uint32_t b ) {
+		return positions[a][axis] < positions[b][axis];
+	} );
+
+	const uint32_t right	= index + 1 + getNumCells( mid - begin );
+	cell.mAxis	= axis;
+	cell.mSplit	= positions[order[mid]][axis];
+	cell.mRight	= right;
+
+	const uint32_t childDepth = parallelDepth ? parallelDepth - 1 : 0;
+	details::parallelInvoke( parallelDepth > 0 && end - begin >= PARALLEL_BUILD_SIZE,
+		[=] { buildImpl( positions, begin, mid, index + 1, childDepth ); },
+		[=] { buildImpl( positions, mid, end, right, childDepth ); } );
+}
+template<uint8_t DIM, class T, class DataT>
+void BucketKdTree<DIM,T,DataT>::clear()
+{
+	mCells.clear();
+	mNodes.clear();
+	for( auto &coordinates : mCoordinates )
+		coordinates.clear();
+}
+
+template<uint8_t DIM, class T, class DataT>
+typename BucketKdTree<DIM,T,DataT>::Node* BucketKdTree<DIM,T,DataT>::nearestNeighborSearch( const vec_t &position, T *distanceSq ) const
+{
+	return nearestNeighborSearchIf( position, distanceSq, details::AcceptAll() );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+typename BucketKdTree<DIM,T,DataT>::Node* BucketKdTree<DIM,T,DataT>::nearestNeighborSearchIf( const vec_t &position, T *distanceSq, Predicate predicate ) const
+{
+	if( mNodes.empty() )
+		return nullptr;
+
+	uint32_t result	= NO_NODE;
+	T dSq			= std::numeric_limits<T>::max();
+	vec_t offsets	= vec_t( 0 );
+	nearestNeighborSearchImpl( 0, position, &offsets, 0, predicate, &result, &dSq );
+	if( result == NO_NODE )
+		return nullptr;
+	if( distanceSq )
+		*distanceSq = dSq;
+
+	return getNode( result );
+}
+// offsets holds the distance from the position to the current cell along each axis, offsetDistanceSq their square length
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+void BucketKdTree<DIM,T,DataT>::nearestNeighborSearchImpl( uint32_t index, const vec_t &position, vec_t *offsets, T offsetDistanceSq, Predicate &predicate, uint32_t *result, T *resultDistanceSq ) const
+{
+	const Cell &cell = mCells[index];
+	if( cell.isLeaf() ) {
+		leafNearest( cell, position, predicate, result, resultDistanceSq );
+		return;
+	}
+
+	// recursively search into the nearest sub-tree first
+	const T d				= position[cell.mAxis] - cell.mSplit;
+	const uint32_t nearest	= d <= 0 ? index + 1 : cell.mRight;
+	const uint32_t furthest	= d <= 0 ? cell.mRight : index + 1;
+	nearestNeighborSearchImpl( nearest, position, offsets, offsetDistanceSq, predicate, result, resultDistanceSq );
+
+	// the furthest sub-tree can only help if its cell is closer than the best so far
+	const T offset = ( *offsets )[cell.mAxis];
+	const T furthestDistanceSq = offsetDistanceSq - offset * offset + d * d;
+	if( furthestDistanceSq < *resultDistanceSq ) {
+		( *offsets )[cell.mAxis] = d;
+		nearestNeighborSearchImpl( furthest, position, offsets, furthestDistanceSq, predicate, result, resultDistanceSq );
+		( *offsets )[cell.mAxis] = offset;
+	}
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+void BucketKdTree<DIM,T,DataT>::leafNearest( const Cell &cell, const vec_t &position, Predicate &predicate, uint32_t *result, T *resultDistanceSq ) const
+{
+	// only points closer than the best so far reach the predicate
+	BruteForceTraits<DIM,T>::within( mCoordinates, cell.mBegin, cell.mEnd, position, *resultDistanceSq, [&]( size_t i, T distSq ) {
+		if( distSq < *resultDistanceSq && predicate( getNode( static_cast<uint32_t>( i ) ) ) ) {
+			*result = static_cast<uint32_t>( i );
+			*resultDistanceSq = distSq;
+		}
+	} );
+}
+template<uint8_t DIM, class T, class DataT>
+void BucketKdTree<DIM,T,DataT>::leafNearest( const Cell &cell, const vec_t &position, details::AcceptAll &, uint32_t *result, T *resultDistanceSq ) const
+{
+	T distSq;
+	const size_t nearest = BruteForceTraits<DIM,T>::nearest( mCoordinates, cell.mBegin, cell.mEnd, position, &distSq );
+	if( distSq < *resultDistanceSq ) {
+		*result = static_cast<uint32_t>( nearest );
+		*resultDistanceSq = distSq;
+	}
+}
+
+template<uint8_t DIM, class T, class DataT>
+std::vector<typename BucketKdTree<DIM,T,DataT>::NodePair> BucketKdTree<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius ) const
+{
+	return rangeSearchIf( position, radius, details::AcceptAll() );
+}
+template<uint8_t DIM, class T, class DataT>
+void BucketKdTree<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius, const std::function<void(Node*,T)> &visitor ) const
+{
+	rangeSearchIf( position, radius, details::AcceptAll(), visitor );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Visitor>
+void BucketKdTree<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius, Visitor &&visitor ) const
+{
+	rangeSearchIf( position, radius, details::AcceptAll(), std::forward<Visitor>( visitor ) );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+std::vector<typename BucketKdTree<DIM,T,DataT>::NodePair> BucketKdTree<DIM,T,DataT>::rangeSearchIf( const vec_t &position, T radius, Predicate predicate ) const
+{
+	std::vector<NodePair> results;
+	if( ! mNodes.empty() ) {
+		vec_t offsets = vec_t( 0 );
+		auto collect = [&results]( Node* node, T distanceSq ) {
+			results.emplace_back( node, distanceSq );
+		};
+		rangeSearchImpl( 0, position, &offsets, 0, radius, predicate, collect );
+	}
+	return results;
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate, class Visitor>
+void BucketKdTree<DIM,T,DataT>::rangeSearchIf( const vec_t &position, T radius, Predicate predicate, Visitor &&visitor ) const
+{
+	if( ! mNodes.empty() ) {
+		vec_t offsets = vec_t( 0 );
+		rangeSearchImpl( 0, position, &offsets, 0, radius, predicate, visitor );
+	}
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate, class Visitor>
+bool BucketKdTree<DIM,T,DataT>::rangeSearchImpl( uint32_t index, const vec_t &position, vec_t *offsets, T offsetDistanceSq, T radius, Predicate &predicate, Visitor &visitor ) const
+{
+	const Cell &cell = mCells[index];
+	if( cell.isLeaf() ) {
+		return BruteForceTraits<DIM,T>::within( mCoordinates, cell.mBegin, cell.mEnd, position, radius * radius, [&]( size_t i, T distSq ) {
+			Node* node = getNode( static_cast<uint32_t>( i ) );
+			return predicate( node ) && details::visit( visitor, node, distSq );
+		} );
+	}
+
+	// the nearest child always overlaps the range when its parent does, the other one only if its cell is close enough
+	const T d = position[cell.mAxis] - cell.mSplit;
+	if( rangeSearchImpl( d <= 0 ? index + 1 : cell.mRight, position, offsets, offsetDistanceSq, radius, predicate, visitor ) )
+		return true;
+	const T offset = ( *offsets )[cell.mAxis];
+	const T furthestDistanceSq = offsetDistanceSq - offset * offset + d * d;
+	bool stopped = false;
+	if( furthestDistanceSq < radius * radius ) {
+		( *offsets )[cell.mAxis] = d;
+		stopped = rangeSearchImpl( d <= 0 ? cell.mRight : index + 1, position, offsets, furthestDistanceSq, radius, predicate, visitor );
+		( *offsets )[cell.mAxis] = offset;
+	}
+	return stopped;
+}
+
+template<uint8_t DIM, class T, class DataT>
+size_t BucketKdTree<DIM,T,DataT>::kNearest( const vec_t &position, size_t k, T maxRadius, NodePair *results ) const
+{
+	return kNearestIf( position, k, maxRadius, results, details::AcceptAll() );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+size_t BucketKdTree<DIM,T,DataT>::kNearestIf( const vec_t &position, size_t k, T maxRadius, NodePair *results, Predicate predicate ) const
+{
+	if( mNodes.empty() || ! k )
+		return 0;
+
+	details::KNearestHeap<NodePair> heap( results, k, maxRadius );
+	vec_t offsets = vec_t( 0 );
+	kNearestImpl( 0, position, &offsets, 0, predicate, &heap );
+	return heap.finish();
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+void BucketKdTree<DIM,T,DataT>::kNearestImpl( uint32_t index, const vec_t &position, vec_t *offsets, T offsetDistanceSq, Predicate &predicate, details::KNearestHeap<NodePair> *heap ) const
+{
+	const Cell &cell = mCells[index];
+	if( cell.isLeaf() ) {
+		// the kernel's test is strict, the heap takes points exactly at maxRadius too
+		for( uint32_t i = cell.mBegin; i < cell.mEnd; ++i ) {
+			const T distSq = glm::distance2( mNodes[i].mPosition, position );
+			if( distSq <= heap->bound() && predicate( getNode( i ) ) )
+				heap->push( getNode( i ), distSq );
+		}
+		return;
+	}
+
+	// same traversal as the nearest neighbor search, pruning against the farthest of the k kept so far
+	const T d = position[cell.mAxis] - cell.mSplit;
+	kNearestImpl( d <= 0 ? index + 1 : cell.mRight, position, offsets, offsetDistanceSq, predicate, heap );
+	const T offset = ( *offsets )[cell.mAxis];
+	const T furthestDistanceSq = offsetDistanceSq - offset * offset + d * d;
+	if( furthestDistanceSq <= heap->bound() ) {
+		( *offsets )[cell.mAxis] = d;
+		kNearestImpl( d <= 0 ? cell.mRight : index + 1, position, offsets, furthestDistanceSq, predicate, heap );
+		( *offsets )[cell.mAxis] = offset;
+	}
+}
+
+//! Represents a 2D float bucketed K-D Tree, leaves are scanned with AVX or SSE2 where available
+template<class DataT=uint32_t> using BucketKdTree2 = BucketKdTree<2,float,DataT>;
+//! Represents a 3D float bucketed K-D Tree
+template<class DataT=uint32_t> using BucketKdTree3 = BucketKdTree<3,float,DataT>;
+//! Represents a 2D double bucketed K-D Tree
+template<class DataT=uint32_t> using dBucketKdTree2 = BucketKdTree<2,double,DataT>;
+//! Represents a 3D double bucketed K-D Tree
+template<class DataT=uint32_t> using dBucketKdTree3 = BucketKdTree<3,double,DataT>;
+
+};
+
+namespace sp = SpacePartitioning;
@@ -26,12 +26,17 @@
 
 #include <vector>
 #include <limits>
+#include <cstdlib>
 #include <algorithm>
 #include "cinder/AxisAlignedBox.h"
 #include "cinder/Exception.h"
 #include "cinder/Rect.h"
 #include "cinder/Utilities.h"
 #include "cinder/Vector.h"
+#include "sp/Filter.h"
+#include "sp/KNearest.h"
+#include "sp/Periodic.h"
+#include "sp/Visitor.h"
 
 namespace SpacePartitioning {
 	
@@ -60,6 +65,12 @@ public:
 	void erase( Node* node );
 	//! Finds and Returns the Node containing this data
 	Node* find( DataT data );
+	//! Makes queries wrap around the domain [min, max), distances being measured to the nearest periodic image. Positions inserted afterwards are wrapped into the domain. Range and k nearest searches are limited to half the smallest extent of the domain
+	void setPeriodicDomain( const vec_t &min, const vec_t &max ) { mPeriodicDomain.set( min, max ); }
+	//! Goes back to unbounded queries
+	void clearPeriodicDomain() { mPeriodicDomain.reset(); }
+	//! Returns whether queries wrap around a periodic domain
+	bool isPeriodic() const { return mPeriodicDomain.isEnabled(); }
 	
 	//! Represents a single element of the Grid
 	class Node {
@@ -87,6 +98,24 @@ public:
 	std::vector<NodePair> rangeSearch( const vec_t &position, T radius ) const;
 	//! Returns a vector of Nodes within a radius along with their square distances to the position
 	void rangeSearch( const vec_t &position, T radius, const std::function<void(Node*,T)> &visitor ) const;
+	//! Calls visitor( Node*, T distanceSq ) with the Nodes within a radius, a visitor returning bool stops the search by returning true
+	template<class Visitor>
+	void rangeSearch( const vec_t &position, T radius, Visitor &&visitor ) const;
+	//! Writes the k nearest Nodes within maxRadius to results, nearest first, and returns how many were found. results must hold k pairs, nothing is allocated
+	size_t kNearest( const vec_t &position, size_t k, T maxRadius, NodePair *results ) const;
+	
+	//! Returns the nearest Node for which predicate( Node* ) returns true, or nullptr if there is none. Rejected nodes don't narrow the search
+	template<class Predicate>
+	Node* nearestNeighborSearchIf( const vec_t &position, T *distanceSq, Predicate predicate ) const;
+	//! Returns a vector of the Nodes within a radius for which predicate( Node* ) returns true
+	template<class Predicate>
+	std::vector<NodePair> rangeSearchIf( const vec_t &position, T radius, Predicate predicate ) const;
+	//! Calls visitor with the Nodes within a radius for which predicate( Node* ) returns true, a visitor returning bool stops the search by returning true
+	template<class Predicate, class Visitor>
+	void rangeSearchIf( const vec_t &position, T radius, Predicate predicate, Visitor &&visitor ) const;
+	//! Writes the k nearest Nodes within maxRadius for which predicate( Node* ) returns true to results, nearest first, and returns how many were found
+	template<class Predicate>
+	size_t kNearestIf( const vec_t &position, size_t k, T maxRadius, NodePair *results, Predicate predicate ) const;
 	
 	//! Returns the number of bins of the grid
 	size_t getNumBins() const { return mBins.size(); }
@@ -118,11 +147,18 @@ protected:
 	void resize( const vec_t &min, const vec_t &max );
 	void resize( const vec_t &min, const vec_t &max, uint32_t k );
 	void insert( Node *node );
+	template<class Predicate, class Visitor>
+	bool rangeSearchImpl( const vec_t &position, T radius, Predicate &predicate, Visitor &visitor ) const;
+	template<class Predicate>
+	void kNearestImages( const vec_t &position, T radius, Predicate &predicate, details::KNearestHeap<NodePair> *heap ) const;
+	template<class Predicate>
+	void kNearestImpl( const vec_t &position, Predicate &predicate, details::KNearestHeap<NodePair> *heap ) const;
 	
 	Vector		mBins;
 	ivec_t		mNumCells, mGridMin, mGridMax;
 	vec_t		mMin, mMax, mOffset;
 	uint32_t	mK, mCellSize;
+	details::PeriodicDomain<DIM,T>	mPeriodicDomain;
 };
 
 	
@@ -162,7 +198,8 @@ struct GridTraits<2,T,DataT> {
 	{
 		return uint32_t( numCells.x * numCells.y );
 	}
-	static void rangeSearch( std::vector<typename Grid<2,T,DataT>::NodePair> *results, const typename Grid<2,T,DataT>::Vector &grid, const typename Grid<2,T,DataT>::vec_t &position, T radius, const typename Grid<2,T,DataT>::ivec_t &minCell, const typename Grid<2,T,DataT>::ivec_t &maxCell, const typename Grid<2,T,DataT>::ivec_t &numCells )
+	template<class Predicate, class Visitor>
+	static bool rangeSearch( const typename Grid<2,T,DataT>::Vector &grid, const typename Grid<2,T,DataT>::vec_t &position, T radius, const typename Grid<2,T,DataT>::ivec_t &minCell, const typename Grid<2,T,DataT>::ivec_t &maxCell, const typename Grid<2,T,DataT>::ivec_t &numCells, Predicate &predicate, Visitor &visitor )
 	{
 		T distSq;
 		T radiusSq = radius * radius;
@@ -172,29 +209,13 @@ struct GridTraits<2,T,DataT> {
 				const std::vector<typename Grid<2,T,DataT>::Node*>& cell = grid[GridTraits<2,T,DataT>::toIndex( pos, numCells )];
 				for( const auto& node : cell ) {
 					distSq = glm::distance2( position, node->getPosition() );
-					if( distSq < radiusSq ) {
-						results->emplace_back( std::make_pair( node, distSq ) );
-					}
-				}
-			}
-		}
-	}
-	static void rangeSearch( const std::function<void(typename Grid<2,T,DataT>::Node*,T)> &visitor, const typename Grid<2,T,DataT>::Vector &grid, const typename Grid<2,T,DataT>::vec_t &position, T radius, const typename Grid<2,T,DataT>::ivec_t &minCell, const typename Grid<2,T,DataT>::ivec_t &maxCell, const typename Grid<2,T,DataT>::ivec_t &numCells )
-	{
-		T distSq;
-		T radiusSq = radius * radius;
-		typename Grid<2,T,DataT>::ivec_t pos;
-		for( pos.y = minCell.y; pos.y < maxCell.y; pos.y++ ) {
-			for( pos.x = minCell.x; pos.x < maxCell.x; pos.x++ ) {
-				const std::vector<typename Grid<2,T,DataT>::Node*>& cell = grid[GridTraits<2,T,DataT>::toIndex( pos, numCells )];
-				for( const auto& node : cell ) {
-					distSq = glm::distance2( position, node->getPosition() );
-					if( distSq < radiusSq ) {
-						visitor( node, distSq );
+					if( distSq < radiusSq && predicate( node ) && details::visit( visitor, node, distSq ) ) {
+						return true;
 					}
 				}
 			}
 		}
+		return false;
 	}
 	typedef ci::RectT<T> Bounds;
 };
@@ -228,7 +249,8 @@ struct GridTraits<3,T,DataT> {
 	{
 		return numCells.x * numCells.y * numCells.z;
 	}
-	static void rangeSearch( std::vector<typename Grid<3,T,DataT>::NodePair> *results, const typename Grid<3,T,DataT>::Vector &bins, const typename Grid<3,T,DataT>::vec_t &position, T radius, const typename Grid<3,T,DataT>::ivec_t &minCell, const typename Grid<3,T,DataT>::ivec_t &maxCell, const typename Grid<3,T,DataT>::ivec_t &numCells )
+	template<class Predicate, class Visitor>
+	static bool rangeSearch( const typename Grid<3,T,DataT>::Vector &bins, const typename Grid<3,T,DataT>::vec_t &position, T radius, const typename Grid<3,T,DataT>::ivec_t &minCell, const typename Grid<3,T,DataT>::ivec_t &maxCell, const typename Grid<3,T,DataT>::ivec_t &numCells, Predicate &predicate, Visitor &visitor )
 	{
 		T distSq;
 		T radiusSq = radius * radius;
@@ -239,32 +261,14 @@ struct GridTraits<3,T,DataT> {
 					const std::vector<typename Grid<3,T,DataT>::Node*>& cell = bins[GridTraits<3,T,DataT>::toIndex( pos, numCells )];
 					for( const auto& node : cell ) {
 						distSq = glm::distance2( position, node->getPosition() );
-						if( distSq < radiusSq ) {
-							results->emplace_back( std::make_pair( node, distSq ) );
-						}
-					}
-				}
-			}
-		}
-	}
-	static void rangeSearch( const std::function<void(typename Grid<3,T,DataT>::Node*,T)> &visitor, const typename Grid<3,T,DataT>::Vector &bins, const typename Grid<3,T,DataT>::vec_t &position, T radius, const typename Grid<3,T,DataT>::ivec_t &minCell, const typename Grid<3,T,DataT>::ivec_t &maxCell, const typename Grid<3,T,DataT>::ivec_t &numCells )
-	{
-		T distSq;
-		T radiusSq = radius * radius;
-		typename Grid<3,T,DataT>::ivec_t pos;
-		for( pos.z = minCell.z; pos.z < maxCell.z; pos.z++ ) {
-			for( pos.y = minCell.y; pos.y < maxCell.y; pos.y++ ) {
-				for( pos.x = minCell.x; pos.x < maxCell.x; pos.x++ ) {
-					const std::vector<typename Grid<3,T,DataT>::Node*>& cell = bins[GridTraits<3,T,DataT>::toIndex( pos, numCells )];
-					for( const auto& node : cell ) {
-						distSq = glm::distance2( position, node->getPosition() );
-						if( distSq < radiusSq ) {
-							visitor( node, distSq );
+						if( distSq < radiusSq && predicate( node ) && details::visit( visitor, node, distSq ) ) {
+							return true;
 						}
 					}
 				}
 			}
 		}
+		return false;
 	}
 	typedef ci::AxisAlignedBox Bounds;
 };
@@ -291,8 +295,9 @@ Grid<DIM,T,DataT>::~Grid(){
 }
 	
 template<uint8_t DIM, class T, class DataT>
-void Grid<DIM,T,DataT>::insert( const vec_t &position, DataT data )
+void Grid<DIM,T,DataT>::insert( const vec_t &insertPosition, DataT data )
 {
+	const vec_t position = mPeriodicDomain.wrap( insertPosition );
 	// Check if it fits the size of the grid's container
 	if( glm::any( glm::greaterThan( position, mMax ) ) || glm::any( glm::lessThan( position, mMin ) ) )
 		resize( glm::min( position, mMin ), glm::max( position, mMax ) );
@@ -361,55 +366,183 @@ typename Grid<DIM,T,DataT>::Node* Grid<DIM,T,DataT>::find( DataT data )
 	return nullptr;
 }
 	
-// TODO: Must be a better way to do this
 template<uint8_t DIM, class T, class DataT>
 typename Grid<DIM,T,DataT>::Node* Grid<DIM,T,DataT>::nearestNeighborSearch( const vec_t &position, T *distanceSq ) const
 {
-	// Grow search radius until found something
-	// TODO: !!! Might grow forever !!!
-	std::vector<typename Grid<DIM,T,DataT>::NodePair> results;
-	T cellSize = static_cast<T>( mCellSize );
-	while( ! results.size() ) {
-		results = rangeSearch( position, cellSize );
-		cellSize *= 2;
-	}
+	return nearestNeighborSearchIf( position, distanceSq, details::AcceptAll() );
+}
+
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+typename Grid<DIM,T,DataT>::Node* Grid<DIM,T,DataT>::nearestNeighborSearchIf( const vec_t &position, T *distanceSq, Predicate predicate ) const
+{
+	if( mBins.empty() )
+		return nullptr;
 	
-	// Once we have nodes to look at, iterate and find the closest one
-	Node* nearestNode = nullptr;
-	T minDist = std::numeric_limits<T>::max();
-	for( const auto& node : results ) {
-		if( node.second < minDist ) {
-			nearestNode = node.first;
-			minDist = node.second;
-		}
-	}
+	// the ring search is bounded by the grid, so it ends even when every node is rejected
+	NodePair nearest;
+	details::KNearestHeap<NodePair> heap( &nearest, 1, std::numeric_limits<T>::max() );
+	kNearestImages( position, std::numeric_limits<T>::max(), predicate, &heap );
+	if( ! heap.finish() )
+		return nullptr;
 	if( distanceSq != nullptr )
-		*distanceSq = minDist;
-	
-	return nearestNode;
+		*distanceSq = nearest.second;
+	return nearest.first;
 }
 
 template<uint8_t DIM, class T, class DataT>
 std::vector<typename Grid<DIM,T,DataT>::NodePair> Grid<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius ) const
 {
-	vec_t radiusVec = vec_t( radius );
-	vec_t min       = glm::clamp( position - radiusVec, mMin, mMax + vec_t( 1 ) );
-	vec_t max       = glm::clamp( position + radiusVec, mMin, mMax + vec_t( 1 ) );
-	ivec_t minCell	= glm::max( GridTraits<DIM,T,DataT>::toGridPosition( min, mOffset, mK ), ivec_t( 0 ) );
-	ivec_t maxCell	= glm::min( ivec_t(1) + GridTraits<DIM,T,DataT>::toGridPosition( max, mOffset, mK ), mNumCells );
+	return rangeSearchIf( position, radius, details::AcceptAll() );
+}
+template<uint8_t DIM, class T, class DataT>
+void Grid<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius, const std::function<void(Node*,T)> &visitor ) const
+{
+	rangeSearchIf( position, radius, details::AcceptAll(), visitor );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Visitor>
+void Grid<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius, Visitor &&visitor ) const
+{
+	rangeSearchIf( position, radius, details::AcceptAll(), std::forward<Visitor>( visitor ) );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+std::vector<typename Grid<DIM,T,DataT>::NodePair> Grid<DIM,T,DataT>::rangeSearchIf( const vec_t &position, T radius, Predicate predicate ) const
+{
 	std::vector<typename Grid<DIM,T,DataT>::NodePair> results;
-	GridTraits<DIM,T,DataT>::rangeSearch( &results, mBins, position, radius, minCell, maxCell, mNumCells );
+	auto collect = [&results]( Node* node, T distanceSq ) {
+		results.emplace_back( node, distanceSq );
+	};
+	rangeSearchIf( position, radius, predicate, collect );
 	return results;
 }
 template<uint8_t DIM, class T, class DataT>
-void Grid<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius, const std::function<void(Node*,T)> &visitor ) const
+template<class Predicate, class Visitor>
+void Grid<DIM,T,DataT>::rangeSearchIf( const vec_t &position, T radius, Predicate predicate, Visitor &&visitor ) const
+{
+	// each image of the position is searched on its own, the radius keeps them from reaching a node twice
+	const T clampedRadius	= mPeriodicDomain.clampRadius( radius );
+	vec_t images[details::PeriodicDomain<DIM,T>::MAX_IMAGES];
+	const uint32_t numImages = mPeriodicDomain.getImages( position, clampedRadius, images );
+	for( uint32_t i = 0; i < numImages; ++i ) {
+		if( rangeSearchImpl( images[i], clampedRadius, predicate, visitor ) )
+			return;
+	}
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate, class Visitor>
+bool Grid<DIM,T,DataT>::rangeSearchImpl( const vec_t &position, T radius, Predicate &predicate, Visitor &visitor ) const
 {
 	vec_t radiusVec = vec_t( radius );
 	vec_t min       = glm::clamp( position - radiusVec, mMin, mMax + vec_t( 1 ) );
 	vec_t max       = glm::clamp( position + radiusVec, mMin, mMax + vec_t( 1 ) );
 	ivec_t minCell	= glm::max( GridTraits<DIM,T,DataT>::toGridPosition( min, mOffset, mK ), ivec_t( 0 ) );
 	ivec_t maxCell	= glm::min( ivec_t(1) + GridTraits<DIM,T,DataT>::toGridPosition( max, mOffset, mK ), mNumCells );
-	GridTraits<DIM,T,DataT>::rangeSearch( visitor, mBins, position, radius, minCell, maxCell, mNumCells );
+	return GridTraits<DIM,T,DataT>::rangeSearch( mBins, position, radius, minCell, maxCell, mNumCells, predicate, visitor );
+}
+
+template<uint8_t DIM, class T, class DataT>
+size_t Grid<DIM,T,DataT>::kNearest( const vec_t &position, size_t k, T maxRadius, NodePair *results ) const
+{
+	return kNearestIf( position, k, maxRadius, results, details::AcceptAll() );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+size_t Grid<DIM,T,DataT>::kNearestIf( const vec_t &position, size_t k, T maxRadius, NodePair *results, Predicate predicate ) const
+{
+	if( mBins.empty() || ! k )
+		return 0;
+	
+	const T radius = mPeriodicDomain.clampRadius( maxRadius );
+	details::KNearestHeap<NodePair> heap( results, k, radius );
+	kNearestImages( position, radius, predicate, &heap );
+	return heap.finish();
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+void Grid<DIM,T,DataT>::kNearestImages( const vec_t &position, T radius, Predicate &predicate, details::KNearestHeap<NodePair> *heap ) const
+{
+	// images are skipped once the k kept so far are nearer than the domain
+	vec_t images[details::PeriodicDomain<DIM,T>::MAX_IMAGES];
+	const uint32_t numImages = mPeriodicDomain.getImages( position, radius, images );
+	for( uint32_t i = 0; i < numImages; ++i ) {
+		if( i == 0 || mPeriodicDomain.distance2( images[i] ) <= heap->bound() )
+			kNearestImpl( images[i], predicate, heap );
+	}
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+void Grid<DIM,T,DataT>::kNearestImpl( const vec_t &position, Predicate &predicate, details::KNearestHeap<NodePair> *heap ) const
+{
+	const ivec_t lastCell	= mNumCells - ivec_t( 1 );
+	const ivec_t center		= glm::clamp( GridTraits<DIM,T,DataT>::toGridPosition( glm::clamp( position, mMin, mMax ), mOffset, mK ), ivec_t( 0 ), lastCell );
+	const T cellSize		= static_cast<T>( mCellSize );
+	
+	// visit rings of cells around the position's cell, each cell once and nothing past the grid bounds
+	for( int ring = 0; ; ++ring ) {
+		// stop once the nearest point a ring could hold is further than the k kept so far, or there is no ring left
+		if( ring > 0 ) {
+			T ringDistance	= std::numeric_limits<T>::max();
+			bool hasCells	= false;
+			for( uint8_t axis = 0; axis < DIM; ++axis ) {
+				if( center[axis] - ring >= 0 ) {
+					const T inner = static_cast<T>( center[axis] - ring + 1 ) * cellSize - mOffset[axis];
+					ringDistance = std::min( ringDistance, std::max( position[axis] - inner, T( 0 ) ) );
+					hasCells = true;
+				}
+				if( center[axis] + ring <= lastCell[axis] ) {
+					const T inner = static_cast<T>( center[axis] + ring ) * cellSize - mOffset[axis];
+					ringDistance = std::min( ringDistance, std::max( inner - position[axis], T( 0 ) ) );
+					hasCells = true;
+				}
+			}
+			if( ! hasCells || ringDistance * ringDistance > heap->bound() )
+				break;
+		}
+		
+		// rows along the x axis on the border of the ring are visited whole, the others only at both ends
+		const ivec_t minCell = glm::max( center - ivec_t( ring ), ivec_t( 0 ) );
+		const ivec_t maxCell = glm::min( center + ivec_t( ring ), lastCell );
+		auto scanCell = [&]( const ivec_t &cell ) {
+			for( const auto& node : mBins[GridTraits<DIM,T,DataT>::toIndex( cell, mNumCells )] ) {
+				const T distanceSq = glm::distance2( position, node->getPosition() );
+				if( distanceSq <= heap->bound() && predicate( node ) )
+					heap->push( node, distanceSq );
+			}
+		};
+		ivec_t row = minCell;
+		while( true ) {
+			bool onRing = false;
+			for( uint8_t axis = 1; axis < DIM; ++axis )
+				onRing = onRing || std::abs( row[axis] - center[axis] ) == ring;
+			ivec_t cell = row;
+			if( onRing ) {
+				for( ; cell.x <= maxCell.x; ++cell.x )
+					scanCell( cell );
+			}
+			else {
+				cell.x = center.x - ring;
+				if( cell.x >= 0 )
+					scanCell( cell );
+				cell.x = center.x + ring;
+				if( cell.x <= lastCell.x )
+					scanCell( cell );
+			}
+			
+			// step to the next row of the box
+			uint8_t axis = 1;
+			for( ; axis < DIM; ++axis ) {
+				if( row[axis] < maxCell[axis] ) {
+					row[axis]++;
+					break;
+				}
+				row[axis] = minCell[axis];
+			}
+			if( axis == DIM )
+				break;
+		}
+	}
 }
 	
 	
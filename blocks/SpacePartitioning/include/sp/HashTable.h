@@ -28,6 +28,10 @@
 #include "cinder/Exception.h"
 #include "cinder/Utilities.h"
 #include "cinder/Vector.h"
+#include "sp/Filter.h"
+#include "sp/KNearest.h"
+#include "sp/Periodic.h"
+#include "sp/Visitor.h"
 
 namespace SpacePartitioning {
 	
@@ -48,6 +52,12 @@ public:
 	void clear();
 	//! Returns the size of the HashTable
 	size_t size() const;
+	//! Makes queries wrap around the domain [min, max), distances being measured to the nearest periodic image. Positions inserted afterwards are wrapped into the domain. Range and k nearest searches are limited to half the smallest extent of the domain
+	void setPeriodicDomain( const vec_t &min, const vec_t &max ) { mPeriodicDomain.set( min, max ); }
+	//! Goes back to unbounded queries
+	void clearPeriodicDomain() { mPeriodicDomain.reset(); }
+	//! Returns whether queries wrap around a periodic domain
+	bool isPeriodic() const { return mPeriodicDomain.isEnabled(); }
 	
 	//! Represents a single element of the HashTable
 	class Node {
@@ -55,7 +65,7 @@ public:
 		//! Returns the position of the node
 		vec_t getPosition() const { return mPosition; }
 		//! Returns the user data
-		void* getData() const { return mData; }
+		const DataT& getData() const { return mData; }
 		
 		Node( const vec_t &position, const DataT &data );
 	protected:
@@ -73,12 +83,35 @@ public:
 	std::vector<NodePair>	rangeSearch( const vec_t &position, T radius ) const;
 	//! Returns a vector of Nodes within a radius along with their square distances to the position
 	void			rangeSearch( const vec_t &position, T radius, const std::function<void(Node*,T)> &visitor ) const;
+	//! Calls visitor( Node*, T distanceSq ) with the Nodes within a radius, a visitor returning bool stops the search by returning true
+	template<class Visitor>
+	void			rangeSearch( const vec_t &position, T radius, Visitor &&visitor ) const;
+	//! Writes the k nearest Nodes within maxRadius to results, nearest first, and returns how many were found. results must hold k pairs, nothing is allocated
+	size_t			kNearest( const vec_t &position, size_t k, T maxRadius, NodePair *results ) const;
+	
+	//! Returns the nearest Node for which predicate( Node* ) returns true, or nullptr if there is none. Rejected nodes don't narrow the search
+	template<class Predicate>
+	Node*			nearestNeighborSearchIf( const vec_t &position, T *distanceSq, Predicate predicate ) const;
+	//! Returns a vector of the Nodes within a radius for which predicate( Node* ) returns true
+	template<class Predicate>
+	std::vector<NodePair>	rangeSearchIf( const vec_t &position, T radius, Predicate predicate ) const;
+	//! Calls visitor with the Nodes within a radius for which predicate( Node* ) returns true, a visitor returning bool stops the search by returning true
+	template<class Predicate, class Visitor>
+	void			rangeSearchIf( const vec_t &position, T radius, Predicate predicate, Visitor &&visitor ) const;
+	//! Writes the k nearest Nodes within maxRadius for which predicate( Node* ) returns true to results, nearest first, and returns how many were found
+	template<class Predicate>
+	size_t			kNearestIf( const vec_t &position, size_t k, T maxRadius, NodePair *results, Predicate predicate ) const;
 protected:
+	template<class Predicate, class Visitor>
+	bool rangeSearchImpl( const vec_t &position, T radius, Predicate &predicate, Visitor &visitor ) const;
+	template<class Predicate>
+	void kNearestImpl( const vec_t &position, T radius, Predicate &predicate, details::KNearestHeap<NodePair> *heap ) const;
 	
 	Vector		mHashTable;
 	vec_t		mCellSize;
 	uint32_t	mHashTableSize;
 	vec_t		mMin, mMax, mOffset;
+	details::PeriodicDomain<DIM,T>	mPeriodicDomain;
 };
 	
 class HashTableInsertionFailedException : public ci::Exception {
@@ -103,25 +136,8 @@ struct HashTableTraits<2,T,DataT> {
 		typename HashTable<2,T,DataT>::ivec_t p = glm::floor( position / cellSize );
 		return ( ( p.x * largePrime.x ) ^ ( p.y * largePrime.y ) ) % tableSize;
 	}
-	static void rangeSearch( std::vector<typename HashTable<2,T,DataT>::NodePair> *results, const typename HashTable<2,T,DataT>::Vector &hashTable, const typename HashTable<2,T,DataT>::vec_t &position, T radius, const typename HashTable<2,T,DataT>::vec_t &minCell, const typename HashTable<2,T,DataT>::vec_t &maxCell, const typename HashTable<2,T,DataT>::vec_t &cellSize, uint32_t tableSize )
-	{
-		T distSq;
-		T radiusSq = radius * radius;
-		typename HashTable<2,T,DataT>::vec_t pos;
-		for( pos.y = minCell.y; pos.y < maxCell.y; pos.y += cellSize.y ) {
-			for( pos.x = minCell.x; pos.x < maxCell.x; pos.x += cellSize.x ) {
-				const std::vector<typename HashTable<2,T,DataT>::Node*>& cell = hashTable[HashTableTraits<2,T,DataT>::getHash( pos, cellSize, tableSize )];
-				for( const auto& node : cell ) {
-					distSq = glm::distance2( position, node->getPosition() );
-					if( distSq < radiusSq ) {
-						results->emplace_back( std::make_pair( node, distSq ) );
-					}
-				}
-			}
-		}
-		
-	}
-	static void rangeSearch( const std::function<void(typename HashTable<2,T,DataT>::Node*,T)> &visitor, const typename HashTable<2,T,DataT>::Vector &hashTable, const typename HashTable<2,T,DataT>::vec_t &position, T radius, const typename HashTable<2,T,DataT>::vec_t &minCell, const typename HashTable<2,T,DataT>::vec_t &maxCell, const typename HashTable<2,T,DataT>::vec_t &cellSize, uint32_t tableSize )
+	template<class Predicate, class Visitor>
+	static bool rangeSearch( const typename HashTable<2,T,DataT>::Vector &hashTable, const typename HashTable<2,T,DataT>::vec_t &position, T radius, const typename HashTable<2,T,DataT>::vec_t &minCell, const typename HashTable<2,T,DataT>::vec_t &maxCell, const typename HashTable<2,T,DataT>::vec_t &cellSize, uint32_t tableSize, Predicate &predicate, Visitor &visitor )
 	{
 		T distSq;
 		T radiusSq = radius * radius;
@@ -129,15 +145,19 @@ struct HashTableTraits<2,T,DataT> {
 		for( pos.y = minCell.y; pos.y < maxCell.y; pos.y += cellSize.y ) {
 			for( pos.x = minCell.x; pos.x < maxCell.x; pos.x += cellSize.x ) {
 				const std::vector<typename HashTable<2,T,DataT>::Node*>& cell = hashTable[HashTableTraits<2,T,DataT>::getHash( pos, cellSize, tableSize )];
+				const typename HashTable<2,T,DataT>::vec_t cellPos = glm::floor( pos / cellSize );
 				for( const auto& node : cell ) {
+					// cells colliding in the same bucket would see each other's nodes
+					if( glm::floor( node->getPosition() / cellSize ) != cellPos )
+						continue;
 					distSq = glm::distance2( position, node->getPosition() );
-					if( distSq < radiusSq ) {
-						visitor( node, distSq );
+					if( distSq < radiusSq && predicate( node ) && details::visit( visitor, node, distSq ) ) {
+						return true;
 					}
 				}
 			}
 		}
-		
+		return false;
 	}
 };
 
@@ -149,26 +169,8 @@ struct HashTableTraits<3,T,DataT> {
 		typename HashTable<3,T,DataT>::ivec_t p = glm::floor( position / cellSize );
 		return ( ( p.x * largePrime.x ) ^ ( p.y * largePrime.y ) ^ ( p.z * largePrime.z ) ) % tableSize;
 	}
-	static void rangeSearch( std::vector<typename HashTable<3,T,DataT>::NodePair> *results, const typename HashTable<3,T,DataT>::Vector &hashTable, const typename HashTable<3,T,DataT>::vec_t &position, T radius, const typename HashTable<3,T,DataT>::vec_t &minCell, const typename HashTable<3,T,DataT>::vec_t &maxCell, const typename HashTable<3,T,DataT>::vec_t &cellSize, uint32_t tableSize )
-	{
-		T distSq;
-		T radiusSq = radius * radius;
-		typename HashTable<3,T,DataT>::vec_t pos;
-		for( pos.z = minCell.z; pos.z < maxCell.z; pos.z += cellSize.z ) {
-			for( pos.y = minCell.y; pos.y < maxCell.y; pos.y += cellSize.y ) {
-				for( pos.x = minCell.x; pos.x < maxCell.x; pos.x += cellSize.x ) {
-					const std::vector<typename HashTable<3,T,DataT>::Node*>& cell = hashTable[HashTableTraits<3,T,DataT>::getHash( pos, cellSize, tableSize )];
-					for( const auto& node : cell ) {
-						distSq = glm::distance2( position, node->getPosition() );
-						if( distSq < radiusSq ) {
-							results->emplace_back( std::make_pair( node, distSq ) );
-						}
-					}
-				}
-			}
-		}
-	}
-	static void rangeSearch( const std::function<void(typename HashTable<3,T,DataT>::Node*,T)> &visitor, const typename HashTable<3,T,DataT>::Vector &hashTable, const typename HashTable<3,T,DataT>::vec_t &position, T radius, const typename HashTable<3,T,DataT>::vec_t &minCell, const typename HashTable<3,T,DataT>::vec_t &maxCell, const typename HashTable<3,T,DataT>::vec_t &cellSize, uint32_t tableSize )
+	template<class Predicate, class Visitor>
+	static bool rangeSearch( const typename HashTable<3,T,DataT>::Vector &hashTable, const typename HashTable<3,T,DataT>::vec_t &position, T radius, const typename HashTable<3,T,DataT>::vec_t &minCell, const typename HashTable<3,T,DataT>::vec_t &maxCell, const typename HashTable<3,T,DataT>::vec_t &cellSize, uint32_t tableSize, Predicate &predicate, Visitor &visitor )
 	{
 		T distSq;
 		T radiusSq = radius * radius;
@@ -177,15 +179,20 @@ struct HashTableTraits<3,T,DataT> {
 			for( pos.y = minCell.y; pos.y < maxCell.y; pos.y += cellSize.y ) {
 				for( pos.x = minCell.x; pos.x < maxCell.x; pos.x += cellSize.x ) {
 					const std::vector<typename HashTable<3,T,DataT>::Node*>& cell = hashTable[HashTableTraits<3,T,DataT>::getHash( pos, cellSize, tableSize )];
+					const typename HashTable<3,T,DataT>::vec_t cellPos = glm::floor( pos / cellSize );
 					for( const auto& node : cell ) {
+						// cells colliding in the same bucket would see each other's nodes
+						if( glm::floor( node->getPosition() / cellSize ) != cellPos )
+							continue;
 						distSq = glm::distance2( position, node->getPosition() );
-						if( distSq < radiusSq ) {
-							visitor( node, distSq );
+						if( distSq < radiusSq && predicate( node ) && details::visit( visitor, node, distSq ) ) {
+							return true;
 						}
 					}
 				}
 			}
 		}
+		return false;
 	}
 };
 	
@@ -204,7 +211,7 @@ HashTable<DIM,T,DataT>::HashTable( const vec_t &cellSize, uint32_t tableSize )
 }
 template<uint8_t DIM, class T, class DataT>
 HashTable<DIM,T,DataT>::HashTable( const vec_t &min, const vec_t &max, const vec_t &cellSize, uint32_t tableSize )
-: mCellSize( cellSize ), mHashTableSize( tableSize )
+: mCellSize( cellSize ), mHashTableSize( tableSize ), mMin( min ), mMax( max ), mOffset( -mMin )
 {
 	for( size_t i = 0; i < mHashTableSize; i++ )
 		mHashTable.push_back( std::vector<Node*>() );
@@ -216,10 +223,14 @@ HashTable<DIM,T,DataT>::~HashTable()
 }
 	
 template<uint8_t DIM, class T, class DataT>
-void HashTable<DIM,T,DataT>::insert( const vec_t &position, const DataT &data )
+void HashTable<DIM,T,DataT>::insert( const vec_t &insertPosition, const DataT &data )
 {
+	const vec_t position = mPeriodicDomain.wrap( insertPosition );
+	// Grow the searchable bounds so that queries don't miss nodes inserted outside of them
+	mMin = glm::min( position, mMin );
+	mMax = glm::max( position, mMax );
 	uint32_t hash = HashTableTraits<DIM,T,DataT>::getHash( position, mCellSize, mHashTableSize );
-        mHashTable[hash].emplace_back( new Node( position, data ) );
+	mHashTable[hash].emplace_back( new Node( position, data ) );
 }
 template<uint8_t DIM, class T, class DataT>
 void HashTable<DIM,T,DataT>::clear()
@@ -242,52 +253,113 @@ size_t HashTable<DIM,T,DataT>::size() const
 	return size;
 }
 	
-// TODO: Must be a better way to do this
 template<uint8_t DIM, class T, class DataT>
 typename HashTable<DIM,T,DataT>::Node* HashTable<DIM,T,DataT>::nearestNeighborSearch( const vec_t &position, T *distanceSq ) const
 {
-	// Grow search radius until found something
-	// TODO: !!! Might grow forever !!!
-	std::vector<typename HashTable<DIM,T,DataT>::NodePair> results;
-	T cellSize = static_cast<T>( mCellSize.x );
-	while( ! results.size() ) {
-		results = rangeSearch( position, cellSize );
-		cellSize *= 2;
-	}
+	return nearestNeighborSearchIf( position, distanceSq, details::AcceptAll() );
+}
 
-	// Once we have nodes to look at, iterate and find the closest one
-	Node* nearestNode = nullptr;
-	T minDist = std::numeric_limits<T>::max();
-	for( const auto& node : results ) {
-		if( node.second < minDist ) {
-			nearestNode = node.first;
-			minDist = node.second;
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+typename HashTable<DIM,T,DataT>::Node* HashTable<DIM,T,DataT>::nearestNeighborSearchIf( const vec_t &position, T *distanceSq, Predicate predicate ) const
+{
+	// grow the search radius until something is accepted or the radius covers every node
+	const T maxRadius = glm::distance( position, glm::clamp( position, mMin, mMax ) ) + glm::distance( mMin, mMax );
+	NodePair nearest;
+	for( T radius = static_cast<T>( mCellSize.x ); ; radius *= 2 ) {
+		details::KNearestHeap<NodePair> heap( &nearest, 1, radius );
+		kNearestImpl( position, radius, predicate, &heap );
+		if( heap.finish() ) {
+			if( distanceSq != nullptr )
+				*distanceSq = nearest.second;
+			return nearest.first;
 		}
+		if( radius > maxRadius )
+			return nullptr;
 	}
-	if( distanceSq != nullptr )
-		*distanceSq = minDist;
-
-	return nearestNode;
 }
 
 template<uint8_t DIM, class T, class DataT>
 std::vector<typename HashTable<DIM,T,DataT>::NodePair> HashTable<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius ) const
 {
-	vec_t radiusVec = vec_t( radius );
-	vec_t min       = glm::clamp( position - radiusVec, mMin, mMax + vec_t( 1 ) );
-	vec_t max       = glm::clamp( position + radiusVec, mMin, mMax + vec_t( 1 ) );
+	return rangeSearchIf( position, radius, details::AcceptAll() );
+}
+template<uint8_t DIM, class T, class DataT>
+void HashTable<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius, const std::function<void(Node*,T)> &visitor ) const
+{
+	rangeSearchIf( position, radius, details::AcceptAll(), visitor );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Visitor>
+void HashTable<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius, Visitor &&visitor ) const
+{
+	rangeSearchIf( position, radius, details::AcceptAll(), std::forward<Visitor>( visitor ) );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+std::vector<typename HashTable<DIM,T,DataT>::NodePair> HashTable<DIM,T,DataT>::rangeSearchIf( const vec_t &position, T radius, Predicate predicate ) const
+{
 	std::vector<typename HashTable<DIM,T,DataT>::NodePair> results;
-	HashTableTraits<DIM,T,DataT>::rangeSearch( &results, mHashTable, position, radius, min, max + vec_t( mCellSize ), mCellSize, mHashTableSize );
+	auto collect = [&results]( Node* node, T distanceSq ) {
+		results.emplace_back( node, distanceSq );
+	};
+	rangeSearchIf( position, radius, predicate, collect );
 	return results;
 }
-
 template<uint8_t DIM, class T, class DataT>
-void HashTable<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius, const std::function<void(Node*,T)> &visitor ) const
+template<class Predicate, class Visitor>
+void HashTable<DIM,T,DataT>::rangeSearchIf( const vec_t &position, T radius, Predicate predicate, Visitor &&visitor ) const
+{
+	// each image of the position is searched on its own, the radius keeps them from reaching a node twice
+	const T clampedRadius	= mPeriodicDomain.clampRadius( radius );
+	vec_t images[details::PeriodicDomain<DIM,T>::MAX_IMAGES];
+	const uint32_t numImages = mPeriodicDomain.getImages( position, clampedRadius, images );
+	for( uint32_t i = 0; i < numImages; ++i ) {
+		if( rangeSearchImpl( images[i], clampedRadius, predicate, visitor ) )
+			return;
+	}
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate, class Visitor>
+bool HashTable<DIM,T,DataT>::rangeSearchImpl( const vec_t &position, T radius, Predicate &predicate, Visitor &visitor ) const
 {
 	vec_t radiusVec = vec_t( radius );
 	vec_t min       = glm::clamp( position - radiusVec, mMin, mMax + vec_t( 1 ) );
 	vec_t max       = glm::clamp( position + radiusVec, mMin, mMax + vec_t( 1 ) );
-	HashTableTraits<DIM,T,DataT>::rangeSearch( visitor, mHashTable, position, radius, min, max + vec_t( mCellSize ), mCellSize, mHashTableSize );
+	return HashTableTraits<DIM,T,DataT>::rangeSearch( mHashTable, position, radius, min, max + vec_t( mCellSize ), mCellSize, mHashTableSize, predicate, visitor );
+}
+
+template<uint8_t DIM, class T, class DataT>
+size_t HashTable<DIM,T,DataT>::kNearest( const vec_t &position, size_t k, T maxRadius, NodePair *results ) const
+{
+	return kNearestIf( position, k, maxRadius, results, details::AcceptAll() );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+size_t HashTable<DIM,T,DataT>::kNearestIf( const vec_t &position, size_t k, T maxRadius, NodePair *results, Predicate predicate ) const
+{
+	if( ! k )
+		return 0;
+	
+	const T radius = mPeriodicDomain.clampRadius( maxRadius );
+	details::KNearestHeap<NodePair> heap( results, k, radius );
+	kNearestImpl( position, radius, predicate, &heap );
+	return heap.finish();
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+void HashTable<DIM,T,DataT>::kNearestImpl( const vec_t &position, T radius, Predicate &predicate, details::KNearestHeap<NodePair> *heap ) const
+{
+	auto push = [heap]( Node* node, T distanceSq ) {
+		heap->push( node, distanceSq );
+	};
+	// images are skipped once the k kept so far are nearer than the domain
+	vec_t images[details::PeriodicDomain<DIM,T>::MAX_IMAGES];
+	const uint32_t numImages = mPeriodicDomain.getImages( position, radius, images );
+	for( uint32_t i = 0; i < numImages; ++i ) {
+		if( i == 0 || mPeriodicDomain.distance2( images[i] ) <= heap->bound() )
+			rangeSearchImpl( images[i], radius, predicate, push );
+	}
 }
 	
 //! Represents a 2D float Spatial Hash Table partitioning structure
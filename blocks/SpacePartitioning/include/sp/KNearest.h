@@ -0,0 +1,83 @@
+/*
+ KNearest - Space Partitioning algorithms for Cinder
+ 
+ Copyright (c) 2016, Simon Geilfus, All rights reserved.
+ This code is intended for use with the Cinder C++ library: http://libcinder.org
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+	the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+	the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+
+namespace SpacePartitioning {
+
+namespace details {
+
+//! Keeps the k nearest candidates seen by a query in a max-heap laid over caller storage, so the farthest one is replaced first and nothing is allocated
+template<class NodePair>
+class KNearestHeap {
+public:
+	using node_t = typename NodePair::first_type;
+	using T = typename NodePair::second_type;
+
+	//! storage must hold k pairs, candidates further than maxRadius are ignored
+	KNearestHeap( NodePair *storage, size_t k, T maxRadius )
+	: mStorage( storage ), mK( k ), mSize( 0 ), mMaxDistanceSq( maxRadius * maxRadius )
+	{
+	}
+
+	//! Returns the square distance a candidate has to be within to be kept, regions further than this can be skipped
+	T bound() const { return mSize < mK ? mMaxDistanceSq : mStorage[0].second; }
+	//! Offers a candidate, keeping it if it is one of the k nearest so far
+	void push( node_t node, T distanceSq )
+	{
+		if( mSize < mK ) {
+			if( distanceSq > mMaxDistanceSq )
+				return;
+			mStorage[mSize++] = NodePair( node, distanceSq );
+			std::push_heap( mStorage, mStorage + mSize, compare );
+		}
+		else if( mK && distanceSq < mStorage[0].second ) {
+			std::pop_heap( mStorage, mStorage + mSize, compare );
+			mStorage[mSize - 1] = NodePair( node, distanceSq );
+			std::push_heap( mStorage, mStorage + mSize, compare );
+		}
+	}
+	//! Sorts the kept candidates nearest first and returns their count
+	size_t finish()
+	{
+		std::sort_heap( mStorage, mStorage + mSize, compare );
+		return mSize;
+	}
+
+protected:
+	static bool compare( const NodePair &a, const NodePair &b ) { return a.second < b.second; }
+
+	NodePair*	mStorage;
+	size_t		mK, mSize;
+	T		mMaxDistanceSq;
+};
+
+} // namespace details
+
+};
+
+namespace sp = SpacePartitioning;
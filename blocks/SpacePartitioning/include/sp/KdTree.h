@@ -25,26 +25,54 @@
 #pragma once
 
 #include <vector>
+#include <limits>
+#include <numeric>
+#include <algorithm>
+#include <cmath>
+#include <functional>
 #include "cinder/Exception.h"
 #include "cinder/Utilities.h"
 #include "cinder/Vector.h"
+#include "sp/Batch.h"
+#include "sp/Filter.h"
+#include "sp/KNearest.h"
+#include "sp/Periodic.h"
+#include "sp/Parallel.h"
+#include "sp/Visitor.h"
 
 namespace SpacePartitioning {
 	
-//! Represents a K-D Tree space partitioning structure
+//! Represents a K-D Tree space partitioning structure. Points can be inserted and removed one at a time, inserts rebuild the smallest unbalanced subtree and removed points are skipped by queries until half of the tree is removed
 template<uint8_t DIM, class T, class DataT>
 class KdTree {
 public:
 	using vec_t = typename ci::VECDIM<DIM, T>::TYPE;
+	//! Identifies a point for remove, stays valid until the point is removed
+	using Handle = uint32_t;
 	
-	//! Inserts a new point in the tree with optional user data
-	void insert( const vec_t &position, const DataT &data = DataT() );
-	//! Removes all the nodes from the structure
+	//! Replaces the content of the tree with a balanced tree of count points, data can be null. Large inputs are built in parallel
+	void build( const vec_t *positions, const DataT *data, size_t count );
+	//! Replaces the content of the tree with a balanced tree of ( position, data ) pairs
+	template<class InputIt>
+	void build( InputIt first, InputIt last );
+	//! Inserts a new point in the tree with optional user data and returns its handle, invalidates previously returned Nodes
+	Handle insert( const vec_t &position, const DataT &data = DataT() );
+	//! Removes a point, its handle can be reused by a later insert
+	void remove( Handle handle );
+	//! Removes all the nodes from the structure, keeping the node storage allocated
 	void clear();
-	//! Returns the size of the KdTree
-	size_t size() const;
+	//! Returns the number of points of the KdTree
+	size_t size() const { return mTreeSize - mNumRemoved; }
+	//! Reserves node storage for n points
+	void reserve( size_t n ) { mNodes.reserve( n ); }
+	//! Makes queries wrap around the domain [min, max), distances being measured to the nearest periodic image. Positions built or inserted afterwards are wrapped into the domain. Range and k nearest searches are limited to half the smallest extent of the domain
+	void setPeriodicDomain( const vec_t &min, const vec_t &max ) { mPeriodicDomain.set( min, max ); }
+	//! Goes back to unbounded queries
+	void clearPeriodicDomain() { mPeriodicDomain.reset(); }
+	//! Returns whether queries wrap around a periodic domain
+	bool isPeriodic() const { return mPeriodicDomain.isEnabled(); }
 	
-	//! Represents a single element of the KdTree
+	//! Represents a single element of the KdTree. Nodes live in a contiguous arena and are invalidated by insert and clear
 	class Node {
 	public:
 		//! Returns the position of the node
@@ -52,29 +80,57 @@ public:
 		//! Returns the user data
 		const DataT& getData() const { return mData; }
 		
-		Node( const vec_t &position, int axis, const DataT &data );
-		~Node();
+		Node( const vec_t &position, uint32_t axis, const DataT &data );
 	protected:
-		vec_t	mPosition;
-		int	mAxis;
-		Node*	mLeft;
-		Node*	mRight;
-		DataT	mData;
+		vec_t		mPosition;
+		uint32_t	mAxis;
+		uint32_t	mLeft;
+		uint32_t	mRight;
+		bool		mRemoved;
+		DataT		mData;
 		friend class KdTree;
 	};
 	
 	using NodePair = std::pair<Node*,T>;
 	
+	//! Returns the Node of a handle
+	Node* getNode( Handle handle ) const { return const_cast<Node*>( &mNodes[handle] ); }
+	//! Returns the handle of a Node
+	Handle getHandle( const Node *node ) const { return static_cast<Handle>( node - mNodes.data() ); }
+	
 	//! Returns a pointer to the nearest Node with its square distance to the position
 	Node*			nearestNeighborSearch( const vec_t &position, T *distanceSq = nullptr ) const;
 	//! Returns a vector of Nodes within a radius along with their square distances to the position
 	std::vector<NodePair>	rangeSearch( const vec_t &position, T radius ) const;
 	//! Returns a vector of Nodes within a radius along with their square distances to the position
 	void			rangeSearch( const vec_t &position, T radius, const std::function<void(Node*,T)> &visitor ) const;
+	//! Calls visitor( Node*, T distanceSq ) with the Nodes within a radius, a visitor returning bool stops the search by returning true
+	template<class Visitor>
+	void			rangeSearch( const vec_t &position, T radius, Visitor &&visitor ) const;
+	//! Writes the k nearest Nodes within maxRadius to results, nearest first, and returns how many were found. results must hold k pairs, nothing is allocated
+	size_t			kNearest( const vec_t &position, size_t k, T maxRadius, NodePair *results ) const;
+	
+	//! Returns the nearest Node for which predicate( Node* ) returns true, or nullptr if there is none. Rejected nodes don't narrow the search
+	template<class Predicate>
+	Node*			nearestNeighborSearchIf( const vec_t &position, T *distanceSq, Predicate predicate ) const;
+	//! Returns a vector of the Nodes within a radius for which predicate( Node* ) returns true
+	template<class Predicate>
+	std::vector<NodePair>	rangeSearchIf( const vec_t &position, T radius, Predicate predicate ) const;
+	//! Calls visitor with the Nodes within a radius for which predicate( Node* ) returns true, a visitor returning bool stops the search by returning true
+	template<class Predicate, class Visitor>
+	void			rangeSearchIf( const vec_t &position, T radius, Predicate predicate, Visitor &&visitor ) const;
+	//! Writes the k nearest Nodes within maxRadius for which predicate( Node* ) returns true to results, nearest first, and returns how many were found
+	template<class Predicate>
+	size_t			kNearestIf( const vec_t &position, size_t k, T maxRadius, NodePair *results, Predicate predicate ) const;
+	
+	//! Writes the nearest Node of positions[indices[i]] and its square distance to nodes and distancesSq at the same index, for up to BATCH_PACKET_SIZE queries. The queries share the traversal of the nodes they all reach, see nearestNeighborSearchBatch
+	void			nearestNeighborSearchPacket( const vec_t *positions, const uint32_t *indices, uint32_t count, Node **nodes, T *distancesSq ) const;
 	
 	KdTree();
-	~KdTree();
 protected:
+	//! Index of a missing child
+	enum : uint32_t { NO_NODE = 0xffffffff };
+	
 	struct HyperRect {
 		HyperRect();
 		HyperRect( const vec_t &min, const vec_t &max );
@@ -87,14 +143,31 @@ protected:
 		vec_t mMin, mMax;
 	};
 	
-	void insertImpl( Node **node, const vec_t &position, const DataT &data, int axis );
-	void nearestNeighborSearchImpl( Node *node, HyperRect *rect, const vec_t &position, Node **result, T *resultDistanceSq ) const;
-	void rangeSearchImpl( Node *node, const vec_t &position, T radius, std::vector<NodePair> *results ) const;
-	void rangeSearchImpl( Node *node, const vec_t &position, T radius, const std::function<void(Node*,T)> &visitor ) const;
-	size_t sizeImpl( Node *node ) const;
+	//! Subtrees smaller than this are built on the calling thread
+	enum : uint32_t { PARALLEL_BUILD_SIZE = 1 << 14 };
 	
-	Node*		mRoot;
-	HyperRect	mHyperRect;
+	void buildImpl( const vec_t *positions, const DataT *data, uint32_t begin, uint32_t end, uint32_t index, uint32_t axis, uint32_t parallelDepth );
+	template<class Predicate>
+	void nearestNeighborSearchImpl( uint32_t node, HyperRect *rect, const vec_t &position, Predicate &predicate, uint32_t *result, T *resultDistanceSq ) const;
+	template<class Predicate, class Visitor>
+	bool rangeSearchImpl( uint32_t node, const vec_t &position, T radius, Predicate &predicate, Visitor &visitor ) const;
+	void nearestNeighborSearchPacketImpl( uint32_t node, HyperRect *rect, const vec_t *positions, const uint32_t *indices, uint64_t mask, uint32_t *results, T *resultDistancesSq ) const;
+	template<class Predicate>
+	void kNearestImpl( uint32_t node, HyperRect *rect, const vec_t &position, Predicate &predicate, details::KNearestHeap<NodePair> *heap ) const;
+	uint32_t countNodes( uint32_t node ) const;
+	void rebuildSubtree( uint32_t node, uint32_t parent );
+	void collectSubtree( uint32_t node );
+	uint32_t linkSubtree( uint32_t begin, uint32_t end, uint32_t axis );
+	
+	std::vector<Node>	mNodes;
+	uint32_t		mRoot;
+	uint32_t		mTreeSize;	// nodes linked in the tree, removed ones included
+	uint32_t		mNumRemoved;	// removed nodes still linked in the tree
+	std::vector<Handle>	mFreeNodes;	// slots of removed nodes dropped by a rebuild
+	HyperRect		mHyperRect;
+	std::vector<uint32_t>	mBuildOrder;	// scratch permutation used by build and rebuilds
+	std::vector<uint32_t>	mPath;		// scratch path walked by insert
+	details::PeriodicDomain<DIM,T>	mPeriodicDomain;
 };
 	
 	
@@ -102,6 +175,7 @@ protected:
 // MARK: KDTree Impl.
 	
 // https://en.wikipedia.org/wiki/K-d_tree
+// https://en.wikipedia.org/wiki/Scapegoat_tree
 // https://github.com/jtsiomb/kdtree
 // https://github.com/mikolalysenko/static-kdtree
 // http://www.flipcode.com/archives/Raytracing_Topics_Techniques-Part_7_Kd-Trees_and_More_Speed.shtml
@@ -109,7 +183,7 @@ protected:
 // KdTree::HyperRect
 template<uint8_t DIM, class T, class DataT>
 KdTree<DIM,T,DataT>::HyperRect::HyperRect()
-: mMin( std::numeric_limits<T>::max() ), mMax( std::numeric_limits<T>::min() )
+: mMin( std::numeric_limits<T>::max() ), mMax( std::numeric_limits<T>::lowest() )
 {
 }
 template<uint8_t DIM, class T, class DataT>
@@ -140,110 +214,262 @@ T KdTree<DIM,T,DataT>::HyperRect::distance2( const vec_t &position ) const
 
 // KdTree::Node
 template<uint8_t DIM, class T, class DataT>
-KdTree<DIM,T,DataT>::Node::Node( const vec_t &position, int axis, const DataT &data )
-: mPosition( position ), mAxis( axis ), mData( data ), mLeft( nullptr ), mRight( nullptr )
+KdTree<DIM,T,DataT>::Node::Node( const vec_t &position, uint32_t axis, const DataT &data )
+: mPosition( position ), mAxis( axis ), mLeft( NO_NODE ), mRight( NO_NODE ), mRemoved( false ), mData( data )
 {
 }
+
+// KdTree
 template<uint8_t DIM, class T, class DataT>
-KdTree<DIM,T,DataT>::Node::~Node()
+KdTree<DIM,T,DataT>::KdTree()
+: mRoot( NO_NODE ), mTreeSize( 0 ), mNumRemoved( 0 )
 {
-	if( mLeft ) {
-		delete mLeft;
-		mLeft = nullptr;
-	}
-	if( mRight ) {
-		delete mRight;
-		mRight = nullptr;
-	}
 }
 
-// KdTree
 template<uint8_t DIM, class T, class DataT>
-KdTree<DIM,T,DataT>::KdTree()
-: mRoot( nullptr )
+void KdTree<DIM,T,DataT>::build( const vec_t *positions, const DataT *data, size_t count )
 {
+	clear();
+	if( ! count )
+		return;
+	
+	// positions are wrapped once, before the median splits
+	std::vector<vec_t> wrapped;
+	if( mPeriodicDomain.isEnabled() ) {
+		wrapped.resize( count );
+		for( size_t i = 0; i < count; ++i )
+			wrapped[i] = mPeriodicDomain.wrap( positions[i] );
+		positions = wrapped.data();
+	}
+	
+	mBuildOrder.resize( count );
+	std::iota( mBuildOrder.begin(), mBuildOrder.end(), 0 );
+	for( size_t i = 0; i < count; ++i )
+		mHyperRect.extend( positions[i] );
+	
+	// nodes are laid out in depth-first order, so every subtree owns a known range of the arena and can be built independently
+	mNodes.assign( count, Node( vec_t(), 0, DataT() ) );
+	mRoot		= 0;
+	mTreeSize	= static_cast<uint32_t>( count );
+	buildImpl( positions, data, 0, static_cast<uint32_t>( count ), 0, 0, details::parallelDepth() );
 }
 template<uint8_t DIM, class T, class DataT>
-KdTree<DIM,T,DataT>::~KdTree()
+template<class InputIt>
+void KdTree<DIM,T,DataT>::build( InputIt first, InputIt last )
 {
-	if( mRoot ) {
-		delete mRoot;
-		mRoot = nullptr;
+	std::vector<vec_t> positions;
+	std::vector<DataT> data;
+	for( ; first != last; ++first ) {
+		positions.push_back( first->first );
+		data.push_back( first->second );
 	}
+	build( positions.data(), data.data(), positions.size() );
+}
+template<uint8_t DIM, class T, class DataT>
+void KdTree<DIM,T,DataT>::buildImpl( const vec_t *positions, const DataT *data, uint32_t begin, uint32_t end, uint32_t index, uint32_t axis, uint32_t parallelDepth )
+{
+	// split on the median along this node's axis
+	uint32_t* order = mBuildOrder.data();
+	const uint32_t mid = begin + ( end - begin ) / 2;
+	std::nth_element( order + begin, order + mid, order + end, [positions, axis]( uint32_t a, uint32_t b ) {
+		return positions[a][axis] < positions[b][axis];
+	} );
+	
+	const uint32_t leftSize		= mid - begin;
+	const uint32_t rightSize	= end - mid - 1;
+	const uint32_t childAxis	= ( axis + 1 ) % DIM;
+	const uint32_t childDepth	= parallelDepth ? parallelDepth - 1 : 0;
+	Node &node	= mNodes[index];
+	node		= Node( positions[order[mid]], axis, data ? data[order[mid]] : DataT() );
+	node.mLeft	= leftSize ? index + 1 : NO_NODE;
+	node.mRight	= rightSize ? index + 1 + leftSize : NO_NODE;
+	
+	details::parallelInvoke( parallelDepth > 0 && end - begin >= PARALLEL_BUILD_SIZE,
+		[=] { if( leftSize ) buildImpl( positions, data, begin, mid, index + 1, childAxis, childDepth ); },
+		[=] { if( rightSize ) buildImpl( positions, data, mid + 1, end, index + 1 + leftSize, childAxis, childDepth ); } );
 }
 
 template<uint8_t DIM, class T, class DataT>
-void KdTree<DIM,T,DataT>::insertImpl( Node **nptr, const vec_t &position, const DataT &data, int axis )
+typename KdTree<DIM,T,DataT>::Handle KdTree<DIM,T,DataT>::insert( const vec_t &insertPosition, const DataT &data )
 {
-	using Node_t = typename KdTree<DIM,T,DataT>::Node;
+	const vec_t position = mPeriodicDomain.wrap( insertPosition );
+	mHyperRect.extend( position );
 	
-	Node_t* node = *nptr;
-	if( ! *nptr ) {
-		node = new Node_t( position, axis, data );
-		*nptr = node;
-		return;
+	// slots dropped by a rebuild are reused first
+	Handle handle;
+	if( mFreeNodes.empty() ) {
+		handle = static_cast<Handle>( mNodes.size() );
+		mNodes.emplace_back( position, 0, data );
 	}
-	int newDir = ( node->mAxis + 1 ) % DIM;
-	if( position[node->mAxis] < node->mPosition[node->mAxis] ) {
-		insertImpl( &(*nptr)->mLeft, position, data, newDir );
+	else {
+		handle = mFreeNodes.back();
+		mFreeNodes.pop_back();
+		mNodes[handle] = Node( position, 0, data );
+	}
+	mTreeSize++;
+	if( mRoot == NO_NODE ) {
+		mRoot = handle;
+		return handle;
+	}
+	
+	// walk down to the empty child slot the position falls into
+	mPath.clear();
+	uint32_t i = mRoot;
+	while( true ) {
+		mPath.push_back( i );
+		Node &node = mNodes[i];
+		uint32_t &child = position[node.mAxis] < node.mPosition[node.mAxis] ? node.mLeft : node.mRight;
+		if( child == NO_NODE ) {
+			child = handle;
+			mNodes[handle].mAxis = ( node.mAxis + 1 ) % DIM;
+			break;
+		}
+		i = child;
+	}
+	
+	// a node deeper than log( n ) / log( 1 / alpha ) has an ancestor with a child holding more than alpha of its nodes, the nearest one is rebuilt balanced
+	const float alpha		= 0.7f;
+	const float maxDepth	= std::log( static_cast<float>( mTreeSize ) ) / std::log( 1.0f / alpha );
+	if( static_cast<float>( mPath.size() ) > maxDepth ) {
+		uint32_t child		= handle;
+		uint32_t childSize	= 1;
+		for( size_t depth = mPath.size(); depth-- > 0; ) {
+			const uint32_t parent	= mPath[depth];
+			const Node &node		= mNodes[parent];
+			const uint32_t size		= childSize + 1 + countNodes( node.mLeft == child ? node.mRight : node.mLeft );
+			if( childSize > alpha * size ) {
+				rebuildSubtree( parent, depth ? mPath[depth - 1] : NO_NODE );
+				break;
+			}
+			child		= parent;
+			childSize	= size;
+		}
+	}
+	return handle;
+}
+template<uint8_t DIM, class T, class DataT>
+void KdTree<DIM,T,DataT>::remove( Handle handle )
+{
+	Node &node = mNodes[handle];
+	if( node.mRemoved )
 		return;
+	node.mRemoved = true;
+	mNumRemoved++;
+	
+	// once half of the tree is removed nodes it is rebuilt without them, and the bounds shrink to what is left
+	if( mNumRemoved * 2 > mTreeSize ) {
+		rebuildSubtree( mRoot, NO_NODE );
+		mHyperRect = HyperRect();
+		for( uint32_t i : mBuildOrder )
+			mHyperRect.extend( mNodes[i].mPosition );
 	}
-	insertImpl( &(*nptr)->mRight, position, data, newDir );
 }
-
+//! Returns the number of nodes of a subtree, removed ones included
 template<uint8_t DIM, class T, class DataT>
-void KdTree<DIM,T,DataT>::insert( const vec_t &position, const DataT &data )
+uint32_t KdTree<DIM,T,DataT>::countNodes( uint32_t index ) const
 {
-	insertImpl( &mRoot, position, data, 0 );
-	mHyperRect.extend( position );
+	if( index == NO_NODE )
+		return 0;
+	return 1 + countNodes( mNodes[index].mLeft ) + countNodes( mNodes[index].mRight );
 }
+//! Rebuilds a subtree balanced over its remaining nodes, which keep their slots and handles, and links it back to its parent
 template<uint8_t DIM, class T, class DataT>
-void KdTree<DIM,T,DataT>::clear()
+void KdTree<DIM,T,DataT>::rebuildSubtree( uint32_t index, uint32_t parent )
 {
-	if( mRoot ) {
-		delete mRoot;
-		mRoot = nullptr;
-	}
+	const uint32_t axis = mNodes[index].mAxis;
+	mBuildOrder.clear();
+	collectSubtree( index );
+	const uint32_t root = mBuildOrder.empty() ? NO_NODE : linkSubtree( 0, static_cast<uint32_t>( mBuildOrder.size() ), axis );
+	if( parent == NO_NODE )
+		mRoot = root;
+	else if( mNodes[parent].mLeft == index )
+		mNodes[parent].mLeft = root;
+	else
+		mNodes[parent].mRight = root;
 }
-
+//! Gathers the remaining nodes of a subtree in mBuildOrder and frees the slots of the removed ones
 template<uint8_t DIM, class T, class DataT>
-size_t KdTree<DIM,T,DataT>::sizeImpl( Node *node ) const
+void KdTree<DIM,T,DataT>::collectSubtree( uint32_t index )
 {
-	size_t size = 0;
-	if( node ) {
-		size++;
-		if( node->mLeft )
-			size += sizeImpl( node->mLeft );
-		if( node->mRight )
-			size += sizeImpl( node->mRight );
+	if( index == NO_NODE )
+		return;
+	const Node &node = mNodes[index];
+	collectSubtree( node.mLeft );
+	collectSubtree( node.mRight );
+	if( node.mRemoved ) {
+		mFreeNodes.push_back( index );
+		mNumRemoved--;
+		mTreeSize--;
 	}
-	return size;
+	else
+		mBuildOrder.push_back( index );
+}
+//! Links the nodes of mBuildOrder[begin, end) into a subtree split on the median of each axis in turn, and returns its root
+template<uint8_t DIM, class T, class DataT>
+uint32_t KdTree<DIM,T,DataT>::linkSubtree( uint32_t begin, uint32_t end, uint32_t axis )
+{
+	uint32_t* order = mBuildOrder.data();
+	const uint32_t mid = begin + ( end - begin ) / 2;
+	std::nth_element( order + begin, order + mid, order + end, [this, axis]( uint32_t a, uint32_t b ) {
+		return mNodes[a].mPosition[axis] < mNodes[b].mPosition[axis];
+	} );
+	
+	const uint32_t childAxis = ( axis + 1 ) % DIM;
+	const uint32_t index = order[mid];
+	mNodes[index].mAxis		= axis;
+	mNodes[index].mLeft		= mid > begin ? linkSubtree( begin, mid, childAxis ) : NO_NODE;
+	mNodes[index].mRight	= mid + 1 < end ? linkSubtree( mid + 1, end, childAxis ) : NO_NODE;
+	return index;
 }
-
 template<uint8_t DIM, class T, class DataT>
-size_t KdTree<DIM,T,DataT>::size() const
+void KdTree<DIM,T,DataT>::clear()
 {
-	return sizeImpl( mRoot );
+	mNodes.clear();
+	mFreeNodes.clear();
+	mRoot		= NO_NODE;
+	mTreeSize	= 0;
+	mNumRemoved	= 0;
+	mHyperRect = HyperRect();
 }
 	
 template<uint8_t DIM, class T, class DataT>
 typename KdTree<DIM,T,DataT>::Node* KdTree<DIM,T,DataT>::nearestNeighborSearch( const vec_t &position, T *distanceSq ) const
 {
-	Node* result	= mRoot;
-	T dSq			= glm::distance2( position, result->mPosition );
-	HyperRect rect	= mHyperRect;
-	nearestNeighborSearchImpl( mRoot, &rect, position, &result, &dSq );
+	return nearestNeighborSearchIf( position, distanceSq, details::AcceptAll() );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+typename KdTree<DIM,T,DataT>::Node* KdTree<DIM,T,DataT>::nearestNeighborSearchIf( const vec_t &position, T *distanceSq, Predicate predicate ) const
+{
+	if( mRoot == NO_NODE )
+		return nullptr;
+	
+	uint32_t result	= NO_NODE;
+	T dSq			= std::numeric_limits<T>::max();
+	HyperRect rect;
+	vec_t images[details::PeriodicDomain<DIM,T>::MAX_IMAGES];
+	const uint32_t numImages = mPeriodicDomain.getImages( position, std::numeric_limits<T>::max(), images );
+	for( uint32_t i = 0; i < numImages; ++i ) {
+		if( mHyperRect.distance2( images[i] ) <= dSq ) {
+			rect = mHyperRect;
+			nearestNeighborSearchImpl( mRoot, &rect, images[i], predicate, &result, &dSq );
+		}
+	}
+	if( result == NO_NODE )
+		return nullptr;
 	if( distanceSq )
 		*distanceSq = dSq;
 	
-	return result;
+	return getNode( result );
 }
 
 template<uint8_t DIM, class T, class DataT>
-void KdTree<DIM,T,DataT>::nearestNeighborSearchImpl( Node *node, HyperRect *rect, const vec_t &position, Node **result, T *resultDistanceSq ) const
+template<class Predicate>
+void KdTree<DIM,T,DataT>::nearestNeighborSearchImpl( uint32_t index, HyperRect *rect, const vec_t &position, Predicate &predicate, uint32_t *result, T *resultDistanceSq ) const
 {
-	Node* nearestNode;
-	Node* furthestNode;
+	const Node* node = &mNodes[index];
+	uint32_t nearestNode;
+	uint32_t furthestNode;
 	T* nearestSplit;
 	T* furthestSplit;
 	
@@ -262,27 +488,27 @@ void KdTree<DIM,T,DataT>::nearestNeighborSearchImpl( Node *node, HyperRect *rect
 	}
 	
 	// recursively search into the nearest sub-tree
-	if( nearestNode ) {
+	if( nearestNode != NO_NODE ) {
 		T temp = *nearestSplit;
 		*nearestSplit = node->mPosition[node->mAxis];
-		nearestNeighborSearchImpl( nearestNode, rect, position, result, resultDistanceSq );
+		nearestNeighborSearchImpl( nearestNode, rect, position, predicate, result, resultDistanceSq );
 		*nearestSplit = temp;
 	}
 	
-	// update distances
+	// update distances, rejected and removed nodes never tighten the search
 	T distanceSq = glm::distance2( node->mPosition, position );
-	if( distanceSq < *resultDistanceSq ) {
-		*result = node;
+	if( distanceSq < *resultDistanceSq && ! node->mRemoved && predicate( getNode( index ) ) ) {
+		*result = index;
 		*resultDistanceSq = distanceSq;
 	}
 	
 	// recursively search into the furthest sub-tree
-	if( furthestNode ) {
+	if( furthestNode != NO_NODE ) {
 		T temp = *furthestSplit;
 		*furthestSplit = node->mPosition[node->mAxis];
 		// check if we still need to go down the furthest sub-tree
 		if( rect->distance2( position ) < *resultDistanceSq ) {
-			nearestNeighborSearchImpl( furthestNode, rect, position, result, resultDistanceSq );
+			nearestNeighborSearchImpl( furthestNode, rect, position, predicate, result, resultDistanceSq );
 		}
 		*furthestSplit = temp;
 	}
@@ -290,58 +516,229 @@ void KdTree<DIM,T,DataT>::nearestNeighborSearchImpl( Node *node, HyperRect *rect
 
 template<uint8_t DIM, class T, class DataT>
 std::vector<typename KdTree<DIM,T,DataT>::NodePair> KdTree<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius ) const
+{
+	return rangeSearchIf( position, radius, details::AcceptAll() );
+}
+template<uint8_t DIM, class T, class DataT>
+void KdTree<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius, const std::function<void(Node*,T)> &visitor ) const
+{
+	rangeSearchIf( position, radius, details::AcceptAll(), visitor );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Visitor>
+void KdTree<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius, Visitor &&visitor ) const
+{
+	rangeSearchIf( position, radius, details::AcceptAll(), std::forward<Visitor>( visitor ) );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+std::vector<typename KdTree<DIM,T,DataT>::NodePair> KdTree<DIM,T,DataT>::rangeSearchIf( const vec_t &position, T radius, Predicate predicate ) const
 {
 	std::vector<NodePair> results;
-	rangeSearchImpl( mRoot, position, radius, &results );
+	auto collect = [&results]( Node* node, T distanceSq ) {
+		results.emplace_back( node, distanceSq );
+	};
+	rangeSearchIf( position, radius, predicate, collect );
 	return results;
 }
 template<uint8_t DIM, class T, class DataT>
-void KdTree<DIM,T,DataT>::rangeSearchImpl( Node *node, const vec_t &position, T radius, std::vector<typename KdTree<DIM,T,DataT>::NodePair> *results ) const
+template<class Predicate, class Visitor>
+void KdTree<DIM,T,DataT>::rangeSearchIf( const vec_t &position, T radius, Predicate predicate, Visitor &&visitor ) const
 {
-	if( ! node )
+	if( mRoot == NO_NODE )
 		return;
 	
-	// if node is within the range add it to the results
+	// each image of the position is searched on its own, the radius keeps them from reaching a node twice
+	const T clampedRadius	= mPeriodicDomain.clampRadius( radius );
+	vec_t images[details::PeriodicDomain<DIM,T>::MAX_IMAGES];
+	const uint32_t numImages = mPeriodicDomain.getImages( position, clampedRadius, images );
+	for( uint32_t i = 0; i < numImages; ++i ) {
+		if( rangeSearchImpl( mRoot, images[i], clampedRadius, predicate, visitor ) )
+			return;
+	}
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate, class Visitor>
+bool KdTree<DIM,T,DataT>::rangeSearchImpl( uint32_t index, const vec_t &position, T radius, Predicate &predicate, Visitor &visitor ) const
+{
+	if( index == NO_NODE )
+		return false;
+	
+	Node* node = getNode( index );
+	// if node is within the range and accepted add it to the results
 	T distanceSq = glm::distance2( node->mPosition, position );
-	if( distanceSq <= radius * radius ) {
-		results->emplace_back( std::make_pair( node, distanceSq ) );
+	if( distanceSq <= radius * radius && ! node->mRemoved && predicate( node ) && details::visit( visitor, node, distanceSq ) ) {
+		return true;
 	}
 	
 	// recursively check the first child
 	T dx = position[node->mAxis] - node->mPosition[node->mAxis];
-	rangeSearchImpl( dx <= 0.0 ? node->mLeft : node->mRight, position, radius, results );
+	if( rangeSearchImpl( dx <= 0.0 ? node->mLeft : node->mRight, position, radius, predicate, visitor ) )
+		return true;
 	// check if we still need to go down the other child
-	if( glm::abs( dx ) < radius ) {
-		rangeSearchImpl(dx <= 0.0 ? node->mRight : node->mLeft, position, radius, results );
-	}
+	return glm::abs( dx ) < radius && rangeSearchImpl( dx <= 0.0 ? node->mRight : node->mLeft, position, radius, predicate, visitor );
 }
 
 template<uint8_t DIM, class T, class DataT>
-void KdTree<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius, const std::function<void(Node*,T)> &visitor ) const
+size_t KdTree<DIM,T,DataT>::kNearest( const vec_t &position, size_t k, T maxRadius, NodePair *results ) const
 {
-	rangeSearchImpl( mRoot, position, radius, visitor );
+	return kNearestIf( position, k, maxRadius, results, details::AcceptAll() );
 }
 template<uint8_t DIM, class T, class DataT>
-void KdTree<DIM,T,DataT>::rangeSearchImpl( Node *node, const vec_t &position, T radius, const std::function<void(Node*,T)> &visitor ) const
+template<class Predicate>
+size_t KdTree<DIM,T,DataT>::kNearestIf( const vec_t &position, size_t k, T maxRadius, NodePair *results, Predicate predicate ) const
 {
-	if( ! node )
-		return;
+	if( mRoot == NO_NODE || ! k )
+		return 0;
+	
+	const T radius = mPeriodicDomain.clampRadius( maxRadius );
+	details::KNearestHeap<NodePair> heap( results, k, radius );
+	HyperRect rect;
+	vec_t images[details::PeriodicDomain<DIM,T>::MAX_IMAGES];
+	const uint32_t numImages = mPeriodicDomain.getImages( position, radius, images );
+	for( uint32_t i = 0; i < numImages; ++i ) {
+		if( mHyperRect.distance2( images[i] ) <= heap.bound() ) {
+			rect = mHyperRect;
+			kNearestImpl( mRoot, &rect, images[i], predicate, &heap );
+		}
+	}
+	return heap.finish();
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+void KdTree<DIM,T,DataT>::kNearestImpl( uint32_t index, HyperRect *rect, const vec_t &position, Predicate &predicate, details::KNearestHeap<NodePair> *heap ) const
+{
+	// same traversal as the nearest neighbor search, pruning against the farthest of the k kept so far
+	const Node* node = &mNodes[index];
+	const bool leftIsNearest = position[node->mAxis] - node->mPosition[node->mAxis] <= 0;
+	const uint32_t nearestNode	= leftIsNearest ? node->mLeft : node->mRight;
+	const uint32_t furthestNode	= leftIsNearest ? node->mRight : node->mLeft;
+	T* nearestSplit		= leftIsNearest ? &rect->mMax[node->mAxis] : &rect->mMin[node->mAxis];
+	T* furthestSplit	= leftIsNearest ? &rect->mMin[node->mAxis] : &rect->mMax[node->mAxis];
+	
+	if( nearestNode != NO_NODE ) {
+		T temp = *nearestSplit;
+		*nearestSplit = node->mPosition[node->mAxis];
+		if( rect->distance2( position ) <= heap->bound() )
+			kNearestImpl( nearestNode, rect, position, predicate, heap );
+		*nearestSplit = temp;
+	}
 	
-	// if node is within the range add it to the results
 	T distanceSq = glm::distance2( node->mPosition, position );
-	if( distanceSq <= radius * radius ) {
-		visitor( node, distanceSq );
+	if( distanceSq <= heap->bound() && ! node->mRemoved && predicate( getNode( index ) ) )
+		heap->push( getNode( index ), distanceSq );
+	
+	if( furthestNode != NO_NODE ) {
+		T temp = *furthestSplit;
+		*furthestSplit = node->mPosition[node->mAxis];
+		if( rect->distance2( position ) <= heap->bound() )
+			kNearestImpl( furthestNode, rect, position, predicate, heap );
+		*furthestSplit = temp;
 	}
+}
 	
-	// recursively check the first child
-	T dx = position[node->mAxis] - node->mPosition[node->mAxis];
-	rangeSearchImpl( dx <= 0.0 ? node->mLeft : node->mRight, position, radius, visitor );
-	// check if we still need to go down the other child
-	if( glm::abs( dx ) < radius ) {
-		rangeSearchImpl(dx <= 0.0 ? node->mRight : node->mLeft, position, radius, visitor );
+template<uint8_t DIM, class T, class DataT>
+void KdTree<DIM,T,DataT>::nearestNeighborSearchPacket( const vec_t *positions, const uint32_t *indices, uint32_t count, Node **nodes, T *distancesSq ) const
+{
+	uint32_t results[BATCH_PACKET_SIZE];
+	T resultDistancesSq[BATCH_PACKET_SIZE];
+	count = std::min<uint32_t>( count, BATCH_PACKET_SIZE );
+	
+	// the packet traversal follows a single image of each query
+	if( mPeriodicDomain.isEnabled() ) {
+		for( uint32_t i = 0; i < count; ++i ) {
+			distancesSq[indices[i]]	= std::numeric_limits<T>::max();
+			nodes[indices[i]]		= nearestNeighborSearch( positions[indices[i]], &distancesSq[indices[i]] );
+		}
+		return;
+	}
+	for( uint32_t i = 0; i < count; ++i ) {
+		results[i]				= NO_NODE;
+		resultDistancesSq[i]	= std::numeric_limits<T>::max();
+	}
+	
+	if( mRoot != NO_NODE && count ) {
+		HyperRect rect		= mHyperRect;
+		const uint64_t mask	= count < 64 ? ( uint64_t( 1 ) << count ) - 1 : ~uint64_t( 0 );
+		nearestNeighborSearchPacketImpl( mRoot, &rect, positions, indices, mask, results, resultDistancesSq );
+	}
+	
+	for( uint32_t i = 0; i < count; ++i ) {
+		nodes[indices[i]]		= results[i] != NO_NODE ? getNode( results[i] ) : nullptr;
+		distancesSq[indices[i]]	= resultDistancesSq[i];
 	}
 }
+
+//! Same as nearestNeighborSearchImpl for the queries set in mask, each node being loaded once for all of them
+template<uint8_t DIM, class T, class DataT>
+void KdTree<DIM,T,DataT>::nearestNeighborSearchPacketImpl( uint32_t index, HyperRect *rect, const vec_t *positions, const uint32_t *indices, uint64_t mask, uint32_t *results, T *resultDistancesSq ) const
+{
+	// once the queries went separate ways they are cheaper to follow one at a time
+	if( details::countBits( mask ) < BATCH_PACKET_MIN_SIZE ) {
+		details::AcceptAll acceptAll;
+		for( uint64_t bits = mask; bits; bits &= bits - 1 ) {
+			const uint32_t i = details::countTrailingZeros( bits );
+			nearestNeighborSearchImpl( index, rect, positions[indices[i]], acceptAll, &results[i], &resultDistancesSq[i] );
+		}
+		return;
+	}
+	
+	const Node* node	= &mNodes[index];
+	const uint32_t axis	= node->mAxis;
+	const T split		= node->mPosition[axis];
+	const bool removed	= node->mRemoved;
 	
+	// update distances and find on which side each query starts
+	uint64_t leftMask	= 0;
+	uint32_t numLeft	= 0;
+	uint32_t numRight	= 0;
+	for( uint64_t bits = mask; bits; bits &= bits - 1 ) {
+		const uint32_t i		= details::countTrailingZeros( bits );
+		const vec_t &position	= positions[indices[i]];
+		const T distanceSq		= glm::distance2( node->mPosition, position );
+		if( distanceSq < resultDistancesSq[i] && ! removed ) {
+			results[i] = index;
+			resultDistancesSq[i] = distanceSq;
+		}
+		if( position[axis] - split <= 0 ) {
+			leftMask |= uint64_t( 1 ) << i;
+			numLeft++;
+		}
+		else {
+			numRight++;
+		}
+	}
+	
+	// every query goes down its own side first like nearestNeighborSearchImpl, then the other side if it is closer than its nearest node:
+	// the side most queries start in, the other side for the remaining queries and the first side for the majority, then the first side for the remaining queries
+	const bool leftFirst		= numLeft >= numRight;
+	const uint64_t firstMask	= leftFirst ? leftMask : mask & ~leftMask;
+	const uint64_t secondMask	= mask & ~firstMask;
+	const struct { bool mLeft; uint64_t mNearMask; uint64_t mFarMask; } steps[3] = {
+		{ leftFirst, firstMask, 0 },
+		{ ! leftFirst, secondMask, firstMask },
+		{ leftFirst, 0, secondMask }
+	};
+	for( const auto &step : steps ) {
+		const uint32_t child = step.mLeft ? node->mLeft : node->mRight;
+		if( child == NO_NODE || ! ( step.mNearMask | step.mFarMask ) )
+			continue;
+		
+		T* bound		= step.mLeft ? &rect->mMax[axis] : &rect->mMin[axis];
+		const T temp	= *bound;
+		*bound			= split;
+		uint64_t childMask = step.mNearMask;
+		for( uint64_t bits = step.mFarMask; bits; bits &= bits - 1 ) {
+			const uint32_t i = details::countTrailingZeros( bits );
+			if( rect->distance2( positions[indices[i]] ) < resultDistancesSq[i] )
+				childMask |= uint64_t( 1 ) << i;
+		}
+		if( childMask )
+			nearestNeighborSearchPacketImpl( child, rect, positions, indices, childMask, results, resultDistancesSq );
+		*bound = temp;
+	}
+}
+
 //! Represents a 2D float K-D Tree space partitioning structure
 template<class DataT=uint32_t> using KdTree2 = KdTree<2,float,DataT>;
 //! Represents a 3D float K-D Tree space partitioning structure
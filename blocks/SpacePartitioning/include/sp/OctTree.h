@@ -24,12 +24,519 @@
 
 #pragma once
 
+#include <vector>
+#include <limits>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include "cinder/Vector.h"
+#include "sp/Filter.h"
+#include "sp/KNearest.h"
+#include "sp/Visitor.h"
+
 namespace SpacePartitioning {
-	
-// TODO: Implement OctTrees
-//! Represents an OctTree
+
+//! Represents a loose QuadTree / OctTree for points that move. Each cell accepts points up to half its size past its bounds, so a point only changes cell when it leaves that looser box: moving a point by a small step is a constant time update instead of a rebuild. Cells split past maxPerCell points and merge back once their subtree holds half as many
+template<uint8_t DIM, class T, class DataT>
 class OctTree {
 public:
+	using vec_t = typename ci::VECDIM<DIM, T>::TYPE;
+	//! Identifies a point for remove and move, stays valid until the point is removed
+	using Handle = uint32_t;
+
+	//! Constructs a tree covering the bounds, points outside of them are kept in the root. Cells split past maxPerCell points, at most maxDepth levels down
+	OctTree( const vec_t &min, const vec_t &max, uint32_t maxPerCell = 8, uint32_t maxDepth = 8 );
+
+	//! Inserts a new point with optional user data and returns its handle, invalidates previously returned Nodes
+	Handle insert( const vec_t &position, const DataT &data = DataT() );
+	//! Removes a point, its handle can be reused by the next insert
+	void remove( Handle handle );
+	//! Moves a point, it is only relinked when it leaves the loose bounds of its cell
+	void move( Handle handle, const vec_t &position );
+	//! Replaces the user data of a point
+	void setData( Handle handle, const DataT &data ) { mNodes[handle].mData = data; }
+	//! Removes all the points and cells, keeping the allocated storage
+	void clear();
+	//! Returns the number of points
+	size_t size() const { return mCells[0].mSubtreeCount; }
+
+	//! Represents a single element of the OctTree
+	class Node {
+	public:
+		//! Returns the position of the node
+		vec_t getPosition() const { return mPosition; }
+		//! Returns the user data
+		const DataT& getData() const { return mData; }
+
+		Node( const vec_t &position, const DataT &data );
+	protected:
+		vec_t		mPosition;
+		DataT		mData;
+		uint32_t	mCell;		// cell the node is linked in
+		uint32_t	mPrev, mNext;	// siblings in the cell's list
+		friend class OctTree;
+	};
+
+	using NodePair = std::pair<Node*,T>;
+
+	//! Returns the Node of a handle
+	Node* getNode( Handle handle ) const { return const_cast<Node*>( &mNodes[handle] ); }
+
+	//! Returns a pointer to the nearest Node with its square distance to the position, or nullptr if empty
+	Node*			nearestNeighborSearch( const vec_t &position, T *distanceSq = nullptr ) const;
+	//! Returns a vector of Nodes within a radius along with their square distances to the position
+	std::vector<NodePair>	rangeSearch( const vec_t &position, T radius ) const;
+	//! Returns a vector of Nodes within a radius along with their square distances to the position
+	void			rangeSearch( const vec_t &position, T radius, const std::function<void(Node*,T)> &visitor ) const;
+	//! Calls visitor( Node*, T distanceSq ) with the Nodes within a radius, a visitor returning bool stops the search by returning true
+	template<class Visitor>
+	void			rangeSearch( const vec_t &position, T radius, Visitor &&visitor ) const;
+	//! Writes the k nearest Nodes within maxRadius to results, nearest first, and returns how many were found. results must hold k pairs, nothing is allocated
+	size_t			kNearest( const vec_t &position, size_t k, T maxRadius, NodePair *results ) const;
+
+	//! Returns the nearest Node for which predicate( Node* ) returns true, or nullptr if there is none. Rejected nodes don't narrow the search
+	template<class Predicate>
+	Node*			nearestNeighborSearchIf( const vec_t &position, T *distanceSq, Predicate predicate ) const;
+	//! Returns a vector of the Nodes within a radius for which predicate( Node* ) returns true
+	template<class Predicate>
+	std::vector<NodePair>	rangeSearchIf( const vec_t &position, T radius, Predicate predicate ) const;
+	//! Calls visitor with the Nodes within a radius for which predicate( Node* ) returns true, a visitor returning bool stops the search by returning true
+	template<class Predicate, class Visitor>
+	void			rangeSearchIf( const vec_t &position, T radius, Predicate predicate, Visitor &&visitor ) const;
+	//! Writes the k nearest Nodes within maxRadius for which predicate( Node* ) returns true to results, nearest first, and returns how many were found
+	template<class Predicate>
+	size_t			kNearestIf( const vec_t &position, size_t k, T maxRadius, NodePair *results, Predicate predicate ) const;
+
+	//! Returns the number of cells in use, the root included
+	size_t getNumCells() const { return mCells.size() - mFreeBlocks.size() * NUM_CHILDREN; }
+	//! Returns the minimum of the OctTree
+	vec_t getMin() const { return mMin; }
+	//! Returns the maximum of the OctTree
+	vec_t getMax() const { return mMax; }
+
+protected:
+	//! Index of a missing node or cell
+	enum : uint32_t { NO_NODE = 0xffffffff };
+	//! Children of a cell, allocated as one block
+	enum : uint32_t { NUM_CHILDREN = 1 << DIM };
+
+	struct Cell {
+		Cell( const vec_t &center = vec_t(), T halfSize = 0, uint32_t parent = NO_NODE, uint32_t depth = 0 );
+
+		vec_t		mCenter;
+		T		mHalfSize;	// of the tight bounds, the loose ones are twice as large
+		uint32_t	mParent;
+		uint32_t	mChildren;	// first of NUM_CHILDREN consecutive cells
+		uint32_t	mFirst;		// first node linked in this cell
+		uint32_t	mCount;		// nodes linked in this cell
+		uint32_t	mSubtreeCount;	// nodes linked in this cell and below
+		uint32_t	mDepth;
+	};
+
+	uint32_t childIndex( const Cell &cell, const vec_t &position ) const;
+	bool inLooseBounds( uint32_t cell, const vec_t &position ) const;
+	T looseDistance2( uint32_t cell, const vec_t &position ) const;
+	uint32_t findCell( uint32_t cell, const vec_t &position ) const;
+
+	void attach( Handle handle, uint32_t cell );
+	void detach( Handle handle );
+	void link( Handle handle, uint32_t cell );
+	uint32_t unlink( Handle handle );
+	void split( uint32_t cell );
+	void collapse( uint32_t cell );
+	void gather( uint32_t target, uint32_t cell );
+
+	template<class Predicate, class Visitor>
+	bool rangeSearchImpl( uint32_t cell, const vec_t &position, T radius, Predicate &predicate, Visitor &visitor ) const;
+	template<class Predicate>
+	void kNearestImpl( uint32_t cell, const vec_t &position, Predicate &predicate, details::KNearestHeap<NodePair> *heap ) const;
+
+	std::vector<Node>	mNodes;		// indexed by handle, removed ones are unlinked
+	std::vector<Handle>	mFreeNodes;
+	std::vector<Cell>	mCells;		// the root is the first cell
+	std::vector<uint32_t>	mFreeBlocks;	// first cell of each released block of children
+	vec_t			mMin, mMax;
+	uint32_t		mMaxPerCell, mMaxDepth;
 };
-	
-};
\ No newline at end of file
+
+// MARK: OctTree Impl.
+
+// http://tulrich.com/geekstuff/partitioning.html
+// https://anteru.net/blog/2008/loose-octrees/
+
+template<uint8_t DIM, class T, class DataT>
+OctTree<DIM,T,DataT>::Node::Node( const vec_t &position, const DataT &data )
+: mPosition( position ), mData( data ), mCell( NO_NODE ), mPrev( NO_NODE ), mNext( NO_NODE )
+{
+}
+
+template<uint8_t DIM, class T, class DataT>
+OctTree<DIM,T,DataT>::Cell::Cell( const vec_t &center, T halfSize, uint32_t parent, uint32_t depth )
+: mCenter( center ), mHalfSize( halfSize ), mParent( parent ), mChildren( NO_NODE ), mFirst( NO_NODE ), mCount( 0 ), mSubtreeCount( 0 ), mDepth( depth )
+{
+}
+
+template<uint8_t DIM, class T, class DataT>
+OctTree<DIM,T,DataT>::OctTree( const vec_t &min, const vec_t &max, uint32_t maxPerCell, uint32_t maxDepth )
+: mMin( min ), mMax( max ), mMaxPerCell( std::max( maxPerCell, 1u ) ), mMaxDepth( maxDepth )
+{
+	clear();
+}
+
+template<uint8_t DIM, class T, class DataT>
+void OctTree<DIM,T,DataT>::clear()
+{
+	mNodes.clear();
+	mFreeNodes.clear();
+	mCells.clear();
+	mFreeBlocks.clear();
+
+	// the root is a square around the bounds
+	T halfSize = 0;
+	for( uint8_t axis = 0; axis < DIM; ++axis )
+		halfSize = std::max( halfSize, ( mMax[axis] - mMin[axis] ) * T( 0.5 ) );
+	mCells.emplace_back( ( mMin + mMax ) * T( 0.5 ), halfSize );
+}
+
+template<uint8_t DIM, class T, class DataT>
+typename OctTree<DIM,T,DataT>::Handle OctTree<DIM,T,DataT>::insert( const vec_t &position, const DataT &data )
+{
+	Handle handle;
+	if( mFreeNodes.empty() ) {
+		handle = static_cast<Handle>( mNodes.size() );
+		mNodes.emplace_back( position, data );
+	}
+	else {
+		handle = mFreeNodes.back();
+		mFreeNodes.pop_back();
+		mNodes[handle] = Node( position, data );
+	}
+	link( handle, findCell( 0, position ) );
+	return handle;
+}
+template<uint8_t DIM, class T, class DataT>
+void OctTree<DIM,T,DataT>::remove( Handle handle )
+{
+	const uint32_t cell = unlink( handle );
+	mNodes[handle].mCell = NO_NODE;
+	mFreeNodes.push_back( handle );
+	collapse( cell );
+}
+template<uint8_t DIM, class T, class DataT>
+void OctTree<DIM,T,DataT>::move( Handle handle, const vec_t &position )
+{
+	mNodes[handle].mPosition = position;
+	const uint32_t cell = mNodes[handle].mCell;
+	if( inLooseBounds( cell, position ) )
+		return;
+
+	// climb to the first ancestor that still holds the point and sink it from there, the root holds everything
+	unlink( handle );
+	uint32_t ancestor = mCells[cell].mParent;
+	while( ! inLooseBounds( ancestor, position ) )
+		ancestor = mCells[ancestor].mParent;
+	link( handle, findCell( ancestor, position ) );
+	collapse( cell );
+}
+
+//! Returns which child's tight bounds hold the position, one bit per axis
+template<uint8_t DIM, class T, class DataT>
+uint32_t OctTree<DIM,T,DataT>::childIndex( const Cell &cell, const vec_t &position ) const
+{
+	uint32_t index = 0;
+	for( uint8_t axis = 0; axis < DIM; ++axis ) {
+		if( position[axis] >= cell.mCenter[axis] )
+			index |= 1 << axis;
+	}
+	return index;
+}
+template<uint8_t DIM, class T, class DataT>
+bool OctTree<DIM,T,DataT>::inLooseBounds( uint32_t cell, const vec_t &position ) const
+{
+	if( cell == 0 )
+		return true;
+	const Cell &c = mCells[cell];
+	for( uint8_t axis = 0; axis < DIM; ++axis ) {
+		if( glm::abs( position[axis] - c.mCenter[axis] ) > 2 * c.mHalfSize )
+			return false;
+	}
+	return true;
+}
+//! Returns the square distance from the position to the loose bounds of a cell, the root has no bounds
+template<uint8_t DIM, class T, class DataT>
+T OctTree<DIM,T,DataT>::looseDistance2( uint32_t cell, const vec_t &position ) const
+{
+	if( cell == 0 )
+		return 0;
+	const Cell &c = mCells[cell];
+	T distanceSq = 0;
+	for( uint8_t axis = 0; axis < DIM; ++axis ) {
+		const T d = glm::abs( position[axis] - c.mCenter[axis] ) - 2 * c.mHalfSize;
+		if( d > 0 )
+			distanceSq += d * d;
+	}
+	return distanceSq;
+}
+//! Returns the deepest cell below this one whose loose bounds hold the position
+template<uint8_t DIM, class T, class DataT>
+uint32_t OctTree<DIM,T,DataT>::findCell( uint32_t cell, const vec_t &position ) const
+{
+	while( mCells[cell].mChildren != NO_NODE ) {
+		const uint32_t child = mCells[cell].mChildren + childIndex( mCells[cell], position );
+		if( ! inLooseBounds( child, position ) )
+			break;
+		cell = child;
+	}
+	return cell;
+}
+
+//! Pushes the node in front of the cell's list, subtree counts are left to the caller
+template<uint8_t DIM, class T, class DataT>
+void OctTree<DIM,T,DataT>::attach( Handle handle, uint32_t cell )
+{
+	Node &node	= mNodes[handle];
+	node.mCell	= cell;
+	node.mPrev	= NO_NODE;
+	node.mNext	= mCells[cell].mFirst;
+	if( node.mNext != NO_NODE )
+		mNodes[node.mNext].mPrev = handle;
+	mCells[cell].mFirst = handle;
+	mCells[cell].mCount++;
+}
+template<uint8_t DIM, class T, class DataT>
+void OctTree<DIM,T,DataT>::detach( Handle handle )
+{
+	const Node &node = mNodes[handle];
+	if( node.mPrev != NO_NODE )
+		mNodes[node.mPrev].mNext = node.mNext;
+	else
+		mCells[node.mCell].mFirst = node.mNext;
+	if( node.mNext != NO_NODE )
+		mNodes[node.mNext].mPrev = node.mPrev;
+	mCells[node.mCell].mCount--;
+}
+template<uint8_t DIM, class T, class DataT>
+void OctTree<DIM,T,DataT>::link( Handle handle, uint32_t cell )
+{
+	attach( handle, cell );
+	for( uint32_t c = cell; c != NO_NODE; c = mCells[c].mParent )
+		mCells[c].mSubtreeCount++;
+
+	if( mCells[cell].mChildren == NO_NODE && mCells[cell].mCount > mMaxPerCell && mCells[cell].mDepth < mMaxDepth )
+		split( cell );
+}
+//! Unlinks the node and returns the cell it was in
+template<uint8_t DIM, class T, class DataT>
+uint32_t OctTree<DIM,T,DataT>::unlink( Handle handle )
+{
+	const uint32_t cell = mNodes[handle].mCell;
+	detach( handle );
+	for( uint32_t c = cell; c != NO_NODE; c = mCells[c].mParent )
+		mCells[c].mSubtreeCount--;
+	return cell;
+}
+template<uint8_t DIM, class T, class DataT>
+void OctTree<DIM,T,DataT>::split( uint32_t cell )
+{
+	uint32_t children;
+	if( ! mFreeBlocks.empty() ) {
+		children = mFreeBlocks.back();
+		mFreeBlocks.pop_back();
+	}
+	else {
+		children = static_cast<uint32_t>( mCells.size() );
+		mCells.resize( mCells.size() + NUM_CHILDREN );
+	}
+
+	const Cell parent = mCells[cell];
+	const T halfSize = parent.mHalfSize * T( 0.5 );
+	for( uint32_t i = 0; i < NUM_CHILDREN; ++i ) {
+		vec_t center = parent.mCenter;
+		for( uint8_t axis = 0; axis < DIM; ++axis )
+			center[axis] += ( i & ( 1 << axis ) ) ? halfSize : -halfSize;
+		mCells[children + i] = Cell( center, halfSize, cell, parent.mDepth + 1 );
+	}
+	mCells[cell].mChildren = children;
+
+	// push the nodes down, those sitting in the loose margin of the cell may not fit any child and stay
+	for( Handle handle = parent.mFirst; handle != NO_NODE; ) {
+		const Handle next = mNodes[handle].mNext;
+		const uint32_t child = children + childIndex( parent, mNodes[handle].mPosition );
+		if( inLooseBounds( child, mNodes[handle].mPosition ) ) {
+			detach( handle );
+			attach( handle, child );
+			mCells[child].mSubtreeCount++;
+		}
+		handle = next;
+	}
+
+	for( uint32_t i = 0; i < NUM_CHILDREN; ++i ) {
+		if( mCells[children + i].mCount > mMaxPerCell && parent.mDepth + 1 < mMaxDepth )
+			split( children + i );
+	}
+}
+//! Merges the highest ancestor left with half a cell's worth of nodes or less back into a single cell
+template<uint8_t DIM, class T, class DataT>
+void OctTree<DIM,T,DataT>::collapse( uint32_t cell )
+{
+	uint32_t target = NO_NODE;
+	for( uint32_t c = cell; c != NO_NODE; c = mCells[c].mParent ) {
+		if( mCells[c].mChildren != NO_NODE && mCells[c].mSubtreeCount <= mMaxPerCell / 2 )
+			target = c;
+	}
+	if( target != NO_NODE )
+		gather( target, target );
+}
+//! Moves the nodes below the cell to the target and releases the cells below it
+template<uint8_t DIM, class T, class DataT>
+void OctTree<DIM,T,DataT>::gather( uint32_t target, uint32_t cell )
+{
+	const uint32_t children = mCells[cell].mChildren;
+	if( children == NO_NODE )
+		return;
+
+	for( uint32_t child = children; child < children + NUM_CHILDREN; ++child ) {
+		while( mCells[child].mFirst != NO_NODE ) {
+			const Handle handle = mCells[child].mFirst;
+			detach( handle );
+			attach( handle, target );
+		}
+		gather( target, child );
+	}
+	mCells[cell].mChildren = NO_NODE;
+	mFreeBlocks.push_back( children );
+}
+
+template<uint8_t DIM, class T, class DataT>
+typename OctTree<DIM,T,DataT>::Node* OctTree<DIM,T,DataT>::nearestNeighborSearch( const vec_t &position, T *distanceSq ) const
+{
+	return nearestNeighborSearchIf( position, distanceSq, details::AcceptAll() );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+typename OctTree<DIM,T,DataT>::Node* OctTree<DIM,T,DataT>::nearestNeighborSearchIf( const vec_t &position, T *distanceSq, Predicate predicate ) const
+{
+	NodePair nearest;
+	if( ! kNearestIf( position, 1, std::numeric_limits<T>::max(), &nearest, predicate ) )
+		return nullptr;
+	if( distanceSq != nullptr )
+		*distanceSq = nearest.second;
+	return nearest.first;
+}
+
+template<uint8_t DIM, class T, class DataT>
+std::vector<typename OctTree<DIM,T,DataT>::NodePair> OctTree<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius ) const
+{
+	return rangeSearchIf( position, radius, details::AcceptAll() );
+}
+template<uint8_t DIM, class T, class DataT>
+void OctTree<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius, const std::function<void(Node*,T)> &visitor ) const
+{
+	rangeSearchIf( position, radius, details::AcceptAll(), visitor );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Visitor>
+void OctTree<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius, Visitor &&visitor ) const
+{
+	rangeSearchIf( position, radius, details::AcceptAll(), std::forward<Visitor>( visitor ) );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+std::vector<typename OctTree<DIM,T,DataT>::NodePair> OctTree<DIM,T,DataT>::rangeSearchIf( const vec_t &position, T radius, Predicate predicate ) const
+{
+	std::vector<NodePair> results;
+	auto collect = [&results]( Node* node, T distanceSq ) {
+		results.emplace_back( node, distanceSq );
+	};
+	rangeSearchImpl( 0, position, radius, predicate, collect );
+	return results;
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate, class Visitor>
+void OctTree<DIM,T,DataT>::rangeSearchIf( const vec_t &position, T radius, Predicate predicate, Visitor &&visitor ) const
+{
+	rangeSearchImpl( 0, position, radius, predicate, visitor );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate, class Visitor>
+bool OctTree<DIM,T,DataT>::rangeSearchImpl( uint32_t cell, const vec_t &position, T radius, Predicate &predicate, Visitor &visitor ) const
+{
+	const Cell &c = mCells[cell];
+	const T radiusSq = radius * radius;
+	if( ! c.mSubtreeCount || looseDistance2( cell, position ) > radiusSq )
+		return false;
+
+	for( Handle handle = c.mFirst; handle != NO_NODE; handle = mNodes[handle].mNext ) {
+		Node* node = getNode( handle );
+		const T distanceSq = glm::distance2( node->mPosition, position );
+		if( distanceSq <= radiusSq && predicate( node ) && details::visit( visitor, node, distanceSq ) )
+			return true;
+	}
+
+	if( c.mChildren != NO_NODE ) {
+		for( uint32_t child = c.mChildren; child < c.mChildren + NUM_CHILDREN; ++child ) {
+			if( rangeSearchImpl( child, position, radius, predicate, visitor ) )
+				return true;
+		}
+	}
+	return false;
+}
+
+template<uint8_t DIM, class T, class DataT>
+size_t OctTree<DIM,T,DataT>::kNearest( const vec_t &position, size_t k, T maxRadius, NodePair *results ) const
+{
+	return kNearestIf( position, k, maxRadius, results, details::AcceptAll() );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+size_t OctTree<DIM,T,DataT>::kNearestIf( const vec_t &position, size_t k, T maxRadius, NodePair *results, Predicate predicate ) const
+{
+	if( ! size() || ! k )
+		return 0;
+
+	details::KNearestHeap<NodePair> heap( results, k, maxRadius );
+	kNearestImpl( 0, position, predicate, &heap );
+	return heap.finish();
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+void OctTree<DIM,T,DataT>::kNearestImpl( uint32_t cell, const vec_t &position, Predicate &predicate, details::KNearestHeap<NodePair> *heap ) const
+{
+	const Cell &c = mCells[cell];
+	for( Handle handle = c.mFirst; handle != NO_NODE; handle = mNodes[handle].mNext ) {
+		const T distanceSq = glm::distance2( mNodes[handle].mPosition, position );
+		if( distanceSq <= heap->bound() && predicate( getNode( handle ) ) )
+			heap->push( getNode( handle ), distanceSq );
+	}
+	if( c.mChildren == NO_NODE )
+		return;
+
+	// visit the children nearest first so the bound tightens early
+	std::pair<T,uint32_t> order[NUM_CHILDREN];
+	uint32_t count = 0;
+	for( uint32_t child = c.mChildren; child < c.mChildren + NUM_CHILDREN; ++child ) {
+		if( ! mCells[child].mSubtreeCount )
+			continue;
+		// insertion sort, there are at most eight
+		const std::pair<T,uint32_t> entry( looseDistance2( child, position ), child );
+		uint32_t i = count++;
+		for( ; i > 0 && entry.first < order[i - 1].first; --i )
+			order[i] = order[i - 1];
+		order[i] = entry;
+	}
+	for( uint32_t i = 0; i < count && order[i].first <= heap->bound(); ++i )
+		kNearestImpl( order[i].second, position, predicate, heap );
+}
+
+//! Represents a 2D float loose QuadTree space partitioning structure
+template<class DataT=uint32_t> using OctTree2 = OctTree<2,float,DataT>;
+//! Represents a 3D float loose OctTree space partitioning structure
+template<class DataT=uint32_t> using OctTree3 = OctTree<3,float,DataT>;
+//! Represents a 2D double loose QuadTree space partitioning structure
+template<class DataT=uint32_t> using dOctTree2 = OctTree<2,double,DataT>;
+//! Represents a 3D double loose OctTree space partitioning structure
+template<class DataT=uint32_t> using dOctTree3 = OctTree<3,double,DataT>;
+
+};
+
+namespace sp = SpacePartitioning;
@@ -0,0 +1,80 @@
+/*
+ Parallel - Space Partitioning algorithms for Cinder
+ 
+ Copyright (c) 2016, Simon Geilfus, All rights reserved.
+ This code is intended for use with the Cinder C++ library: http://libcinder.org
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+	the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+	the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <thread>
+#include <utility>
+
+namespace SpacePartitioning {
+
+namespace details {
+
+//! Returns the number of fork-join levels needed to keep every hardware thread busy
+inline uint32_t parallelDepth()
+{
+	const uint32_t threads = std::max( 1u, std::thread::hardware_concurrency() );
+	uint32_t depth = 0;
+	while( ( 1u << depth ) < threads )
+		depth++;
+	return depth;
+}
+
+//! Runs both functions, the first one on another thread when parallel is true
+template<class F1, class F2>
+void parallelInvoke( bool parallel, F1 &&f1, F2 &&f2 )
+{
+	if( ! parallel ) {
+		f1();
+		f2();
+		return;
+	}
+	auto task = std::async( std::launch::async, std::forward<F1>( f1 ) );
+	f2();
+	task.get();
+}
+
+//! Calls f( begin, end ) over [begin, end) split in halves across parallelDepth fork-join levels, ranges of grain or less are not split
+template<class F>
+void parallelFor( size_t begin, size_t end, size_t grain, uint32_t parallelDepth, const F &f )
+{
+	if( ! parallelDepth || end - begin <= grain ) {
+		f( begin, end );
+		return;
+	}
+	const size_t mid = begin + ( end - begin ) / 2;
+	parallelInvoke( true,
+		[=, &f] { parallelFor( begin, mid, grain, parallelDepth - 1, f ); },
+		[=, &f] { parallelFor( mid, end, grain, parallelDepth - 1, f ); } );
+}
+
+} // namespace details
+
+};
+
+namespace sp = SpacePartitioning;
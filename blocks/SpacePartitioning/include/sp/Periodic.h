@@ -0,0 +1,156 @@
+/*
+ Periodic - Space Partitioning algorithms for Cinder
+ 
+ Copyright (c) 2016, Simon Geilfus, All rights reserved.
+ This code is intended for use with the Cinder C++ library: http://libcinder.org
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+	the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+	the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include "cinder/Vector.h"
+
+namespace SpacePartitioning {
+
+namespace details {
+
+//! Describes an optional periodic domain [min, max) where space wraps around, distances being measured to the nearest periodic image of a position. A disabled domain leaves positions and queries untouched
+template<uint8_t DIM, class T>
+class PeriodicDomain {
+public:
+	using vec_t = typename ci::VECDIM<DIM, T>::TYPE;
+	
+	//! Upper bound of the number of images a query visits, one per combination of offsets along each axis
+	enum : uint32_t { MAX_IMAGES = DIM == 1 ? 3 : DIM == 2 ? 9 : 27 };
+	
+	PeriodicDomain() : mEnabled( false ) {}
+	
+	//! Enables wrapping around the domain [min, max)
+	void set( const vec_t &min, const vec_t &max );
+	//! Disables wrapping
+	void reset() { mEnabled = false; }
+	bool isEnabled() const { return mEnabled; }
+	const vec_t& getMin() const { return mMin; }
+	vec_t getMax() const { return mMin + mSize; }
+	
+	//! Returns the position wrapped into the domain
+	vec_t wrap( const vec_t &position ) const;
+	//! Returns the radius limited to half the smallest extent of the domain, where every position is reached through a single image
+	T clampRadius( T radius ) const { return mEnabled ? std::min( radius, mHalfExtent ) : radius; }
+	//! Returns the distance squared between a position and the domain
+	T distance2( const vec_t &position ) const;
+	//! Writes the position wrapped into the domain to images, followed by its images that are within radius of the domain, and returns their count. A disabled domain writes the position alone. images must hold MAX_IMAGES positions
+	uint32_t getImages( const vec_t &position, T radius, vec_t *images ) const;
+	
+protected:
+	bool	mEnabled;
+	vec_t	mMin, mSize;
+	T	mHalfExtent;
+};
+
+// MARK: PeriodicDomain Impl.
+
+// https://en.wikipedia.org/wiki/Periodic_boundary_conditions
+// https://en.wikipedia.org/wiki/Periodic_boundary_conditions#Practical_implementation:_continuity_and_the_minimum_image_convention
+
+template<uint8_t DIM, class T>
+void PeriodicDomain<DIM,T>::set( const vec_t &min, const vec_t &max )
+{
+	mEnabled	= true;
+	mMin		= min;
+	mSize		= max - min;
+	mHalfExtent	= std::numeric_limits<T>::max();
+	for( uint8_t axis = 0; axis < DIM; ++axis )
+		mHalfExtent = std::min( mHalfExtent, mSize[axis] / T( 2 ) );
+}
+
+template<uint8_t DIM, class T>
+typename PeriodicDomain<DIM,T>::vec_t PeriodicDomain<DIM,T>::wrap( const vec_t &position ) const
+{
+	if( ! mEnabled )
+		return position;
+	
+	vec_t wrapped = position - mMin;
+	for( uint8_t axis = 0; axis < DIM; ++axis ) {
+		wrapped[axis] -= std::floor( wrapped[axis] / mSize[axis] ) * mSize[axis];
+		// rounding can land a position just below min on max itself
+		if( wrapped[axis] >= mSize[axis] )
+			wrapped[axis] = T( 0 );
+	}
+	return mMin + wrapped;
+}
+
+template<uint8_t DIM, class T>
+T PeriodicDomain<DIM,T>::distance2( const vec_t &position ) const
+{
+	T result = 0;
+	for( uint8_t axis = 0; axis < DIM; ++axis ) {
+		const T outside = std::max( mMin[axis] - position[axis], position[axis] - mMin[axis] - mSize[axis] );
+		if( outside > T( 0 ) )
+			result += outside * outside;
+	}
+	return result;
+}
+
+template<uint8_t DIM, class T>
+uint32_t PeriodicDomain<DIM,T>::getImages( const vec_t &position, T radius, vec_t *images ) const
+{
+	if( ! mEnabled ) {
+		images[0] = position;
+		return 1;
+	}
+	
+	// an image shifted along an axis can only reach the domain if the position is within radius of that side
+	const vec_t wrapped = wrap( position );
+	uint32_t numImages = 1;
+	images[0] = wrapped;
+	for( uint8_t axis = 0; axis < DIM; ++axis ) {
+		const uint32_t count	= numImages;
+		const bool nearMin		= wrapped[axis] - mMin[axis] < radius;
+		const bool nearMax		= mMin[axis] + mSize[axis] - wrapped[axis] < radius;
+		for( uint32_t i = 0; i < count; ++i ) {
+			if( nearMin ) {
+				images[numImages] = images[i];
+				images[numImages++][axis] += mSize[axis];
+			}
+			if( nearMax ) {
+				images[numImages] = images[i];
+				images[numImages++][axis] -= mSize[axis];
+			}
+		}
+	}
+	
+	// images shifted along several axes can still be out of reach
+	uint32_t numReached = 1;
+	for( uint32_t i = 1; i < numImages; ++i ) {
+		if( distance2( images[i] ) <= radius * radius )
+			images[numReached++] = images[i];
+	}
+	return numReached;
+}
+
+} // namespace details
+
+};
+
+namespace sp = SpacePartitioning;
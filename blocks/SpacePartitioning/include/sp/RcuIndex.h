@@ -0,0 +1,268 @@
+/*
+ RcuIndex - Space Partitioning algorithms for Cinder
+ 
+ Copyright (c) 2016, Simon Geilfus, All rights reserved.
+ This code is intended for use with the Cinder C++ library: http://libcinder.org
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+	the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+	the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <string>
+#include <atomic>
+#include <memory>
+#include <limits>
+#include <cstdint>
+#include <utility>
+#include "cinder/Exception.h"
+
+namespace SpacePartitioning {
+
+//! Publishes immutable versions of a spatial structure to concurrent readers, read-copy-update style. A writer builds the next version aside and publishes it with an atomic pointer swap, readers pin the version current when they start and never wait. The versions replaced are retired and freed once every reader that could still see them is done, which is tracked with epochs
+template<class Index>
+class RcuIndex {
+public:
+	class Reader;
+	
+	//! Keeps the version a reader started with alive until destroyed
+	class ReadGuard {
+	public:
+		ReadGuard( ReadGuard &&other );
+		ReadGuard( const ReadGuard& ) = delete;
+		ReadGuard& operator=( const ReadGuard& ) = delete;
+		~ReadGuard();
+		
+		//! Returns the pinned version, or nullptr if nothing was published yet
+		const Index* get() const { return mIndex; }
+		const Index* operator->() const { return mIndex; }
+		const Index& operator*() const { return *mIndex; }
+		explicit operator bool() const { return mIndex != nullptr; }
+	protected:
+		ReadGuard( const Reader *reader, const Index *index ) : mReader( reader ), mIndex( index ) {}
+		
+		const Reader	*mReader;
+		const Index		*mIndex;
+		friend class Reader;
+	};
+	
+	//! Reading side of a single thread, holds one of the reader slots until destroyed
+	class Reader {
+	public:
+		Reader( Reader &&other );
+		Reader( const Reader& ) = delete;
+		Reader& operator=( const Reader& ) = delete;
+		~Reader();
+		
+		//! Pins the current version until the returned guard is destroyed, without ever waiting on writers. Guards of the same Reader can be nested
+		ReadGuard read() const;
+	protected:
+		Reader( RcuIndex *rcu, uint32_t slot ) : mRcu( rcu ), mSlot( slot ), mDepth( 0 ) {}
+		void release() const;
+		
+		RcuIndex			*mRcu;
+		uint32_t			mSlot;
+		mutable uint32_t	mDepth;	// guards alive, only the outermost one announces an epoch
+		friend class RcuIndex;
+	};
+	
+	//! Constructs an empty RcuIndex that up to maxReaders Readers can read at once
+	RcuIndex( uint32_t maxReaders = 64 );
+	//! Frees every version, no Reader can be left
+	~RcuIndex();
+	
+	//! Registers a reader for the calling thread, throws RcuIndexException if maxReaders are already registered
+	Reader makeReader();
+	//! Makes index the current version. The previous one is retired and freed by a later reclaim once no reader can see it anymore. Writers are serialized, readers are never blocked
+	void publish( std::unique_ptr<Index> index );
+	//! Returns a retired version no reader can see anymore, for the writer to rebuild in place of allocating a new one, or nullptr if there is none
+	std::unique_ptr<Index> recycle();
+	//! Frees the retired versions no reader can see anymore and returns how many are still waiting on readers
+	size_t reclaim();
+	
+	//! Returns the current version, only safe while no writer can publish
+	const Index* getCurrent() const { return mCurrent.load(); }
+	//! Returns the number of versions published so far
+	uint64_t getEpoch() const { return mEpoch.load() - 1; }
+	
+protected:
+	//! Epoch of a slot whose reader isn't reading
+	enum : uint64_t { IDLE = 0 };
+	
+	//! Epoch announced by a reader, on its own cache line so that readers don't slow each other down
+	struct alignas( 64 ) Slot {
+		std::atomic<uint64_t>	mEpoch;
+		std::atomic<bool>		mRegistered;
+	};
+	struct Retired {
+		uint64_t				mEpoch;		// epoch at which it stopped being current
+		std::unique_ptr<Index>	mIndex;
+	};
+	
+	uint64_t oldestReaderEpoch() const;
+	
+	std::atomic<const Index*>	mCurrent;
+	std::atomic<uint64_t>		mEpoch;
+	std::unique_ptr<Slot[]>		mSlots;
+	uint32_t					mNumSlots;
+	std::mutex					mWriterMutex;	// publish, recycle and reclaim
+	std::vector<Retired>		mRetired;
+};
+
+class RcuIndexException : public ci::Exception {
+public:
+	RcuIndexException( const std::string &value ) : ci::Exception( value ) {}
+};
+
+// MARK: RcuIndex Impl.
+
+// https://www.kernel.org/doc/html/latest/RCU/whatisRCU.html
+// https://www.cl.cam.ac.uk/techreports/UCAM-CL-TR-579.pdf
+
+// RcuIndex::ReadGuard
+template<class Index>
+RcuIndex<Index>::ReadGuard::ReadGuard( ReadGuard &&other )
+: mReader( other.mReader ), mIndex( other.mIndex )
+{
+	other.mReader = nullptr;
+	other.mIndex = nullptr;
+}
+template<class Index>
+RcuIndex<Index>::ReadGuard::~ReadGuard()
+{
+	if( mReader )
+		mReader->release();
+}
+
+// RcuIndex::Reader
+template<class Index>
+RcuIndex<Index>::Reader::Reader( Reader &&other )
+: mRcu( other.mRcu ), mSlot( other.mSlot ), mDepth( other.mDepth )
+{
+	other.mRcu = nullptr;
+}
+template<class Index>
+RcuIndex<Index>::Reader::~Reader()
+{
+	if( mRcu ) {
+		mRcu->mSlots[mSlot].mEpoch.store( IDLE );
+		mRcu->mSlots[mSlot].mRegistered.store( false );
+	}
+}
+template<class Index>
+typename RcuIndex<Index>::ReadGuard RcuIndex<Index>::Reader::read() const
+{
+	// announce the epoch before loading the version, a writer retiring the version loaded after this either sees the announcement or published before the load
+	if( ! mDepth++ )
+		mRcu->mSlots[mSlot].mEpoch.store( mRcu->mEpoch.load() );
+	return ReadGuard( this, mRcu->mCurrent.load() );
+}
+template<class Index>
+void RcuIndex<Index>::Reader::release() const
+{
+	if( ! --mDepth )
+		mRcu->mSlots[mSlot].mEpoch.store( IDLE );
+}
+
+// RcuIndex
+template<class Index>
+RcuIndex<Index>::RcuIndex( uint32_t maxReaders )
+: mCurrent( nullptr ), mEpoch( 1 ), mSlots( new Slot[maxReaders] ), mNumSlots( maxReaders )
+{
+	for( uint32_t i = 0; i < mNumSlots; ++i ) {
+		mSlots[i].mEpoch.store( IDLE );
+		mSlots[i].mRegistered.store( false );
+	}
+}
+template<class Index>
+RcuIndex<Index>::~RcuIndex()
+{
+	delete mCurrent.load();
+}
+
+template<class Index>
+typename RcuIndex<Index>::Reader RcuIndex<Index>::makeReader()
+{
+	for( uint32_t i = 0; i < mNumSlots; ++i ) {
+		bool registered = false;
+		if( mSlots[i].mRegistered.compare_exchange_strong( registered, true ) )
+			return Reader( this, i );
+	}
+	throw RcuIndexException( "more than " + std::to_string( mNumSlots ) + " readers" );
+}
+
+template<class Index>
+void RcuIndex<Index>::publish( std::unique_ptr<Index> index )
+{
+	std::lock_guard<std::mutex> lock( mWriterMutex );
+	
+	// readers that announced this epoch or an older one may still hold the previous version
+	const Index* previous = mCurrent.exchange( index.release() );
+	const uint64_t epoch = mEpoch.fetch_add( 1 );
+	if( previous )
+		mRetired.push_back( Retired{ epoch, std::unique_ptr<Index>( const_cast<Index*>( previous ) ) } );
+}
+
+//! Returns the oldest epoch announced by a reader currently reading, or the maximum if none is
+template<class Index>
+uint64_t RcuIndex<Index>::oldestReaderEpoch() const
+{
+	uint64_t oldest = std::numeric_limits<uint64_t>::max();
+	for( uint32_t i = 0; i < mNumSlots; ++i ) {
+		const uint64_t epoch = mSlots[i].mEpoch.load();
+		if( epoch != IDLE && epoch < oldest )
+			oldest = epoch;
+	}
+	return oldest;
+}
+
+template<class Index>
+std::unique_ptr<Index> RcuIndex<Index>::recycle()
+{
+	std::lock_guard<std::mutex> lock( mWriterMutex );
+	
+	const uint64_t oldest = oldestReaderEpoch();
+	for( auto it = mRetired.begin(); it != mRetired.end(); ++it ) {
+		if( it->mEpoch < oldest ) {
+			std::unique_ptr<Index> index = std::move( it->mIndex );
+			mRetired.erase( it );
+			return index;
+		}
+	}
+	return nullptr;
+}
+
+template<class Index>
+size_t RcuIndex<Index>::reclaim()
+{
+	std::lock_guard<std::mutex> lock( mWriterMutex );
+	
+	// versions are retired in epoch order, the ones before the oldest reader are unreachable
+	const uint64_t oldest = oldestReaderEpoch();
+	auto it = mRetired.begin();
+	while( it != mRetired.end() && it->mEpoch < oldest )
+		++it;
+	mRetired.erase( mRetired.begin(), it );
+	return mRetired.size();
+}
+
+};
+
+namespace sp = SpacePartitioning;
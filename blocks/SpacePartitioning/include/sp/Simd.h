@@ -0,0 +1,197 @@
+/*
+ Simd - Space Partitioning algorithms for Cinder
+ 
+ Copyright (c) 2016, Simon Geilfus, All rights reserved.
+ This code is intended for use with the Cinder C++ library: http://libcinder.org
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+	the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+	the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include "sp/Visitor.h"
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+	#define SP_SIMD_SSE2
+	#include <emmintrin.h>
+#endif
+#if defined( __AVX__ )
+	#define SP_SIMD_AVX
+	#include <immintrin.h>
+#endif
+
+namespace SpacePartitioning {
+
+//! Brute-force kernels over packed coordinate arrays, vectorized with AVX or SSE2 where available
+namespace simd {
+
+//! Returns the index of the point nearest to ( px, py ) and its square distance, count must be greater than 0. Ties go to the lowest index
+inline size_t nearest2( const float *xs, const float *ys, size_t count, float px, float py, float *distanceSq = nullptr )
+{
+	size_t i			= 0;
+	size_t nearest		= 0;
+	float nearestDistSq	= std::numeric_limits<float>::max();
+
+#if defined( SP_SIMD_AVX )
+	// AVX has no 256-bit integer ops, lane indices are tracked as floats which are exact below 2^24
+	if( count >= 8 && count < ( 1 << 24 ) ) {
+		const __m256 qx		= _mm256_set1_ps( px );
+		const __m256 qy		= _mm256_set1_ps( py );
+		const __m256 eight	= _mm256_set1_ps( 8.0f );
+		__m256 minDistSq	= _mm256_set1_ps( std::numeric_limits<float>::max() );
+		__m256 minIndex		= _mm256_setzero_ps();
+		__m256 index		= _mm256_setr_ps( 0, 1, 2, 3, 4, 5, 6, 7 );
+		for( ; i + 8 <= count; i += 8 ) {
+			const __m256 dx		= _mm256_sub_ps( _mm256_loadu_ps( xs + i ), qx );
+			const __m256 dy		= _mm256_sub_ps( _mm256_loadu_ps( ys + i ), qy );
+			const __m256 distSq	= _mm256_add_ps( _mm256_mul_ps( dx, dx ), _mm256_mul_ps( dy, dy ) );
+			const __m256 closer	= _mm256_cmp_ps( distSq, minDistSq, _CMP_LT_OQ );
+			minDistSq	= _mm256_min_ps( distSq, minDistSq );
+			minIndex	= _mm256_blendv_ps( minIndex, index, closer );
+			index		= _mm256_add_ps( index, eight );
+		}
+
+		// Reduce the eight lanes
+		alignas( 32 ) float laneDistSq[8];
+		alignas( 32 ) float laneIndex[8];
+		_mm256_store_ps( laneDistSq, minDistSq );
+		_mm256_store_ps( laneIndex, minIndex );
+		for( int lane = 0; lane < 8; ++lane ) {
+			const size_t laneNearest = static_cast<size_t>( laneIndex[lane] );
+			if( laneDistSq[lane] < nearestDistSq || ( laneDistSq[lane] == nearestDistSq && laneNearest < nearest ) ) {
+				nearestDistSq	= laneDistSq[lane];
+				nearest			= laneNearest;
+			}
+		}
+	}
+#endif
+
+#if defined( SP_SIMD_SSE2 )
+	if( count - i >= 4 ) {
+		const __m128 qx		= _mm_set1_ps( px );
+		const __m128 qy		= _mm_set1_ps( py );
+		const __m128i four	= _mm_set1_epi32( 4 );
+		__m128 minDistSq	= _mm_set1_ps( std::numeric_limits<float>::max() );
+		__m128i minIndex	= _mm_setzero_si128();
+		__m128i index		= _mm_add_epi32( _mm_setr_epi32( 0, 1, 2, 3 ), _mm_set1_epi32( static_cast<int32_t>( i ) ) );
+		for( ; i + 4 <= count; i += 4 ) {
+			const __m128 dx		= _mm_sub_ps( _mm_loadu_ps( xs + i ), qx );
+			const __m128 dy		= _mm_sub_ps( _mm_loadu_ps( ys + i ), qy );
+			const __m128 distSq	= _mm_add_ps( _mm_mul_ps( dx, dx ), _mm_mul_ps( dy, dy ) );
+			const __m128i closer	= _mm_castps_si128( _mm_cmplt_ps( distSq, minDistSq ) );
+			minDistSq	= _mm_min_ps( distSq, minDistSq );
+			minIndex	= _mm_or_si128( _mm_and_si128( closer, index ), _mm_andnot_si128( closer, minIndex ) );
+			index		= _mm_add_epi32( index, four );
+		}
+
+		// Reduce the four lanes
+		alignas( 16 ) float laneDistSq[4];
+		alignas( 16 ) int32_t laneIndex[4];
+		_mm_store_ps( laneDistSq, minDistSq );
+		_mm_store_si128( reinterpret_cast<__m128i*>( laneIndex ), minIndex );
+		for( int lane = 0; lane < 4; ++lane ) {
+			const size_t laneNearest = static_cast<size_t>( laneIndex[lane] );
+			if( laneDistSq[lane] < nearestDistSq || ( laneDistSq[lane] == nearestDistSq && laneNearest < nearest ) ) {
+				nearestDistSq	= laneDistSq[lane];
+				nearest			= laneNearest;
+			}
+		}
+	}
+#endif
+
+	for( ; i < count; ++i ) {
+		const float dx		= xs[i] - px;
+		const float dy		= ys[i] - py;
+		const float distSq	= dx * dx + dy * dy;
+		if( distSq < nearestDistSq ) {
+			nearestDistSq	= distSq;
+			nearest			= i;
+		}
+	}
+
+	if( distanceSq != nullptr )
+		*distanceSq = nearestDistSq;
+	return nearest;
+}
+
+//! Calls visitor( index, distanceSq ) for every point strictly closer than sqrt( radiusSq ) to ( px, py ), in index order. Returns true if a visitor returning bool stopped the scan
+template<class Visitor>
+bool within2( const float *xs, const float *ys, size_t count, float px, float py, float radiusSq, Visitor &&visitor )
+{
+	size_t i = 0;
+
+#if defined( SP_SIMD_AVX )
+	{
+		const __m256 qx	= _mm256_set1_ps( px );
+		const __m256 qy	= _mm256_set1_ps( py );
+		const __m256 r2	= _mm256_set1_ps( radiusSq );
+		alignas( 32 ) float laneDistSq[8];
+		for( ; i + 8 <= count; i += 8 ) {
+			const __m256 dx		= _mm256_sub_ps( _mm256_loadu_ps( xs + i ), qx );
+			const __m256 dy		= _mm256_sub_ps( _mm256_loadu_ps( ys + i ), qy );
+			const __m256 distSq	= _mm256_add_ps( _mm256_mul_ps( dx, dx ), _mm256_mul_ps( dy, dy ) );
+			const int mask		= _mm256_movemask_ps( _mm256_cmp_ps( distSq, r2, _CMP_LT_OQ ) );
+			if( ! mask )
+				continue;
+			_mm256_store_ps( laneDistSq, distSq );
+			for( int lane = 0; lane < 8; ++lane ) {
+				if( ( mask & ( 1 << lane ) ) && details::visit( visitor, i + lane, laneDistSq[lane] ) )
+					return true;
+			}
+		}
+	}
+#endif
+
+#if defined( SP_SIMD_SSE2 )
+	const __m128 qx	= _mm_set1_ps( px );
+	const __m128 qy	= _mm_set1_ps( py );
+	const __m128 r2	= _mm_set1_ps( radiusSq );
+	alignas( 16 ) float laneDistSq[4];
+	for( ; i + 4 <= count; i += 4 ) {
+		const __m128 dx		= _mm_sub_ps( _mm_loadu_ps( xs + i ), qx );
+		const __m128 dy		= _mm_sub_ps( _mm_loadu_ps( ys + i ), qy );
+		const __m128 distSq	= _mm_add_ps( _mm_mul_ps( dx, dx ), _mm_mul_ps( dy, dy ) );
+		const int mask		= _mm_movemask_ps( _mm_cmplt_ps( distSq, r2 ) );
+		if( ! mask )
+			continue;
+		_mm_store_ps( laneDistSq, distSq );
+		for( int lane = 0; lane < 4; ++lane ) {
+			if( ( mask & ( 1 << lane ) ) && details::visit( visitor, i + lane, laneDistSq[lane] ) )
+				return true;
+		}
+	}
+#endif
+
+	for( ; i < count; ++i ) {
+		const float dx		= xs[i] - px;
+		const float dy		= ys[i] - py;
+		const float distSq	= dx * dx + dy * dy;
+		if( distSq < radiusSq && details::visit( visitor, i, distSq ) )
+			return true;
+	}
+	return false;
+}
+
+} // namespace simd
+
+};
+
+namespace sp = SpacePartitioning;
@@ -0,0 +1,380 @@
+/*
+ StaticGrid - Space Partitioning algorithms for Cinder
+ 
+ Copyright (c) 2016, Simon Geilfus, All rights reserved.
+ This code is intended for use with the Cinder C++ library: http://libcinder.org
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+	the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+	the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <vector>
+#include <limits>
+#include <cstdlib>
+#include <algorithm>
+#include <functional>
+#include "cinder/Vector.h"
+#include "sp/Filter.h"
+#include "sp/KNearest.h"
+#include "sp/Visitor.h"
+
+namespace SpacePartitioning {
+
+//! Represents a Grid / Bin-lattice over fixed bounds stored as compressed rows: nodes are sorted by cell into a single array and each cell is a contiguous range of it. Points outside of the bounds are kept in the border cells. The grid is rebuilt as a whole with build(), in two passes and without allocating once the storage has grown to fit
+template<uint8_t DIM, class T, class DataT>
+class StaticGrid {
+public:
+	using vec_t = typename ci::VECDIM<DIM, T>::TYPE;
+	using ivec_t = typename ci::VECDIM<DIM, int>::TYPE;
+
+	//! Constructs an empty StaticGrid covering min to max with cells of cellSize
+	StaticGrid( const vec_t &min, const vec_t &max, T cellSize );
+
+	//! Replaces the content of the grid with count points, data can be null
+	void build( const vec_t *positions, const DataT *data, size_t count );
+	//! Replaces the content of the grid with a random access range of ( position, data ) pairs
+	template<class RandomIt>
+	void build( RandomIt first, RandomIt last );
+	//! Removes all the nodes from the structure, keeping the storage allocated
+	void clear();
+	//! Returns the size of the StaticGrid
+	size_t size() const { return mNodes.size(); }
+
+	//! Represents a single element of the StaticGrid
+	class Node {
+	public:
+		//! Returns the position of the node
+		vec_t getPosition() const { return mPosition; }
+		//! Returns the user data
+		const DataT& getData() const { return mData; }
+
+		Node( const vec_t &position, const DataT &data );
+	protected:
+		vec_t	mPosition;
+		DataT	mData;
+		friend class StaticGrid;
+	};
+
+	using NodePair = std::pair<Node*,T>;
+
+	//! Returns a pointer to the nearest Node with its square distance to the position, or nullptr if empty
+	Node*			nearestNeighborSearch( const vec_t &position, T *distanceSq = nullptr ) const;
+	//! Returns a vector of Nodes within a radius along with their square distances to the position
+	std::vector<NodePair>	rangeSearch( const vec_t &position, T radius ) const;
+	//! Returns a vector of Nodes within a radius along with their square distances to the position
+	void			rangeSearch( const vec_t &position, T radius, const std::function<void(Node*,T)> &visitor ) const;
+	//! Calls visitor( Node*, T distanceSq ) with the Nodes within a radius, a visitor returning bool stops the search by returning true
+	template<class Visitor>
+	void			rangeSearch( const vec_t &position, T radius, Visitor &&visitor ) const;
+	//! Writes the k nearest Nodes within maxRadius to results, nearest first, and returns how many were found. results must hold k pairs, nothing is allocated
+	size_t			kNearest( const vec_t &position, size_t k, T maxRadius, NodePair *results ) const;
+
+	//! Returns the nearest Node for which predicate( Node* ) returns true, or nullptr if there is none. Rejected nodes don't narrow the search
+	template<class Predicate>
+	Node*			nearestNeighborSearchIf( const vec_t &position, T *distanceSq, Predicate predicate ) const;
+	//! Returns a vector of the Nodes within a radius for which predicate( Node* ) returns true
+	template<class Predicate>
+	std::vector<NodePair>	rangeSearchIf( const vec_t &position, T radius, Predicate predicate ) const;
+	//! Calls visitor with the Nodes within a radius for which predicate( Node* ) returns true, a visitor returning bool stops the search by returning true
+	template<class Predicate, class Visitor>
+	void			rangeSearchIf( const vec_t &position, T radius, Predicate predicate, Visitor &&visitor ) const;
+	//! Writes the k nearest Nodes within maxRadius for which predicate( Node* ) returns true to results, nearest first, and returns how many were found
+	template<class Predicate>
+	size_t			kNearestIf( const vec_t &position, size_t k, T maxRadius, NodePair *results, Predicate predicate ) const;
+
+	//! Returns the number of bins of the grid
+	size_t getNumBins() const { return mCellStarts.size() - 1; }
+	//! Returns the number of bins of the grid in each dimension
+	ivec_t getNumCells() const { return mNumCells; }
+	//! Returns the number of Nodes in the ith bin
+	size_t getBinSize( size_t i ) const { return mCellStarts[i + 1] - mCellStarts[i]; }
+	//! Returns the first Node of the ith bin, the bin's getBinSize( i ) Nodes are contiguous
+	const Node* getBin( size_t i ) const { return mNodes.data() + mCellStarts[i]; }
+	//! Returns the bin index at a position, positions outside of the bounds map to the nearest border bin
+	size_t getBinIndexAt( const vec_t &position ) const { return toIndex( toGridPosition( position ) ); }
+	//! Returns the size of a bin
+	T getBinsSize() const { return mCellSize; }
+
+	//! Returns the minimum of the StaticGrid
+	vec_t getMin() const { return mMin; }
+	//! Returns the maximum of the StaticGrid
+	vec_t getMax() const { return mMax; }
+
+protected:
+	template<class PositionAt, class DataAt>
+	void buildImpl( size_t count, const PositionAt &positionAt, const DataAt &dataAt );
+	ivec_t toGridPosition( const vec_t &position ) const;
+	uint32_t toIndex( const ivec_t &gridPosition ) const;
+	static bool nextRow( ivec_t *row, const ivec_t &minCell, const ivec_t &maxCell );
+	Node* getNode( uint32_t i ) const { return const_cast<Node*>( &mNodes[i] ); }
+	template<class Predicate, class Visitor>
+	bool rangeSearchImpl( const vec_t &position, T radius, Predicate &predicate, Visitor &visitor ) const;
+	template<class Predicate>
+	void kNearestImpl( uint32_t begin, uint32_t end, const vec_t &position, Predicate &predicate, details::KNearestHeap<NodePair> *heap ) const;
+
+	std::vector<uint32_t>	mCellStarts;	// first node of each cell, followed by the node count
+	std::vector<Node>	mNodes;		// positions and user data sorted by cell
+	std::vector<uint32_t>	mNodeCells;	// scratch cell of each input point used by build
+	vec_t			mMin, mMax;
+	ivec_t			mNumCells;
+	T			mCellSize, mInvCellSize;
+};
+
+// MARK: StaticGrid Impl.
+
+// https://en.wikipedia.org/wiki/Counting_sort
+// https://en.wikipedia.org/wiki/Sparse_matrix#Compressed_sparse_row_(CSR,_CRS_or_Yale_format)
+
+template<uint8_t DIM, class T, class DataT>
+StaticGrid<DIM,T,DataT>::Node::Node( const vec_t &position, const DataT &data )
+: mPosition( position ), mData( data )
+{
+}
+
+template<uint8_t DIM, class T, class DataT>
+StaticGrid<DIM,T,DataT>::StaticGrid( const vec_t &min, const vec_t &max, T cellSize )
+: mMin( min ), mMax( max ), mCellSize( cellSize ), mInvCellSize( T( 1 ) / cellSize )
+{
+	mNumCells = glm::max( ivec_t( glm::ceil( ( max - min ) * mInvCellSize ) ), ivec_t( 1 ) );
+	size_t numBins = 1;
+	for( uint8_t axis = 0; axis < DIM; ++axis )
+		numBins *= mNumCells[axis];
+	mCellStarts.assign( numBins + 1, 0 );
+}
+
+template<uint8_t DIM, class T, class DataT>
+void StaticGrid<DIM,T,DataT>::build( const vec_t *positions, const DataT *data, size_t count )
+{
+	buildImpl( count, [positions]( size_t i ) -> const vec_t& { return positions[i]; },
+		[data]( size_t i ) { return data ? data[i] : DataT(); } );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class RandomIt>
+void StaticGrid<DIM,T,DataT>::build( RandomIt first, RandomIt last )
+{
+	buildImpl( static_cast<size_t>( last - first ), [first]( size_t i ) -> const vec_t& { return first[i].first; },
+		[first]( size_t i ) -> const DataT& { return first[i].second; } );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class PositionAt, class DataAt>
+void StaticGrid<DIM,T,DataT>::buildImpl( size_t count, const PositionAt &positionAt, const DataAt &dataAt )
+{
+	// count the points falling in each cell
+	std::fill( mCellStarts.begin(), mCellStarts.end(), 0 );
+	mNodeCells.resize( count );
+	for( size_t i = 0; i < count; ++i ) {
+		const uint32_t cell = toIndex( toGridPosition( positionAt( i ) ) );
+		mNodeCells[i] = cell;
+		mCellStarts[cell]++;
+	}
+
+	// turn the counts into the end of each cell
+	const size_t numBins = getNumBins();
+	for( size_t i = 1; i < numBins; ++i )
+		mCellStarts[i] += mCellStarts[i - 1];
+	mCellStarts[numBins] = static_cast<uint32_t>( count );
+
+	// scatter back to front so that each end walks down to its cell's start and points keep their order within a cell
+	mNodes.resize( count, Node( vec_t(), DataT() ) );
+	for( size_t i = count; i-- > 0; ) {
+		const uint32_t j	= --mCellStarts[mNodeCells[i]];
+		mNodes[j].mPosition	= positionAt( i );
+		mNodes[j].mData		= dataAt( i );
+	}
+}
+template<uint8_t DIM, class T, class DataT>
+void StaticGrid<DIM,T,DataT>::clear()
+{
+	mNodes.clear();
+	std::fill( mCellStarts.begin(), mCellStarts.end(), 0 );
+}
+
+template<uint8_t DIM, class T, class DataT>
+typename StaticGrid<DIM,T,DataT>::ivec_t StaticGrid<DIM,T,DataT>::toGridPosition( const vec_t &position ) const
+{
+	// clamping before the conversion keeps far away positions from overflowing
+	return ivec_t( glm::clamp( ( position - mMin ) * mInvCellSize, vec_t( 0 ), vec_t( mNumCells - ivec_t( 1 ) ) ) );
+}
+template<uint8_t DIM, class T, class DataT>
+uint32_t StaticGrid<DIM,T,DataT>::toIndex( const ivec_t &gridPosition ) const
+{
+	uint32_t index = 0;
+	for( int axis = DIM - 1; axis >= 0; --axis )
+		index = index * mNumCells[axis] + gridPosition[axis];
+	return index;
+}
+//! Steps row to the next row of cells along the x axis within minCell and maxCell, returns false once they have all been visited
+template<uint8_t DIM, class T, class DataT>
+bool StaticGrid<DIM,T,DataT>::nextRow( ivec_t *row, const ivec_t &minCell, const ivec_t &maxCell )
+{
+	for( uint8_t axis = 1; axis < DIM; ++axis ) {
+		if( ( *row )[axis] < maxCell[axis] ) {
+			( *row )[axis]++;
+			return true;
+		}
+		( *row )[axis] = minCell[axis];
+	}
+	return false;
+}
+
+template<uint8_t DIM, class T, class DataT>
+typename StaticGrid<DIM,T,DataT>::Node* StaticGrid<DIM,T,DataT>::nearestNeighborSearch( const vec_t &position, T *distanceSq ) const
+{
+	return nearestNeighborSearchIf( position, distanceSq, details::AcceptAll() );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+typename StaticGrid<DIM,T,DataT>::Node* StaticGrid<DIM,T,DataT>::nearestNeighborSearchIf( const vec_t &position, T *distanceSq, Predicate predicate ) const
+{
+	NodePair nearest;
+	if( ! kNearestIf( position, 1, std::numeric_limits<T>::max(), &nearest, predicate ) )
+		return nullptr;
+	if( distanceSq != nullptr )
+		*distanceSq = nearest.second;
+	return nearest.first;
+}
+
+template<uint8_t DIM, class T, class DataT>
+std::vector<typename StaticGrid<DIM,T,DataT>::NodePair> StaticGrid<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius ) const
+{
+	return rangeSearchIf( position, radius, details::AcceptAll() );
+}
+template<uint8_t DIM, class T, class DataT>
+void StaticGrid<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius, const std::function<void(Node*,T)> &visitor ) const
+{
+	rangeSearchIf( position, radius, details::AcceptAll(), visitor );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Visitor>
+void StaticGrid<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius, Visitor &&visitor ) const
+{
+	rangeSearchIf( position, radius, details::AcceptAll(), std::forward<Visitor>( visitor ) );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+std::vector<typename StaticGrid<DIM,T,DataT>::NodePair> StaticGrid<DIM,T,DataT>::rangeSearchIf( const vec_t &position, T radius, Predicate predicate ) const
+{
+	std::vector<NodePair> results;
+	auto collect = [&results]( Node* node, T distanceSq ) {
+		results.emplace_back( node, distanceSq );
+	};
+	rangeSearchImpl( position, radius, predicate, collect );
+	return results;
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate, class Visitor>
+void StaticGrid<DIM,T,DataT>::rangeSearchIf( const vec_t &position, T radius, Predicate predicate, Visitor &&visitor ) const
+{
+	rangeSearchImpl( position, radius, predicate, visitor );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate, class Visitor>
+bool StaticGrid<DIM,T,DataT>::rangeSearchImpl( const vec_t &position, T radius, Predicate &predicate, Visitor &visitor ) const
+{
+	if( mNodes.empty() || ! ( radius >= 0 ) )
+		return false;
+
+	// the cells of a row along the x axis are contiguous, so each row of the box is a single range of nodes
+	const T radiusSq		= radius * radius;
+	const ivec_t minCell	= toGridPosition( position - vec_t( radius ) );
+	const ivec_t maxCell	= toGridPosition( position + vec_t( radius ) );
+	ivec_t row = minCell;
+	do {
+		const uint32_t rowStart = toIndex( row );
+		const uint32_t end = mCellStarts[rowStart + maxCell.x - minCell.x + 1];
+		for( uint32_t i = mCellStarts[rowStart]; i < end; ++i ) {
+			const T distanceSq = glm::distance2( position, mNodes[i].mPosition );
+			if( distanceSq < radiusSq && predicate( getNode( i ) ) && details::visit( visitor, getNode( i ), distanceSq ) )
+				return true;
+		}
+	} while( nextRow( &row, minCell, maxCell ) );
+	return false;
+}
+
+template<uint8_t DIM, class T, class DataT>
+size_t StaticGrid<DIM,T,DataT>::kNearest( const vec_t &position, size_t k, T maxRadius, NodePair *results ) const
+{
+	return kNearestIf( position, k, maxRadius, results, details::AcceptAll() );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+size_t StaticGrid<DIM,T,DataT>::kNearestIf( const vec_t &position, size_t k, T maxRadius, NodePair *results, Predicate predicate ) const
+{
+	if( mNodes.empty() || ! k )
+		return 0;
+
+	details::KNearestHeap<NodePair> heap( results, k, maxRadius );
+	const ivec_t lastCell	= mNumCells - ivec_t( 1 );
+	const ivec_t center		= toGridPosition( position );
+	int maxRing = 0;
+	for( uint8_t axis = 0; axis < DIM; ++axis )
+		maxRing = std::max( maxRing, std::max( center[axis], lastCell[axis] - center[axis] ) );
+
+	// visit rings of cells around the position's cell, until a ring can't hold anything nearer than the k kept so far.
+	// points outside of the bounds live in border cells but lie beyond them, so the ring distance stays a lower bound
+	for( int ring = 0; ring <= maxRing; ++ring ) {
+		const T ringDistance = static_cast<T>( std::max( ring - 1, 0 ) ) * mCellSize;
+		if( ringDistance * ringDistance > heap.bound() )
+			break;
+
+		const ivec_t minCell = glm::max( center - ivec_t( ring ), ivec_t( 0 ) );
+		const ivec_t maxCell = glm::min( center + ivec_t( ring ), lastCell );
+		ivec_t row = minCell;
+		do {
+			// rows on the border of the ring are visited whole, the others only at both ends
+			bool onRing = false;
+			for( uint8_t axis = 1; axis < DIM; ++axis )
+				onRing = onRing || std::abs( row[axis] - center[axis] ) == ring;
+			const uint32_t rowStart = toIndex( row ) - row.x;
+			if( onRing ) {
+				kNearestImpl( mCellStarts[rowStart + minCell.x], mCellStarts[rowStart + maxCell.x + 1], position, predicate, &heap );
+			}
+			else {
+				if( center.x - ring >= 0 )
+					kNearestImpl( mCellStarts[rowStart + center.x - ring], mCellStarts[rowStart + center.x - ring + 1], position, predicate, &heap );
+				if( center.x + ring <= lastCell.x )
+					kNearestImpl( mCellStarts[rowStart + center.x + ring], mCellStarts[rowStart + center.x + ring + 1], position, predicate, &heap );
+			}
+		} while( nextRow( &row, minCell, maxCell ) );
+	}
+	return heap.finish();
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+void StaticGrid<DIM,T,DataT>::kNearestImpl( uint32_t begin, uint32_t end, const vec_t &position, Predicate &predicate, details::KNearestHeap<NodePair> *heap ) const
+{
+	for( uint32_t i = begin; i < end; ++i ) {
+		const T distanceSq = glm::distance2( position, mNodes[i].mPosition );
+		if( distanceSq <= heap->bound() && predicate( getNode( i ) ) )
+			heap->push( getNode( i ), distanceSq );
+	}
+}
+
+//! Represents a 2D float compressed Grid / Bin-lattice space partitioning structure
+template<class DataT=uint32_t> using StaticGrid2 = StaticGrid<2,float,DataT>;
+//! Represents a 3D float compressed Grid / Bin-lattice space partitioning structure
+template<class DataT=uint32_t> using StaticGrid3 = StaticGrid<3,float,DataT>;
+//! Represents a 2D double compressed Grid / Bin-lattice space partitioning structure
+template<class DataT=uint32_t> using dStaticGrid2 = StaticGrid<2,double,DataT>;
+//! Represents a 3D double compressed Grid / Bin-lattice space partitioning structure
+template<class DataT=uint32_t> using dStaticGrid3 = StaticGrid<3,double,DataT>;
+
+};
+
+namespace sp = SpacePartitioning;
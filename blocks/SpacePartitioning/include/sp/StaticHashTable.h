@@ -0,0 +1,460 @@
+/*
+ StaticHashTable - Space Partitioning algorithms for Cinder
+ 
+ Copyright (c) 2016, Simon Geilfus, All rights reserved.
+ This code is intended for use with the Cinder C++ library: http://libcinder.org
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+	the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+	the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <vector>
+#include <limits>
+#include <cstdlib>
+#include <algorithm>
+#include <functional>
+#include "cinder/Vector.h"
+#include "sp/Filter.h"
+#include "sp/KNearest.h"
+#include "sp/Visitor.h"
+
+namespace SpacePartitioning {
+
+//! Represents a Spatial Hash Table over an unbounded world, rebuilt as a whole with build(). Nodes are sorted by cell into a single array and an open-addressing table maps each occupied integer cell to its range of it, so a cell lookup is a few probes in one flat array and nothing is allocated per point
+template<uint8_t DIM, class T, class DataT>
+class StaticHashTable {
+public:
+	using vec_t = typename ci::VECDIM<DIM, T>::TYPE;
+	using ivec_t = typename ci::VECDIM<DIM, int>::TYPE;
+
+	//! Constructs an empty StaticHashTable with cells of cellSize
+	StaticHashTable( const vec_t &cellSize );
+
+	//! Replaces the content of the table with count points, data can be null
+	void build( const vec_t *positions, const DataT *data, size_t count );
+	//! Replaces the content of the table with a random access range of ( position, data ) pairs
+	template<class RandomIt>
+	void build( RandomIt first, RandomIt last );
+	//! Removes all the nodes from the structure, keeping the storage allocated
+	void clear();
+	//! Returns the size of the StaticHashTable
+	size_t size() const { return mNodes.size(); }
+
+	//! Represents a single element of the StaticHashTable
+	class Node {
+	public:
+		//! Returns the position of the node
+		vec_t getPosition() const { return mPosition; }
+		//! Returns the user data
+		const DataT& getData() const { return mData; }
+
+		Node( const vec_t &position, const DataT &data );
+	protected:
+		vec_t	mPosition;
+		DataT	mData;
+		friend class StaticHashTable;
+	};
+
+	using NodePair = std::pair<Node*,T>;
+
+	//! Returns a pointer to the nearest Node with its square distance to the position, or nullptr if empty
+	Node*			nearestNeighborSearch( const vec_t &position, T *distanceSq = nullptr ) const;
+	//! Returns a vector of Nodes within a radius along with their square distances to the position
+	std::vector<NodePair>	rangeSearch( const vec_t &position, T radius ) const;
+	//! Returns a vector of Nodes within a radius along with their square distances to the position
+	void			rangeSearch( const vec_t &position, T radius, const std::function<void(Node*,T)> &visitor ) const;
+	//! Calls visitor( Node*, T distanceSq ) with the Nodes within a radius, a visitor returning bool stops the search by returning true
+	template<class Visitor>
+	void			rangeSearch( const vec_t &position, T radius, Visitor &&visitor ) const;
+	//! Writes the k nearest Nodes within maxRadius to results, nearest first, and returns how many were found. results must hold k pairs, nothing is allocated
+	size_t			kNearest( const vec_t &position, size_t k, T maxRadius, NodePair *results ) const;
+
+	//! Returns the nearest Node for which predicate( Node* ) returns true, or nullptr if there is none. Rejected nodes don't narrow the search
+	template<class Predicate>
+	Node*			nearestNeighborSearchIf( const vec_t &position, T *distanceSq, Predicate predicate ) const;
+	//! Returns a vector of the Nodes within a radius for which predicate( Node* ) returns true
+	template<class Predicate>
+	std::vector<NodePair>	rangeSearchIf( const vec_t &position, T radius, Predicate predicate ) const;
+	//! Calls visitor with the Nodes within a radius for which predicate( Node* ) returns true, a visitor returning bool stops the search by returning true
+	template<class Predicate, class Visitor>
+	void			rangeSearchIf( const vec_t &position, T radius, Predicate predicate, Visitor &&visitor ) const;
+	//! Writes the k nearest Nodes within maxRadius for which predicate( Node* ) returns true to results, nearest first, and returns how many were found
+	template<class Predicate>
+	size_t			kNearestIf( const vec_t &position, size_t k, T maxRadius, NodePair *results, Predicate predicate ) const;
+
+	//! Returns the number of occupied cells
+	size_t getNumCells() const { return mNumCells; }
+	//! Returns the size of a cell
+	vec_t getCellSize() const { return mCellSize; }
+
+protected:
+	//! Cells further than this from the origin are merged with the last one, which keeps far away positions from overflowing
+	enum : int { MAX_CELL = 1 << 28 };
+
+	//! An occupied cell and its range of nodes, the slot is empty while mEnd is 0
+	struct Slot {
+		ivec_t		mCell;
+		uint32_t	mBegin, mEnd;
+	};
+
+	template<class PositionAt, class DataAt>
+	void buildImpl( size_t count, const PositionAt &positionAt, const DataAt &dataAt );
+	ivec_t toCell( const vec_t &position ) const;
+	uint32_t findSlot( const ivec_t &cell ) const;
+	static uint32_t hash( const ivec_t &cell );
+	static bool nextRow( ivec_t *row, const ivec_t &minCell, const ivec_t &maxCell );
+	Node* getNode( uint32_t i ) const { return const_cast<Node*>( &mNodes[i] ); }
+	template<class Predicate, class Visitor>
+	bool rangeSearchImpl( const vec_t &position, T radius, Predicate &predicate, Visitor &visitor ) const;
+	template<class Predicate, class Visitor>
+	bool visitSlot( uint32_t slot, const vec_t &position, T radiusSq, Predicate &predicate, Visitor &visitor ) const;
+	template<class Predicate>
+	void kNearestImpl( uint32_t slot, const vec_t &position, Predicate &predicate, details::KNearestHeap<NodePair> *heap ) const;
+
+	std::vector<Slot>	mSlots;		// open-addressing table, a power of two in size
+	std::vector<Node>	mNodes;		// positions and user data sorted by cell
+	std::vector<uint32_t>	mNodeSlots;	// scratch slot of each input point used by build
+	vec_t			mCellSize, mInvCellSize;
+	ivec_t			mMinCell, mMaxCell;	// bounds of the occupied cells
+	uint32_t		mMask;
+	size_t			mNumCells;
+};
+
+// MARK: StaticHashTable Impl.
+
+// http://www.beosil.com/download/CollisionDetectionHashing_VMV03.pdf
+// https://en.wikipedia.org/wiki/Linear_probing
+// http://xorshift.di.unimi.it/splitmix64.c
+
+template<uint8_t DIM, class T, class DataT>
+StaticHashTable<DIM,T,DataT>::Node::Node( const vec_t &position, const DataT &data )
+: mPosition( position ), mData( data )
+{
+}
+
+template<uint8_t DIM, class T, class DataT>
+StaticHashTable<DIM,T,DataT>::StaticHashTable( const vec_t &cellSize )
+: mCellSize( cellSize ), mInvCellSize( vec_t( 1 ) / cellSize ), mMinCell( 0 ), mMaxCell( -1 ), mMask( 0 ), mNumCells( 0 )
+{
+}
+
+template<uint8_t DIM, class T, class DataT>
+void StaticHashTable<DIM,T,DataT>::build( const vec_t *positions, const DataT *data, size_t count )
+{
+	buildImpl( count, [positions]( size_t i ) -> const vec_t& { return positions[i]; },
+		[data]( size_t i ) { return data ? data[i] : DataT(); } );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class RandomIt>
+void StaticHashTable<DIM,T,DataT>::build( RandomIt first, RandomIt last )
+{
+	buildImpl( static_cast<size_t>( last - first ), [first]( size_t i ) -> const vec_t& { return first[i].first; },
+		[first]( size_t i ) -> const DataT& { return first[i].second; } );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class PositionAt, class DataAt>
+void StaticHashTable<DIM,T,DataT>::buildImpl( size_t count, const PositionAt &positionAt, const DataAt &dataAt )
+{
+	// keep the table at most half full, there can't be more occupied cells than points
+	uint32_t tableSize = 16;
+	while( tableSize < 2 * count )
+		tableSize <<= 1;
+	mSlots.assign( tableSize, Slot() );
+	mMask		= tableSize - 1;
+	mNumCells	= 0;
+	mMinCell	= ivec_t( std::numeric_limits<int>::max() );
+	mMaxCell	= ivec_t( std::numeric_limits<int>::lowest() );
+
+	// find or claim the slot of each point's cell and count the points it holds
+	mNodeSlots.resize( count );
+	for( size_t i = 0; i < count; ++i ) {
+		const ivec_t cell = toCell( positionAt( i ) );
+		uint32_t slot = hash( cell ) & mMask;
+		while( mSlots[slot].mEnd && mSlots[slot].mCell != cell )
+			slot = ( slot + 1 ) & mMask;
+		if( ! mSlots[slot].mEnd ) {
+			mSlots[slot].mCell = cell;
+			mMinCell = glm::min( mMinCell, cell );
+			mMaxCell = glm::max( mMaxCell, cell );
+			mNumCells++;
+		}
+		mSlots[slot].mEnd++;
+		mNodeSlots[i] = slot;
+	}
+
+	// lay the cells out in table order, each one starting where the previous ended
+	uint32_t end = 0;
+	for( auto &slot : mSlots ) {
+		if( slot.mEnd ) {
+			end += slot.mEnd;
+			slot.mBegin	= end;
+			slot.mEnd	= end;
+		}
+	}
+
+	// scatter back to front so that each cell's begin walks down from its end and points keep their order within a cell
+	mNodes.resize( count, Node( vec_t(), DataT() ) );
+	for( size_t i = count; i-- > 0; ) {
+		const uint32_t j	= --mSlots[mNodeSlots[i]].mBegin;
+		mNodes[j].mPosition	= positionAt( i );
+		mNodes[j].mData		= dataAt( i );
+	}
+}
+template<uint8_t DIM, class T, class DataT>
+void StaticHashTable<DIM,T,DataT>::clear()
+{
+	mNodes.clear();
+	std::fill( mSlots.begin(), mSlots.end(), Slot() );
+	mMinCell	= ivec_t( 0 );
+	mMaxCell	= ivec_t( -1 );
+	mNumCells	= 0;
+}
+
+template<uint8_t DIM, class T, class DataT>
+typename StaticHashTable<DIM,T,DataT>::ivec_t StaticHashTable<DIM,T,DataT>::toCell( const vec_t &position ) const
+{
+	return ivec_t( glm::clamp( glm::floor( position * mInvCellSize ), vec_t( -MAX_CELL ), vec_t( MAX_CELL ) ) );
+}
+//! Mixes the cell coordinates with the splitmix64 finalizer, so that neighbouring cells land far apart and the low bits can be masked
+template<uint8_t DIM, class T, class DataT>
+uint32_t StaticHashTable<DIM,T,DataT>::hash( const ivec_t &cell )
+{
+	uint64_t h = 0;
+	for( uint8_t axis = 0; axis < DIM; ++axis )
+		h = ( h << 21 | h >> 43 ) ^ static_cast<uint32_t>( cell[axis] );
+	h = ( h ^ ( h >> 30 ) ) * 0xbf58476d1ce4e5b9ull;
+	h = ( h ^ ( h >> 27 ) ) * 0x94d049bb133111ebull;
+	return static_cast<uint32_t>( h ^ ( h >> 31 ) );
+}
+//! Returns the slot of an occupied cell, or an empty slot if nothing falls in the cell
+template<uint8_t DIM, class T, class DataT>
+uint32_t StaticHashTable<DIM,T,DataT>::findSlot( const ivec_t &cell ) const
+{
+	uint32_t slot = hash( cell ) & mMask;
+	while( mSlots[slot].mEnd && mSlots[slot].mCell != cell )
+		slot = ( slot + 1 ) & mMask;
+	return slot;
+}
+//! Steps row to the next row of cells along the x axis within minCell and maxCell, returns false once they have all been visited
+template<uint8_t DIM, class T, class DataT>
+bool StaticHashTable<DIM,T,DataT>::nextRow( ivec_t *row, const ivec_t &minCell, const ivec_t &maxCell )
+{
+	for( uint8_t axis = 1; axis < DIM; ++axis ) {
+		if( ( *row )[axis] < maxCell[axis] ) {
+			( *row )[axis]++;
+			return true;
+		}
+		( *row )[axis] = minCell[axis];
+	}
+	return false;
+}
+
+template<uint8_t DIM, class T, class DataT>
+typename StaticHashTable<DIM,T,DataT>::Node* StaticHashTable<DIM,T,DataT>::nearestNeighborSearch( const vec_t &position, T *distanceSq ) const
+{
+	return nearestNeighborSearchIf( position, distanceSq, details::AcceptAll() );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+typename StaticHashTable<DIM,T,DataT>::Node* StaticHashTable<DIM,T,DataT>::nearestNeighborSearchIf( const vec_t &position, T *distanceSq, Predicate predicate ) const
+{
+	NodePair nearest;
+	if( ! kNearestIf( position, 1, std::numeric_limits<T>::max(), &nearest, predicate ) )
+		return nullptr;
+	if( distanceSq != nullptr )
+		*distanceSq = nearest.second;
+	return nearest.first;
+}
+
+template<uint8_t DIM, class T, class DataT>
+std::vector<typename StaticHashTable<DIM,T,DataT>::NodePair> StaticHashTable<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius ) const
+{
+	return rangeSearchIf( position, radius, details::AcceptAll() );
+}
+template<uint8_t DIM, class T, class DataT>
+void StaticHashTable<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius, const std::function<void(Node*,T)> &visitor ) const
+{
+	rangeSearchIf( position, radius, details::AcceptAll(), visitor );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Visitor>
+void StaticHashTable<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius, Visitor &&visitor ) const
+{
+	rangeSearchIf( position, radius, details::AcceptAll(), std::forward<Visitor>( visitor ) );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+std::vector<typename StaticHashTable<DIM,T,DataT>::NodePair> StaticHashTable<DIM,T,DataT>::rangeSearchIf( const vec_t &position, T radius, Predicate predicate ) const
+{
+	std::vector<NodePair> results;
+	auto collect = [&results]( Node* node, T distanceSq ) {
+		results.emplace_back( node, distanceSq );
+	};
+	rangeSearchImpl( position, radius, predicate, collect );
+	return results;
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate, class Visitor>
+void StaticHashTable<DIM,T,DataT>::rangeSearchIf( const vec_t &position, T radius, Predicate predicate, Visitor &&visitor ) const
+{
+	rangeSearchImpl( position, radius, predicate, visitor );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate, class Visitor>
+bool StaticHashTable<DIM,T,DataT>::rangeSearchImpl( const vec_t &position, T radius, Predicate &predicate, Visitor &visitor ) const
+{
+	if( mNodes.empty() || ! ( radius >= 0 ) )
+		return false;
+
+	const T radiusSq		= radius * radius;
+	const ivec_t minCell	= glm::max( toCell( position - vec_t( radius ) ), mMinCell );
+	const ivec_t maxCell	= glm::min( toCell( position + vec_t( radius ) ), mMaxCell );
+	if( glm::any( glm::greaterThan( minCell, maxCell ) ) )
+		return false;
+
+	// look the cells of the range up, unless there are more of them than occupied cells
+	double numRangeCells = 1;
+	for( uint8_t axis = 0; axis < DIM; ++axis )
+		numRangeCells *= static_cast<double>( maxCell[axis] - minCell[axis] + 1 );
+	if( numRangeCells > static_cast<double>( mNumCells ) ) {
+		for( uint32_t slot = 0; slot <= mMask; ++slot ) {
+			const Slot &s = mSlots[slot];
+			if( s.mEnd && ! glm::any( glm::lessThan( s.mCell, minCell ) ) && ! glm::any( glm::greaterThan( s.mCell, maxCell ) )
+				&& visitSlot( slot, position, radiusSq, predicate, visitor ) )
+				return true;
+		}
+		return false;
+	}
+
+	ivec_t row = minCell;
+	do {
+		for( ivec_t cell = row; cell.x <= maxCell.x; ++cell.x ) {
+			if( visitSlot( findSlot( cell ), position, radiusSq, predicate, visitor ) )
+				return true;
+		}
+	} while( nextRow( &row, minCell, maxCell ) );
+	return false;
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate, class Visitor>
+bool StaticHashTable<DIM,T,DataT>::visitSlot( uint32_t slot, const vec_t &position, T radiusSq, Predicate &predicate, Visitor &visitor ) const
+{
+	for( uint32_t i = mSlots[slot].mBegin, end = mSlots[slot].mEnd; i < end; ++i ) {
+		const T distanceSq = glm::distance2( position, mNodes[i].mPosition );
+		if( distanceSq < radiusSq && predicate( getNode( i ) ) && details::visit( visitor, getNode( i ), distanceSq ) )
+			return true;
+	}
+	return false;
+}
+
+template<uint8_t DIM, class T, class DataT>
+size_t StaticHashTable<DIM,T,DataT>::kNearest( const vec_t &position, size_t k, T maxRadius, NodePair *results ) const
+{
+	return kNearestIf( position, k, maxRadius, results, details::AcceptAll() );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+size_t StaticHashTable<DIM,T,DataT>::kNearestIf( const vec_t &position, size_t k, T maxRadius, NodePair *results, Predicate predicate ) const
+{
+	if( mNodes.empty() || ! k )
+		return 0;
+
+	details::KNearestHeap<NodePair> heap( results, k, maxRadius );
+	const ivec_t center = glm::clamp( toCell( position ), mMinCell, mMaxCell );
+
+	// visit rings of cells around the position's cell within the occupied bounds, nearest first
+	for( int ring = 0; ; ++ring ) {
+		// stop once the nearest point a ring could hold is further than the k kept so far, or there is no ring left
+		double numRingCells = 1;
+		if( ring > 0 ) {
+			T ringDistance	= std::numeric_limits<T>::max();
+			bool hasCells	= false;
+			for( uint8_t axis = 0; axis < DIM; ++axis ) {
+				if( center[axis] - ring >= mMinCell[axis] ) {
+					ringDistance = std::min( ringDistance, std::max( position[axis] - static_cast<T>( center[axis] - ring + 1 ) * mCellSize[axis], T( 0 ) ) );
+					hasCells = true;
+				}
+				if( center[axis] + ring <= mMaxCell[axis] ) {
+					ringDistance = std::min( ringDistance, std::max( static_cast<T>( center[axis] + ring ) * mCellSize[axis] - position[axis], T( 0 ) ) );
+					hasCells = true;
+				}
+				numRingCells *= 2 * ring + 1;
+			}
+			if( ! hasCells || ringDistance * ringDistance > heap.bound() )
+				break;
+		}
+
+		// in sparse worlds the rings can outgrow the occupied cells, then the remaining ones are scanned directly
+		if( numRingCells > static_cast<double>( mNumCells ) ) {
+			for( uint32_t slot = 0; slot <= mMask; ++slot ) {
+				const Slot &s = mSlots[slot];
+				if( s.mEnd && glm::any( glm::greaterThan( glm::abs( s.mCell - center ), ivec_t( ring - 1 ) ) ) )
+					kNearestImpl( slot, position, predicate, &heap );
+			}
+			break;
+		}
+
+		// rows along the x axis on the border of the ring are visited whole, the others only at both ends
+		const ivec_t minCell = glm::max( center - ivec_t( ring ), mMinCell );
+		const ivec_t maxCell = glm::min( center + ivec_t( ring ), mMaxCell );
+		ivec_t row = minCell;
+		do {
+			bool onRing = false;
+			for( uint8_t axis = 1; axis < DIM; ++axis )
+				onRing = onRing || std::abs( row[axis] - center[axis] ) == ring;
+			ivec_t cell = row;
+			if( onRing ) {
+				for( ; cell.x <= maxCell.x; ++cell.x )
+					kNearestImpl( findSlot( cell ), position, predicate, &heap );
+			}
+			else {
+				cell.x = center.x - ring;
+				if( cell.x >= mMinCell.x )
+					kNearestImpl( findSlot( cell ), position, predicate, &heap );
+				cell.x = center.x + ring;
+				if( cell.x <= mMaxCell.x )
+					kNearestImpl( findSlot( cell ), position, predicate, &heap );
+			}
+		} while( nextRow( &row, minCell, maxCell ) );
+	}
+	return heap.finish();
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+void StaticHashTable<DIM,T,DataT>::kNearestImpl( uint32_t slot, const vec_t &position, Predicate &predicate, details::KNearestHeap<NodePair> *heap ) const
+{
+	for( uint32_t i = mSlots[slot].mBegin, end = mSlots[slot].mEnd; i < end; ++i ) {
+		const T distanceSq = glm::distance2( position, mNodes[i].mPosition );
+		if( distanceSq <= heap->bound() && predicate( getNode( i ) ) )
+			heap->push( getNode( i ), distanceSq );
+	}
+}
+
+//! Represents a 2D float flat Spatial Hash Table partitioning structure
+template<class DataT=uint32_t> using StaticHashTable2 = StaticHashTable<2,float,DataT>;
+//! Represents a 3D float flat Spatial Hash Table partitioning structure
+template<class DataT=uint32_t> using StaticHashTable3 = StaticHashTable<3,float,DataT>;
+//! Represents a 2D double flat Spatial Hash Table partitioning structure
+template<class DataT=uint32_t> using dStaticHashTable2 = StaticHashTable<2,double,DataT>;
+//! Represents a 3D double flat Spatial Hash Table partitioning structure
+template<class DataT=uint32_t> using dStaticHashTable3 = StaticHashTable<3,double,DataT>;
+
+};
+
+namespace sp = SpacePartitioning;
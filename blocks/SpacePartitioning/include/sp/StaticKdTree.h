@@ -0,0 +1,371 @@
+/*
+ StaticKdTree - Space Partitioning algorithms for Cinder
+ 
+ Copyright (c) 2016, Simon Geilfus, All rights reserved.
+ This code is intended for use with the Cinder C++ library: http://libcinder.org
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+	the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+	the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <vector>
+#include <limits>
+#include <numeric>
+#include <algorithm>
+#include <functional>
+#include "cinder/Vector.h"
+#include "sp/Filter.h"
+#include "sp/KNearest.h"
+#include "sp/Parallel.h"
+#include "sp/Visitor.h"
+
+namespace SpacePartitioning {
+
+//! Represents a static, balanced K-D Tree stored implicitly in breadth-first order: the children of node i are 2i+1 and 2i+2 and the split axis follows from the depth. Split values are packed in their own array, apart from the positions and user data, so traversal mostly touches a dense array of scalars. The tree is rebuilt as a whole with build()
+template<uint8_t DIM, class T, class DataT>
+class StaticKdTree {
+public:
+	using vec_t = typename ci::VECDIM<DIM, T>::TYPE;
+
+	//! Replaces the content of the tree with count points, data can be null. Large inputs are built in parallel
+	void build( const vec_t *positions, const DataT *data, size_t count );
+	//! Replaces the content of the tree with ( position, data ) pairs
+	template<class InputIt>
+	void build( InputIt first, InputIt last );
+	//! Removes all the nodes from the structure, keeping the storage allocated
+	void clear();
+	//! Returns the size of the StaticKdTree
+	size_t size() const { return mNodes.size(); }
+
+	//! Represents a single element of the StaticKdTree
+	class Node {
+	public:
+		//! Returns the position of the node
+		vec_t getPosition() const { return mPosition; }
+		//! Returns the user data
+		const DataT& getData() const { return mData; }
+
+		Node( const vec_t &position, const DataT &data );
+	protected:
+		vec_t	mPosition;
+		DataT	mData;
+		friend class StaticKdTree;
+	};
+
+	using NodePair = std::pair<Node*,T>;
+
+	//! Returns a pointer to the nearest Node with its square distance to the position, or nullptr if empty
+	Node*			nearestNeighborSearch( const vec_t &position, T *distanceSq = nullptr ) const;
+	//! Returns a vector of Nodes within a radius along with their square distances to the position
+	std::vector<NodePair>	rangeSearch( const vec_t &position, T radius ) const;
+	//! Returns a vector of Nodes within a radius along with their square distances to the position
+	void			rangeSearch( const vec_t &position, T radius, const std::function<void(Node*,T)> &visitor ) const;
+	//! Calls visitor( Node*, T distanceSq ) with the Nodes within a radius, a visitor returning bool stops the search by returning true
+	template<class Visitor>
+	void			rangeSearch( const vec_t &position, T radius, Visitor &&visitor ) const;
+	//! Writes the k nearest Nodes within maxRadius to results, nearest first, and returns how many were found. results must hold k pairs, nothing is allocated
+	size_t			kNearest( const vec_t &position, size_t k, T maxRadius, NodePair *results ) const;
+
+	//! Returns the nearest Node for which predicate( Node* ) returns true, or nullptr if there is none. Rejected nodes don't narrow the search
+	template<class Predicate>
+	Node*			nearestNeighborSearchIf( const vec_t &position, T *distanceSq, Predicate predicate ) const;
+	//! Returns a vector of the Nodes within a radius for which predicate( Node* ) returns true
+	template<class Predicate>
+	std::vector<NodePair>	rangeSearchIf( const vec_t &position, T radius, Predicate predicate ) const;
+	//! Calls visitor with the Nodes within a radius for which predicate( Node* ) returns true, a visitor returning bool stops the search by returning true
+	template<class Predicate, class Visitor>
+	void			rangeSearchIf( const vec_t &position, T radius, Predicate predicate, Visitor &&visitor ) const;
+	//! Writes the k nearest Nodes within maxRadius for which predicate( Node* ) returns true to results, nearest first, and returns how many were found
+	template<class Predicate>
+	size_t			kNearestIf( const vec_t &position, size_t k, T maxRadius, NodePair *results, Predicate predicate ) const;
+
+protected:
+	//! Index of a missing result
+	enum : uint32_t { NO_NODE = 0xffffffff };
+	//! Subtrees smaller than this are built on the calling thread
+	enum : uint32_t { PARALLEL_BUILD_SIZE = 1 << 14 };
+
+	static uint32_t leftSubtreeSize( uint32_t count );
+	Node* getNode( uint32_t i ) const { return const_cast<Node*>( &mNodes[i] ); }
+	void buildImpl( const vec_t *positions, const DataT *data, uint32_t begin, uint32_t end, uint32_t index, uint32_t depth, uint32_t parallelDepth );
+	template<class Predicate>
+	void nearestNeighborSearchImpl( uint32_t index, uint32_t axis, const vec_t &position, vec_t *offsets, T offsetDistanceSq, Predicate &predicate, uint32_t *result, T *resultDistanceSq ) const;
+	template<class Predicate>
+	void kNearestImpl( uint32_t index, uint32_t axis, const vec_t &position, vec_t *offsets, T offsetDistanceSq, Predicate &predicate, details::KNearestHeap<NodePair> *heap ) const;
+	template<class Predicate, class Visitor>
+	bool rangeSearchImpl( uint32_t index, uint32_t axis, const vec_t &position, T radius, Predicate &predicate, Visitor &visitor ) const;
+
+	std::vector<T>		mSplits;	// split coordinate of each node, in breadth-first order
+	std::vector<Node>	mNodes;		// positions and user data, in the same order
+	std::vector<uint32_t>	mBuildOrder;	// scratch permutation used by build
+};
+
+// MARK: StaticKdTree Impl.
+
+// https://en.wikipedia.org/wiki/Binary_heap#Heap_implementation
+// http://www.cs.cmu.edu/~guyb/papers/BFGS18.pdf
+
+template<uint8_t DIM, class T, class DataT>
+StaticKdTree<DIM,T,DataT>::Node::Node( const vec_t &position, const DataT &data )
+: mPosition( position ), mData( data )
+{
+}
+
+//! Returns the size of the left subtree of a complete binary tree of count nodes
+template<uint8_t DIM, class T, class DataT>
+uint32_t StaticKdTree<DIM,T,DataT>::leftSubtreeSize( uint32_t count )
+{
+	if( count <= 1 )
+		return 0;
+
+	// levels above the last one are full, the last one fills from the left
+	uint32_t fullLevels = 0;
+	while( ( 2u << fullLevels ) - 1 <= count )
+		fullLevels++;
+	const uint32_t lastLevel		= count - ( ( 1u << fullLevels ) - 1 );
+	const uint32_t halfLastLevel	= 1u << ( fullLevels - 1 );
+	return ( halfLastLevel - 1 ) + std::min( lastLevel, halfLastLevel );
+}
+
+template<uint8_t DIM, class T, class DataT>
+void StaticKdTree<DIM,T,DataT>::build( const vec_t *positions, const DataT *data, size_t count )
+{
+	clear();
+	if( ! count )
+		return;
+
+	mBuildOrder.resize( count );
+	std::iota( mBuildOrder.begin(), mBuildOrder.end(), 0 );
+	mSplits.resize( count );
+	mNodes.assign( count, Node( vec_t(), DataT() ) );
+	buildImpl( positions, data, 0, static_cast<uint32_t>( count ), 0, 0, details::parallelDepth() );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class InputIt>
+void StaticKdTree<DIM,T,DataT>::build( InputIt first, InputIt last )
+{
+	std::vector<vec_t> positions;
+	std::vector<DataT> data;
+	for( ; first != last; ++first ) {
+		positions.push_back( first->first );
+		data.push_back( first->second );
+	}
+	build( positions.data(), data.data(), positions.size() );
+}
+template<uint8_t DIM, class T, class DataT>
+void StaticKdTree<DIM,T,DataT>::buildImpl( const vec_t *positions, const DataT *data, uint32_t begin, uint32_t end, uint32_t index, uint32_t depth, uint32_t parallelDepth )
+{
+	// split so that the tree stays complete, the median for a full tree
+	const uint32_t axis = depth % DIM;
+	uint32_t* order = mBuildOrder.data();
+	const uint32_t mid = begin + leftSubtreeSize( end - begin );
+	std::nth_element( order + begin, order + mid, order + end, [positions, axis]( uint32_t a, uint32_t b ) {
+		return positions[a][axis] < positions[b][axis];
+	} );
+
+	const vec_t &position	= positions[order[mid]];
+	mSplits[index]			= position[axis];
+	mNodes[index]			= Node( position, data ? data[order[mid]] : DataT() );
+
+	const uint32_t childDepth = parallelDepth ? parallelDepth - 1 : 0;
+	details::parallelInvoke( parallelDepth > 0 && end - begin >= PARALLEL_BUILD_SIZE,
+		[=] { if( mid > begin ) buildImpl( positions, data, begin, mid, 2 * index + 1, depth + 1, childDepth ); },
+		[=] { if( end > mid + 1 ) buildImpl( positions, data, mid + 1, end, 2 * index + 2, depth + 1, childDepth ); } );
+}
+template<uint8_t DIM, class T, class DataT>
+void StaticKdTree<DIM,T,DataT>::clear()
+{
+	mSplits.clear();
+	mNodes.clear();
+}
+
+template<uint8_t DIM, class T, class DataT>
+typename StaticKdTree<DIM,T,DataT>::Node* StaticKdTree<DIM,T,DataT>::nearestNeighborSearch( const vec_t &position, T *distanceSq ) const
+{
+	return nearestNeighborSearchIf( position, distanceSq, details::AcceptAll() );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+typename StaticKdTree<DIM,T,DataT>::Node* StaticKdTree<DIM,T,DataT>::nearestNeighborSearchIf( const vec_t &position, T *distanceSq, Predicate predicate ) const
+{
+	if( mNodes.empty() )
+		return nullptr;
+
+	uint32_t result	= NO_NODE;
+	T dSq			= std::numeric_limits<T>::max();
+	vec_t offsets	= vec_t( 0 );
+	nearestNeighborSearchImpl( 0, 0, position, &offsets, 0, predicate, &result, &dSq );
+	if( result == NO_NODE )
+		return nullptr;
+	if( distanceSq )
+		*distanceSq = dSq;
+
+	return getNode( result );
+}
+// offsets holds the distance from the position to the current cell along each axis, offsetDistanceSq their square length
+// http://www.cs.umd.edu/~mount/Papers/DCC_93_kdtree.pdf
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+void StaticKdTree<DIM,T,DataT>::nearestNeighborSearchImpl( uint32_t index, uint32_t axis, const vec_t &position, vec_t *offsets, T offsetDistanceSq, Predicate &predicate, uint32_t *result, T *resultDistanceSq ) const
+{
+	const uint32_t count	= static_cast<uint32_t>( mNodes.size() );
+	const T d				= position[axis] - mSplits[index];
+	const uint32_t nearest	= 2 * index + ( d <= 0 ? 1 : 2 );
+	const uint32_t furthest	= 2 * index + ( d <= 0 ? 2 : 1 );
+	const uint32_t childAxis	= ( axis + 1 ) % DIM;
+
+	// recursively search into the nearest sub-tree
+	if( nearest < count )
+		nearestNeighborSearchImpl( nearest, childAxis, position, offsets, offsetDistanceSq, predicate, result, resultDistanceSq );
+
+	// update distances, rejected nodes never tighten the search
+	T distanceSq = glm::distance2( mNodes[index].mPosition, position );
+	if( distanceSq < *resultDistanceSq && predicate( getNode( index ) ) ) {
+		*result = index;
+		*resultDistanceSq = distanceSq;
+	}
+
+	// the furthest sub-tree can only help if its cell is closer than the best so far
+	if( furthest < count ) {
+		const T offset = ( *offsets )[axis];
+		const T furthestDistanceSq = offsetDistanceSq - offset * offset + d * d;
+		if( furthestDistanceSq < *resultDistanceSq ) {
+			( *offsets )[axis] = d;
+			nearestNeighborSearchImpl( furthest, childAxis, position, offsets, furthestDistanceSq, predicate, result, resultDistanceSq );
+			( *offsets )[axis] = offset;
+		}
+	}
+}
+
+template<uint8_t DIM, class T, class DataT>
+std::vector<typename StaticKdTree<DIM,T,DataT>::NodePair> StaticKdTree<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius ) const
+{
+	return rangeSearchIf( position, radius, details::AcceptAll() );
+}
+template<uint8_t DIM, class T, class DataT>
+void StaticKdTree<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius, const std::function<void(Node*,T)> &visitor ) const
+{
+	rangeSearchIf( position, radius, details::AcceptAll(), visitor );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Visitor>
+void StaticKdTree<DIM,T,DataT>::rangeSearch( const vec_t &position, T radius, Visitor &&visitor ) const
+{
+	rangeSearchIf( position, radius, details::AcceptAll(), std::forward<Visitor>( visitor ) );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+std::vector<typename StaticKdTree<DIM,T,DataT>::NodePair> StaticKdTree<DIM,T,DataT>::rangeSearchIf( const vec_t &position, T radius, Predicate predicate ) const
+{
+	std::vector<NodePair> results;
+	if( ! mNodes.empty() ) {
+		auto collect = [&results]( Node* node, T distanceSq ) {
+			results.emplace_back( node, distanceSq );
+		};
+		rangeSearchImpl( 0, 0, position, radius, predicate, collect );
+	}
+	return results;
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate, class Visitor>
+void StaticKdTree<DIM,T,DataT>::rangeSearchIf( const vec_t &position, T radius, Predicate predicate, Visitor &&visitor ) const
+{
+	if( ! mNodes.empty() )
+		rangeSearchImpl( 0, 0, position, radius, predicate, visitor );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate, class Visitor>
+bool StaticKdTree<DIM,T,DataT>::rangeSearchImpl( uint32_t index, uint32_t axis, const vec_t &position, T radius, Predicate &predicate, Visitor &visitor ) const
+{
+	const uint32_t count = static_cast<uint32_t>( mNodes.size() );
+	if( index >= count )
+		return false;
+
+	// if node is within the range and accepted add it to the results
+	T distanceSq = glm::distance2( mNodes[index].mPosition, position );
+	if( distanceSq <= radius * radius && predicate( getNode( index ) ) && details::visit( visitor, getNode( index ), distanceSq ) ) {
+		return true;
+	}
+
+	// recursively check the first child, then the other one if the range crosses the split
+	const T dx = position[axis] - mSplits[index];
+	const uint32_t childAxis = ( axis + 1 ) % DIM;
+	if( rangeSearchImpl( 2 * index + ( dx <= 0 ? 1 : 2 ), childAxis, position, radius, predicate, visitor ) )
+		return true;
+	return glm::abs( dx ) < radius && rangeSearchImpl( 2 * index + ( dx <= 0 ? 2 : 1 ), childAxis, position, radius, predicate, visitor );
+}
+
+template<uint8_t DIM, class T, class DataT>
+size_t StaticKdTree<DIM,T,DataT>::kNearest( const vec_t &position, size_t k, T maxRadius, NodePair *results ) const
+{
+	return kNearestIf( position, k, maxRadius, results, details::AcceptAll() );
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+size_t StaticKdTree<DIM,T,DataT>::kNearestIf( const vec_t &position, size_t k, T maxRadius, NodePair *results, Predicate predicate ) const
+{
+	if( mNodes.empty() || ! k )
+		return 0;
+
+	details::KNearestHeap<NodePair> heap( results, k, maxRadius );
+	vec_t offsets = vec_t( 0 );
+	kNearestImpl( 0, 0, position, &offsets, 0, predicate, &heap );
+	return heap.finish();
+}
+template<uint8_t DIM, class T, class DataT>
+template<class Predicate>
+void StaticKdTree<DIM,T,DataT>::kNearestImpl( uint32_t index, uint32_t axis, const vec_t &position, vec_t *offsets, T offsetDistanceSq, Predicate &predicate, details::KNearestHeap<NodePair> *heap ) const
+{
+	// same traversal as the nearest neighbor search, pruning against the farthest of the k kept so far
+	const uint32_t count	= static_cast<uint32_t>( mNodes.size() );
+	const T d				= position[axis] - mSplits[index];
+	const uint32_t nearest	= 2 * index + ( d <= 0 ? 1 : 2 );
+	const uint32_t furthest	= 2 * index + ( d <= 0 ? 2 : 1 );
+	const uint32_t childAxis	= ( axis + 1 ) % DIM;
+
+	if( nearest < count )
+		kNearestImpl( nearest, childAxis, position, offsets, offsetDistanceSq, predicate, heap );
+
+	T distanceSq = glm::distance2( mNodes[index].mPosition, position );
+	if( distanceSq <= heap->bound() && predicate( getNode( index ) ) )
+		heap->push( getNode( index ), distanceSq );
+
+	if( furthest < count ) {
+		const T offset = ( *offsets )[axis];
+		const T furthestDistanceSq = offsetDistanceSq - offset * offset + d * d;
+		if( furthestDistanceSq <= heap->bound() ) {
+			( *offsets )[axis] = d;
+			kNearestImpl( furthest, childAxis, position, offsets, furthestDistanceSq, predicate, heap );
+			( *offsets )[axis] = offset;
+		}
+	}
+}
+
+//! Represents a 2D float static K-D Tree space partitioning structure
+template<class DataT=uint32_t> using StaticKdTree2 = StaticKdTree<2,float,DataT>;
+//! Represents a 3D float static K-D Tree space partitioning structure
+template<class DataT=uint32_t> using StaticKdTree3 = StaticKdTree<3,float,DataT>;
+//! Represents a 2D double static K-D Tree space partitioning structure
+template<class DataT=uint32_t> using dStaticKdTree2 = StaticKdTree<2,double,DataT>;
+//! Represents a 3D double static K-D Tree space partitioning structure
+template<class DataT=uint32_t> using dStaticKdTree3 = StaticKdTree<3,double,DataT>;
+
+};
+
+namespace sp = SpacePartitioning;
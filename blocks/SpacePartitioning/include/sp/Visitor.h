@@ -0,0 +1,58 @@
+/*
+ Visitor - Space Partitioning algorithms for Cinder
+ 
+ Copyright (c) 2016, Simon Geilfus, All rights reserved.
+ This code is intended for use with the Cinder C++ library: http://libcinder.org
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+	the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+	the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <type_traits>
+#include <utility>
+
+namespace SpacePartitioning {
+
+namespace details {
+
+template<class Visitor, class... Args>
+bool invokeVisitor( std::false_type, Visitor &visitor, Args&&... args )
+{
+	visitor( std::forward<Args>( args )... );
+	return false;
+}
+template<class Visitor, class... Args>
+bool invokeVisitor( std::true_type, Visitor &visitor, Args&&... args )
+{
+	return static_cast<bool>( visitor( std::forward<Args>( args )... ) );
+}
+
+//! Calls visitor( args... ) and returns true if it asked the search to stop. Visitors returning void never stop, visitors returning bool stop by returning true
+template<class Visitor, class... Args>
+bool visit( Visitor &visitor, Args&&... args )
+{
+	using ReturnsBool = std::is_convertible<decltype( visitor( std::forward<Args>( args )... ) ), bool>;
+	return invokeVisitor( ReturnsBool(), visitor, std::forward<Args>( args )... );
+}
+
+} // namespace details
+
+};
+
+namespace sp = SpacePartitioning;
@@ -1,8 +1,13 @@
 // ArriveApp.cpp
 // Callum Howard, 2017
 
+#include <algorithm>                // find, all_of
+#include <cctype>                   // isdigit
 #include <cmath>                    // round
 #include <functional>               // bind, placeholder
+#include <iterator>                 // next
+#include <stdexcept>                // out_of_range
+#include <string>                   // stoul
 #include "cinder/app/App.h"
 #include "cinder/app/RendererGl.h"
 #include "cinder/gl/gl.h"
@@ -14,6 +19,7 @@
 #include "CommsManager.hpp"
 #include "Background.hpp"
 #include "Ecosystem.hpp"
+#include "MassEcosystem.hpp"
 
 using namespace ci;
 using namespace ci::app;
@@ -44,6 +50,8 @@ public:
     void draw() override;
 
 private:
+    bool runMassive();
+
     void zoomChange(float amount) {
         mZoom = constrain(mZoom + amount, mZoomMin, mZoomMax);
     };
@@ -59,7 +67,7 @@ private:
 
     // debug gui
     int mFramerate;
-    int mFittestLifetime;
+    int mFittestLifetime = 0;
     //params::InterfaceGl mParams;
 
     vec2 mDebugPoint;
@@ -72,6 +80,9 @@ private:
 
 
 void ArsAnimaApp::setup() {
+    // headless benchmark run, e.g. --massive 1000000 100
+    if (runMassive()) { quit(); return; }
+
     // viewport parameters setup
     mOffset = vec2{};
     mCursor = vec2{getWindowCenter()};
@@ -110,6 +121,13 @@ void ArsAnimaApp::setup() {
 
     // set up virtual world
     mEcosystem.setup();
+    mEcosystem.subscribe([this] (const ch::EcosystemEvents& events) {
+        for (const auto& death : events.deaths) {
+            if (death.lifetime <= static_cast<ch::Tick>(mFittestLifetime)) { continue; }
+            mFittestLifetime = static_cast<int>(death.lifetime);
+            CI_LOG_I("new fittest lifetime: " << mFittestLifetime << " at tick " << events.tick);
+        }
+    });
     mBackground.setup(getWindowWidth(), getWindowHeight());
 
     // set up comms
@@ -182,6 +200,41 @@ void ArsAnimaApp::prepareSettings(ArsAnimaApp::Settings *settings) {
 	settings->setMultiTouchEnabled(true);
 }
 
+// parses a strictly positive decimal count, anything else is rejected
+static bool parseCount(const string& arg, unsigned long* count) {
+    if (arg.empty() or not all_of(arg.cbegin(), arg.cend(),
+            [] (char c) { return isdigit(static_cast<unsigned char>(c)); })) { return false; }
+    try {
+        *count = stoul(arg);
+    } catch (const out_of_range&) {
+        return false;
+    }
+    return *count > 0;
+}
+
+bool ArsAnimaApp::runMassive() {
+    const auto& args = getCommandLineArgs();
+    const auto flag = std::find(args.cbegin(), args.cend(), "--massive");
+    if (flag == args.cend()) { return false; }
+
+    auto numVehicles = 0ul;
+    auto numTicks = 100ul;
+    if (std::next(flag) == args.cend() or not parseCount(*std::next(flag), &numVehicles) or
+            (std::next(flag, 2) != args.cend() and
+            not parseCount(*std::next(flag, 2), &numTicks))) {
+        CI_LOG_E("usage: --massive <vehicles> [ticks], both positive integers");
+        return true;
+    }
+
+    auto massEcosystem = ch::MassEcosystem{};
+    massEcosystem.setup(numVehicles, numVehicles);
+    const auto ticksPerSecond = massEcosystem.run(numTicks);
+    CI_LOG_I("massive: " << numVehicles << " vehicles, " << numTicks << " ticks, "
+            << ticksPerSecond << " ticks/sec, fittest lifetime "
+            << massEcosystem.getFittestLifetime());
+    return true;
+}
+
 void ArsAnimaApp::mouseDown(MouseEvent event) {
     if (not getWindow()->getUserData<WindowData>()->isPrimary) { return; };
     const vec2 pos = event.getPos();
@@ -305,6 +358,15 @@ void ArsAnimaApp::keyDown(KeyEvent event) {
         case KeyEvent::KEY_ESCAPE: quit(); break;
         case KeyEvent::KEY_SPACE: mEcosystem.setMode(ch::PAN_VIEW); break;
         case KeyEvent::KEY_f: setFullScreen(not isFullScreen()); break;
+        case KeyEvent::KEY_s:
+            mEcosystem.setSpatialBackend(static_cast<ch::SpatialBackend>(
+                    (mEcosystem.getSpatialBackend() + 1) % ch::NUM_SPATIAL_BACKENDS));
+            CI_LOG_I("spatial structure: " << mEcosystem.getSpatialBackendName());
+            break;
+        case KeyEvent::KEY_t:
+            mEcosystem.setSpatialAutoTune(not mEcosystem.getSpatialAutoTune());
+            CI_LOG_I("spatial auto tune: " << mEcosystem.getSpatialAutoTune());
+            break;
     }
 }
 
@@ -320,8 +382,6 @@ void ArsAnimaApp::update() {
         mCommsManager.generateEvent();
         mEcosystem.setMode(ch::PAN_VIEW);
     }
-
-    mFittestLifetime = static_cast<int>(mEcosystem.getFittestLifetime());
 }
 
 void ArsAnimaApp::draw() {
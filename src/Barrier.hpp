@@ -5,6 +5,7 @@
 #define BARRIER_HPP
 
 #include "cinder/app/App.h"             // MouseEvent
+#include "sp/BSPTree.h"
 #include "chGlobals.hpp"                // Tick
 #include "chUtils.hpp"                  // midpoint, intersects, intersectionPoint
 #include "Particle.hpp"
@@ -24,6 +25,8 @@ public:
     void setMode(ch::Mode mode);
     bool isFocused() const;
     bool isActive() const { return mActive; }
+    vec2 getFirst() const { return bPosition + mFirst.getPosition(); }
+    vec2 getSecond() const { return bPosition + mSecond.getPosition(); }
 
     bool hasCrossed(const vec2& oldPos, const vec2& newPos) const;
     vec2 intersectionPoint(const vec2& oldPos, const vec2& newPos) const;
@@ -148,6 +151,9 @@ private:
     bool mActive = true;
 };
 
+// the barriers' segments, for line of sight and collision tests
+using BarrierTree = sp::BSPTree2<const Barrier*>;
+
 Barrier::Barrier(Tick currentTick, const vec2& first = vec2{}, const vec2& second = vec2{}) :
         Particle{5.0f, midpoint(first, second), currentTick},
         mFirst{currentTick, bSize * 2.0f, first},
@@ -257,13 +263,11 @@ void Barrier::setMode(ch::Mode mode) {
 }
 
 inline bool Barrier::hasCrossed(const vec2& oldPos, const vec2& newPos) const {
-    return intersects(oldPos, newPos,
-            bPosition + mFirst.getPosition(), bPosition + mSecond.getPosition());
+    return intersects(oldPos, newPos, getFirst(), getSecond());
 }
 
 inline vec2 Barrier::intersectionPoint(const vec2& oldPos, const vec2& newPos) const {
-    return getIntersection(oldPos, newPos,
-            bPosition + mFirst.getPosition(), bPosition + mSecond.getPosition());
+    return getIntersection(oldPos, newPos, getFirst(), getSecond());
 }
 
 inline vec2 Barrier::reflectNormal(const vec2& incident) const {
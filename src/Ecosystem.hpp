@@ -7,16 +7,18 @@
 #include <cassert>
 #include <vector>
 #include <limits>                       // numeric_limits
-#include <algorithm>                    // generate_n, sort, any_of, find_if, min_element, remove_if
+#include <algorithm>                    // generate_n, any_of, find_if, min_element, remove_if
+#include <chrono>                       // steady_clock
 #include "cinder/gl/gl.h"
 #include "cinder/app/App.h"             // MouseEvent, getWindowWidth, getWindowHeight
-#include "sp/Grid.h"
-#include "sp/KdTree.h"
+#include "sp/Batch.h"                   // nearestNeighborSearchBatch
 #include "chUtils.hpp"                  // makeRandPoint, distance
 #include "chGlobals.hpp"                // Tick
 #include "Circle.hpp"
 #include "Vehicle.hpp"
 #include "Barrier.hpp"
+#include "ParticleIndex.hpp"
+#include "EcosystemEvents.hpp"
 
 namespace ch {
 
@@ -39,12 +41,22 @@ public:
     Mode getMode() const { return mMode; }
     Tick getFittestLifetime() const { return mFittestLifetime; }
     void puffVehicles(int midiChannel);
+    void subscribe(const EventSubscriber& subscriber) { mSubscribers.push_back(subscriber); }
+    void setSpatialBackend(SpatialBackend backend) { mParticleIndex.setBackend(backend); }
+    SpatialBackend getSpatialBackend() const { return mParticleIndex.getBackend(); }
+    const char* getSpatialBackendName() const {
+        return mParticleIndex.getBackendName(mParticleIndex.getBackend());
+    }
+    void setSpatialAutoTune(bool autoTune) { mParticleIndex.setAutoTune(autoTune); }
+    bool getSpatialAutoTune() const { return mParticleIndex.getAutoTune(); }
 
     Color mVehicleColor = Color{0.1f, 0.4f, 0.1f};
 
 private:
-    void updateVehicles();
+    template<class SpatialStruct> double updateVehicles(const SpatialStruct& spatialStruct);
+    std::vector<ParticleIndex::Entry> snapshotParticles();
     bool isOccluded(const Vehicle& v, const vec2& target);
+    void updateBarrierTree();
     vec2 chooseSpawn() const;
 
     Mode mMode = PAN_VIEW;
@@ -59,12 +71,15 @@ private:
     std::vector<Circle> mFood;
     std::vector<Vehicle> mVehicles;
     std::vector<Barrier> mBarriers;
+    BarrierTree mBarrierTree;  // the nth barrier has handle n
     boost::circular_buffer<Circle> mCorpses;
     boost::circular_buffer<vec2> mFoodSpawns;
 
-    //using SpatialStruct = sp::Grid2<Particle*>;
-    using SpatialStruct = sp::KdTree2<Particle*>;
-    SpatialStruct mParticleSpatialStruct;
+    EcosystemEvents mEvents;  // raised during the current tick
+    std::vector<EventSubscriber> mSubscribers;
+
+    ParticleIndex mParticleIndex;
+    bool mParticleIndexDirty = true;  // particles edited since the last snapshot
 
     gl::BatchRef mBatchPrimary;
     gl::BatchRef mBatchSecondary;
@@ -89,7 +104,9 @@ void Ecosystem::setup() {
 
     std::generate_n(std::back_inserter(mFoodSpawns), mMaxFoodSpawns, makeRandPoint);
 
-    mParticleSpatialStruct = SpatialStruct{};
+    mParticleIndex.setup(Rectf{0.0f, 0.0f,
+            static_cast<float>(getWindowWidth()), static_cast<float>(getWindowHeight())},
+            mVehicles.size());
 
     // create a default shader with color and texture support
     mShader = gl::context()->getStockShader(gl::ShaderDef().color());
@@ -104,14 +121,11 @@ void Ecosystem::setup() {
 }
 
 void Ecosystem::update() {
-    // update the grid
-    mParticleSpatialStruct.clear();
-    for (auto& particle : mFood) {
-        mParticleSpatialStruct.insert(particle.getPosition(), &particle);
-    }
-    for (auto& particle : mCorpses) {
-        if (not particle.isActive()) { continue; }
-        mParticleSpatialStruct.insert(particle.getPosition(), &particle);
+    // swap in the structure built while the last frame rendered, unless the
+    // particles were edited since or there is nothing to swap in yet
+    if (mParticleIndexDirty or not mParticleIndex.swap()) {
+        mParticleIndex.rebuild(snapshotParticles());
+        mParticleIndexDirty = false;
     }
 
     // find and replace oldest food to keep circulation going
@@ -123,7 +137,12 @@ void Ecosystem::update() {
         *found = Circle{mTickCount, 3.0f, addNoise(chooseSpawn(), 180.0f)};
     }
 
-    updateVehicles();
+    updateBarrierTree();
+
+    auto querySeconds = 0.0;
+    mParticleIndex.visit([this, &querySeconds] (const auto& spatialStruct) {
+        querySeconds = this->updateVehicles(spatialStruct);
+    });
 
     for (auto& barrier : mBarriers) {
         barrier.setMode(mMode);
@@ -134,16 +153,56 @@ void Ecosystem::update() {
             [](const auto& barrier) { return not barrier.isActive(); });
     if (to_erase != std::end(mBarriers)) { mBarriers.erase(to_erase); }
 
+    // build next tick's structure in the background while this frame renders,
+    // after the tuner has picked which structure that is
+    mParticleIndex.endTick(querySeconds);
+    mParticleIndex.beginRebuild(snapshotParticles());
+
+    // hand this tick's events to subscribers in one batch
+    for (const auto& subscriber : mSubscribers) { subscriber(mEvents); }
+
     // update ecosystem tick count
     ++mTickCount;
     assert(mTickCount != std::numeric_limits<Tick>::max());
+    mEvents.clear(mTickCount);
+}
+
+std::vector<ParticleIndex::Entry> Ecosystem::snapshotParticles() {
+    auto entries = std::vector<ParticleIndex::Entry>{};
+    entries.reserve(mFood.size() + mCorpses.size());
+    for (auto& particle : mFood) {
+        entries.emplace_back(particle.getPosition(), &particle);
+    }
+    for (auto& particle : mCorpses) {
+        if (not particle.isActive()) { continue; }
+        entries.emplace_back(particle.getPosition(), &particle);
+    }
+    return entries;
 }
 
-void Ecosystem::updateVehicles() {
+// returns the time spent querying the spatial structure in seconds
+template<class SpatialStruct>
+double Ecosystem::updateVehicles(const SpatialStruct& spatialStruct) {
 
     Vehicle* reproReady = nullptr;
 
-    for (auto& vehicle : mVehicles) {
+    // every vehicle's optimistic nearest food in one batch, so that nearby
+    // vehicles share the walk down the structure. Neither the structure nor
+    // the other vehicles move during the loop, so each vehicle gets what its
+    // own query would have found
+    const auto batchStart = std::chrono::steady_clock::now();
+    auto positions = std::vector<vec2>{};
+    positions.reserve(mVehicles.size());
+    for (const auto& vehicle : mVehicles) { positions.push_back(vehicle.getPosition()); }
+    auto nearestNodes = std::vector<typename SpatialStruct::Node*>(positions.size());
+    auto nearestDistancesSquared = std::vector<float>(positions.size());
+    sp::nearestNeighborSearchBatch(spatialStruct, positions.data(), positions.size(),
+            nearestNodes.data(), nearestDistancesSquared.data());
+    auto querySeconds = std::chrono::duration<double>{
+            std::chrono::steady_clock::now() - batchStart}.count();
+
+    for (size_t i = 0; i < mVehicles.size(); ++i) {
+        auto& vehicle = mVehicles[i];
         if (vehicle.readyToReproduce() and (reproReady == nullptr or
                 vehicle.getBirthTick() < reproReady->getBirthTick())) {
             reproReady = &vehicle;
@@ -154,13 +213,16 @@ void Ecosystem::updateVehicles() {
             if (lifetime > mFittestLifetime) { mFittestLifetime = lifetime; }
 
             // place a corpse at its last position
-            if (mTickCount - vehicle.getBirthTick() > 300 or vehicle.getIsChild()) {
+            const auto leftCorpse = lifetime > 300 or vehicle.getIsChild();
+            if (leftCorpse) {
                 mCorpses.push_back(
                         Circle{mTickCount, 5.0f, vehicle.getPosition(), Circle::CORPSE});
             }
+            mEvents.deaths.push_back(DeathEvent{vehicle.getPosition(), lifetime, leftCorpse});
 
             // spawn a new vehicle in its place
-            if (reproReady != nullptr) {
+            const auto isMitosis = reproReady != nullptr;
+            if (isMitosis) {
                 vehicle = Vehicle{mTickCount, reproReady->getPosition(), mVehicleColor};
                 vehicle.setIsChild();  // they will have corpse
                 reproReady->setIsChild();
@@ -172,6 +234,8 @@ void Ecosystem::updateVehicles() {
                 if (randFloat(0, 1) < 0.4f and
                         mTickCount - reproReady->getBirthTick() > 250) {
                     vehicle.setColor(vehicle.getColor() + randVec3() * vec3{0.7, 0.8, 0.5});
+                    mEvents.mutations.push_back(MutationEvent{vehicle.getPosition(),
+                            reproReady->getColor(), vehicle.getColor()});
                 }
 
                 // split energy evenly between parent and child (mitosis)
@@ -183,11 +247,14 @@ void Ecosystem::updateVehicles() {
             } else {  // make new child at initial spawn area
                 vehicle = Vehicle{mTickCount, makeRandPoint(), mVehicleColor};
             }
+            mEvents.births.push_back(
+                    BirthEvent{vehicle.getPosition(), vehicle.getColor(), isMitosis});
 
             continue;
         }
 
         // find a target to seek
+        const auto queryStart = std::chrono::steady_clock::now();
 
         // in case a nearest neighbor can't be found
         auto fallbackTarget = Circle{mTickCount, 0.0f, makeRandPoint()};
@@ -198,9 +265,8 @@ void Ecosystem::updateVehicles() {
         float distanceSquared = distance(vehicle.getPosition(), fallbackTarget.getPosition());
 
         // optimistically do quick look for nearest neighbor
-        float optimisticDistanceSquared;
-        auto nn = mParticleSpatialStruct.nearestNeighborSearch(
-               vehicle.getPosition(), &optimisticDistanceSquared);
+        const auto optimisticDistanceSquared = nearestDistancesSquared[i];
+        const auto nn = nearestNodes[i];
         Circle* optimisticNearestFoodRef = static_cast<Circle *>(nn->getData());
 
         // if it is within line of sight then optimistic is a good choice
@@ -208,34 +274,26 @@ void Ecosystem::updateVehicles() {
             nearestFoodRef = optimisticNearestFoodRef;
             distanceSquared = optimisticDistanceSquared;
 
-        } else {  // try and find another target
-            auto neighbors = mParticleSpatialStruct.rangeSearch(
-                    vehicle.getPosition(), vehicle.getSightDist());
-
-            // order by smallest distance first
-            sort(neighbors.begin(), neighbors.end(),
-                    [] (const auto& lhs, const auto& rhs) {
-                        return lhs.second < rhs.second;
-                    });
-
-            for (const auto& neighbor : neighbors) {
-                const auto node = neighbor.first;
-                const auto distSq = neighbor.second;
-
-                // if line of sight to neighbor is occluded, try another neighbor
-                if (isOccluded(vehicle, node->getPosition())) { continue; }
-
-                // a good target has been found, stop searching
-                nearestFoodRef = static_cast<Circle*>(node->getData());
-                distanceSquared = distSq;
-                break;
+        } else {  // find the nearest target in sight that isn't occluded
+            const auto isVisible = [this, &vehicle] (const auto* node) {
+                return not isOccluded(vehicle, node->getPosition());
+            };
+            typename SpatialStruct::NodePair visible;
+            if (spatialStruct.kNearestIf(vehicle.getPosition(), 1,
+                    vehicle.getSightDist(), &visible, isVisible)) {
+                nearestFoodRef = static_cast<Circle*>(visible.first->getData());
+                distanceSquared = visible.second;
             }
         }
+        querySeconds += std::chrono::duration<double>{
+                std::chrono::steady_clock::now() - queryStart}.count();
 
         // carry out vehicle actions
         const auto size = vehicle.getSize();
         if (distanceSquared < size * size) {
             vehicle.eat(nearestFoodRef->getEnergy());
+            mEvents.eats.push_back(EatEvent{nearestFoodRef->getPosition(),
+                    nearestFoodRef->getEnergy(), nearestFoodRef->getType() == Circle::CORPSE});
             switch (nearestFoodRef->getType()) {
             case Circle::FOOD:
                 if (not mFoodSpawns.empty() and randBool()) {
@@ -256,12 +314,17 @@ void Ecosystem::updateVehicles() {
             vehicle.arrive(vehicle.getPosition() +
                     400.0f * randVec2());
         }
-        vehicle.update(mBarriers);
+        if (vehicle.update(mBarrierTree)) {
+            mEvents.barrierHits.push_back(BarrierHitEvent{vehicle.getPosition()});
+        }
     }
+
+    return querySeconds;
 }
 
 void Ecosystem::puffVehicles(int midiChannel) {
     for (auto& vehicle : mVehicles) { vehicle.puff(midiChannel); }
+    mEvents.puffs.push_back(PuffEvent{midiChannel});
 }
 
 void Ecosystem::mouseDown(const vec2& mousePos) {
@@ -289,6 +352,7 @@ void Ecosystem::mouseDown(const vec2& mousePos) {
                     });
             // add food at mouse, replace oldest food
             *found = Circle{mTickCount, 3.0f, mousePos};
+            mParticleIndexDirty = true;
             break;
         }
     default:
@@ -330,10 +394,29 @@ void Ecosystem::setMode(Mode m) {
 }
 
 bool Ecosystem::isOccluded(const Vehicle& v, const vec2& target) {
-    return any_of(mBarriers.cbegin(), mBarriers.cend(),
-          [&v, &target] (const Barrier& b) {
-              return b.hasCrossed(v.getPosition(), target);
-          });
+    return mBarrierTree.segmentIntersectsAny(v.getPosition(), target);
+}
+
+// brings the tree in line with the barriers, only the ones added, dragged or
+// removed since the last tick touch it. Barriers may have been reallocated, so
+// every segment's pointer is refreshed
+void Ecosystem::updateBarrierTree() {
+    using Handle = BarrierTree::Handle;
+    const auto numKept = std::min(mBarrierTree.size(), mBarriers.size());
+    for (size_t i = 0; i < numKept; ++i) {
+        const auto& barrier = mBarriers[i];
+        const auto* segment = mBarrierTree.getSegment(static_cast<Handle>(i));
+        if (segment->getA() != barrier.getFirst() or segment->getB() != barrier.getSecond()) {
+            mBarrierTree.move(static_cast<Handle>(i), barrier.getFirst(), barrier.getSecond());
+        }
+        mBarrierTree.setData(static_cast<Handle>(i), &barrier);
+    }
+    for (auto i = mBarrierTree.size(); i > mBarriers.size(); --i) {
+        mBarrierTree.remove(static_cast<Handle>(i - 1));
+    }
+    for (auto i = numKept; i < mBarriers.size(); ++i) {
+        mBarrierTree.insert(mBarriers[i].getFirst(), mBarriers[i].getSecond(), &mBarriers[i]);
+    }
 }
 
 vec2 Ecosystem::chooseSpawn() const {
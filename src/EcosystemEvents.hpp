@@ -0,0 +1,84 @@
+// EcosystemEvents.hpp
+
+#ifndef ECOSYSTEMEVENTS_HPP
+#define ECOSYSTEMEVENTS_HPP
+
+#include <functional>
+#include <vector>
+#include "cinder/gl/gl.h"               // vec2, Color
+#include "chGlobals.hpp"                // Tick
+
+namespace ch {
+
+using namespace ci;
+
+struct EatEvent {
+    vec2 position;
+    float energy;
+    bool isCorpse;
+};
+
+struct DeathEvent {
+    vec2 position;
+    Tick lifetime;
+    bool leftCorpse;
+};
+
+struct BirthEvent {
+    vec2 position;
+    Color color;
+    bool isMitosis;  // split from a parent rather than spawned at random
+};
+
+struct MutationEvent {
+    vec2 position;
+    Color from;
+    Color to;
+};
+
+struct BarrierHitEvent {
+    vec2 position;
+};
+
+struct PuffEvent {
+    int midiChannel;
+};
+
+// Everything that happened in the ecosystem over one tick. The simulation
+// appends to the typed buffers as it goes, without locking or knowing who is
+// listening, and subscribers read them in bulk once the tick is over.
+struct EcosystemEvents {
+    void clear(Tick nextTick);
+    bool empty() const;
+
+    Tick tick = 0;
+    std::vector<EatEvent> eats;
+    std::vector<DeathEvent> deaths;
+    std::vector<BirthEvent> births;
+    std::vector<MutationEvent> mutations;
+    std::vector<BarrierHitEvent> barrierHits;
+    std::vector<PuffEvent> puffs;
+};
+
+using EventSubscriber = std::function<void(const EcosystemEvents&)>;
+
+
+// keeps the capacity so steady state ticks don't allocate
+void EcosystemEvents::clear(Tick nextTick) {
+    tick = nextTick;
+    eats.clear();
+    deaths.clear();
+    births.clear();
+    mutations.clear();
+    barrierHits.clear();
+    puffs.clear();
+}
+
+bool EcosystemEvents::empty() const {
+    return eats.empty() and deaths.empty() and births.empty() and
+            mutations.empty() and barrierHits.empty() and puffs.empty();
+}
+
+} // namespace ch
+
+#endif
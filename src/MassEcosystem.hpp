@@ -0,0 +1,505 @@
+// MassEcosystem.hpp
+
+#ifndef MASSECOSYSTEM_HPP
+#define MASSECOSYSTEM_HPP
+
+#include <algorithm>                    // sort, min, max, nth_element, fill
+#include <atomic>
+#include <chrono>                       // steady_clock
+#include <cstdint>
+#include <limits>                       // numeric_limits
+#include <memory>                       // unique_ptr, make_unique
+#include <utility>                      // pair
+#include <vector>
+#include "cinder/gl/gl.h"               // vec2, Color, Rectf
+#include "cinder/Rand.h"
+#include "cinder/CinderMath.h"          // lmap
+#include "chUtils.hpp"                  // limit, setMagnitude, length
+#include "chGlobals.hpp"                // Tick
+#include "chParallel.hpp"               // WorkerPool
+#include "Vehicle.hpp"                  // sGreen
+
+namespace ch {
+
+using namespace ci;
+
+// Headless, high-scale variant of Ecosystem for large population experiments.
+//
+// It applies the same evolutionary rules as the gallery ecosystem: energy is
+// spent over time and on acceleration, food and corpses are eaten on contact,
+// the oldest vehicles ready to reproduce replace the dead by mitosis, colour
+// is inherited and occasionally mutated, and long lived vehicles and children
+// leave corpses. Behaviour is simplified: there are no trails, animations,
+// puffs or barriers, and food is static within a tick.
+//
+// Results only depend on the seed: vehicles draw random numbers from a
+// generator seeded per chunk of vehicles and tick, and when several vehicles
+// reach the same food item the lowest indexed one eats it.
+//
+// State is stored as structure of arrays, food is sensed through a uniform grid
+// rebuilt every tick with a counting sort, and vehicles are sensed and moved in
+// parallel. Births, deaths and food respawns are applied serially afterwards.
+// The world is sized to keep the gallery's food density (60 per 1920x1080).
+//
+// Throughput targets for a release build on 8 hardware threads, with as many
+// food items as vehicles:
+//     100k vehicles:  >= 60 ticks/sec
+//     1M vehicles:    >= 5 ticks/sec
+// They have not been measured on 8 threads yet. With --massive on a single
+// core Xeon (g++ 12, -O3) it runs 34 ticks/sec at 100k and 1.9 at 1M.
+class MassEcosystem {
+public:
+    void setup(size_t numVehicles, size_t numFood, uint32_t seed = 0);
+    void update();
+    double run(Tick numTicks);  // returns the measured ticks per second
+
+    size_t getNumVehicles() const { return mPosX.size(); }
+    size_t getNumFood() const { return mNumFood; }
+    Tick getTickCount() const { return mTickCount; }
+    Tick getFittestLifetime() const { return mFittestLifetime; }
+    const Rectf& getBounds() const { return mBounds; }
+
+private:
+    // uniform grid over the active food, cell ranges are found by prefix sum
+    class FoodGrid {
+    public:
+        void setup(const Rectf& bounds, float cellSize);
+        void build(const std::vector<float>& xs, const std::vector<float>& ys,
+                const std::vector<uint8_t>& active);
+        int32_t nearest(const vec2& pos, float maxDist, float* distanceSquared) const;
+
+    private:
+        ivec2 toCell(const vec2& pos) const;
+
+        Rectf mBounds;
+        float mCellSize = 1.0f;
+        ivec2 mNumCells;
+        std::vector<uint32_t> mCellStart;   // one past the end is the item count
+        std::vector<uint32_t> mCellOf;      // scratch, cell of each food item
+        std::vector<uint32_t> mItems;       // food indices sorted by cell
+        std::vector<vec2> mItemPositions;   // positions in the same order
+    };
+
+    struct Worker {
+        Rand mRand;
+        std::vector<std::pair<uint32_t, uint32_t>> mContacts;  // vehicle, food in reach
+        std::vector<uint32_t> mDead;
+        std::vector<uint32_t> mReady;
+    };
+
+    void updateVehicles(size_t begin, size_t end, Worker& worker);
+    void eatFood();
+    uint32_t chunkSeed(size_t chunk) const;
+    void steer(size_t i, const vec2& target);
+    void respawnFood(uint32_t i, Rand& rand);
+    void replaceOldestFood(Rand& rand);
+    void applyDeaths();
+    vec2 randPoint(Rand& rand) const;
+    bool readyToReproduce(size_t i) const { return mMaxEnergy - mEnergy[i] < 20.0f; }
+
+    const float mVehicleSize = 6.0f;
+    const float mMaxForce = 0.8f;
+    const float mMaxSpeed = 40.0f;
+    const float mMaxEnergy = 100.0f;
+    const float mSeekDist = 400.0f;
+    const size_t mChunkSize = 1024;  // vehicles sharing a random sequence
+    const uint32_t mNoClaim = std::numeric_limits<uint32_t>::max();
+
+    Rectf mBounds;
+    Tick mTickCount = 0;
+    Tick mFittestLifetime = 0;
+    uint32_t mSeed = 0;
+
+    // vehicles
+    std::vector<float> mPosX, mPosY;
+    std::vector<float> mVelX, mVelY;
+    std::vector<float> mEnergy;
+    std::vector<Tick> mBirthTick;
+    std::vector<uint8_t> mIsChild;
+    std::vector<Color> mColor;
+
+    // food followed by a ring of corpses
+    size_t mNumFood = 0;
+    size_t mNextCorpse = 0;
+    std::vector<float> mFoodX, mFoodY;
+    std::vector<float> mFoodEnergy;
+    std::vector<Tick> mFoodBirthTick;
+    std::vector<uint8_t> mFoodActive;
+    std::unique_ptr<std::atomic<uint32_t>[]> mFoodClaimed;  // lowest vehicle in reach
+    std::vector<vec2> mFoodSpawns;
+    std::vector<uint32_t> mFoodOrder;   // scratch for finding the oldest food
+
+    FoodGrid mFoodGrid;
+    std::vector<Worker> mWorkers;
+    std::unique_ptr<WorkerPool> mPool;  // threads are kept across ticks
+    Rand mRand;
+};
+
+
+void MassEcosystem::setup(size_t numVehicles, size_t numFood, uint32_t seed) {
+    mSeed = seed;
+    mRand.seed(seed);
+    mTickCount = 0;
+    mFittestLifetime = 0;
+
+    // keep the gallery's density so behaviour matches at any scale
+    const auto scale = glm::sqrt(static_cast<float>(numFood) / 60.0f);
+    mBounds = Rectf{0.0f, 0.0f, 1920.0f * scale, 1080.0f * scale};
+
+    mPosX.resize(numVehicles);
+    mPosY.resize(numVehicles);
+    mVelX.assign(numVehicles, 0.0f);
+    mVelY.assign(numVehicles, 0.0f);
+    mEnergy.resize(numVehicles);
+    mBirthTick.assign(numVehicles, 0);
+    mIsChild.assign(numVehicles, 0);
+    mColor.assign(numVehicles, sGreen);
+    for (size_t i = 0; i < numVehicles; ++i) {
+        const auto pos = randPoint(mRand);
+        mPosX[i] = pos.x;
+        mPosY[i] = pos.y;
+        mEnergy[i] = mRand.nextFloat(mMaxEnergy / 4.0f, mMaxEnergy / 2.0f);
+    }
+
+    // one spawn area per six food items, as in the gallery
+    mFoodSpawns.clear();
+    for (size_t i = 0; i < std::max<size_t>(1, numFood / 6); ++i) {
+        mFoodSpawns.push_back(randPoint(mRand));
+    }
+
+    // the gallery keeps 30 corpses around for 50 vehicles
+    mNumFood = numFood;
+    mNextCorpse = 0;
+    const auto numCorpses = std::max<size_t>(1, numVehicles * 3 / 5);
+    const auto capacity = numFood + numCorpses;
+    mFoodX.resize(capacity);
+    mFoodY.resize(capacity);
+    mFoodEnergy.assign(capacity, 50.0f);
+    mFoodBirthTick.assign(capacity, 0);
+    mFoodActive.assign(capacity, 0);
+    mFoodClaimed.reset(new std::atomic<uint32_t>[capacity]);
+    for (size_t i = 0; i < capacity; ++i) { mFoodClaimed[i].store(mNoClaim); }
+    for (uint32_t i = 0; i < numFood; ++i) {
+        const auto pos = randPoint(mRand);
+        mFoodX[i] = pos.x;
+        mFoodY[i] = pos.y;
+        mFoodEnergy[i] = 25.0f;
+        mFoodActive[i] = 1;
+    }
+
+    // aim for roughly one food item per cell
+    const auto cellSize = glm::sqrt(mBounds.calcArea() / static_cast<float>(capacity));
+    mFoodGrid.setup(mBounds, std::max(cellSize, 2.0f * mVehicleSize));
+
+    if (not mPool) { mPool = std::make_unique<WorkerPool>(); }
+    mWorkers = std::vector<Worker>(mPool->size());
+}
+
+void MassEcosystem::update() {
+    mFoodGrid.build(mFoodX, mFoodY, mFoodActive);
+
+    // sense and move in parallel, side effects are collected per worker. Workers
+    // get contiguous runs of chunks, so concatenating their results in worker
+    // order gives vehicle order whatever the number of workers
+    for (auto& worker : mWorkers) {
+        worker.mContacts.clear();
+        worker.mDead.clear();
+        worker.mReady.clear();
+    }
+    const auto numChunks = (mPosX.size() + mChunkSize - 1) / mChunkSize;
+    mPool->parallelFor(numChunks, [this] (size_t begin, size_t end, size_t w) {
+        auto& worker = mWorkers[w];
+        for (auto chunk = begin; chunk < end; ++chunk) {
+            worker.mRand.seed(chunkSeed(chunk));
+            updateVehicles(chunk * mChunkSize,
+                    std::min(mPosX.size(), (chunk + 1) * mChunkSize), worker);
+        }
+    }, 1);
+
+    eatFood();
+    replaceOldestFood(mRand);
+    applyDeaths();
+
+    ++mTickCount;
+}
+
+double MassEcosystem::run(Tick numTicks) {
+    const auto start = std::chrono::steady_clock::now();
+    for (Tick tick = 0; tick < numTicks; ++tick) { update(); }
+    const auto elapsed = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+    return elapsed > 0.0 ? numTicks / elapsed : 0.0;
+}
+
+void MassEcosystem::updateVehicles(size_t begin, size_t end, Worker& worker) {
+    for (size_t i = begin; i < end; ++i) {
+        if (mEnergy[i] <= 0.0f) {
+            worker.mDead.push_back(static_cast<uint32_t>(i));
+            continue;
+        }
+        if (readyToReproduce(i)) { worker.mReady.push_back(static_cast<uint32_t>(i)); }
+
+        const auto pos = vec2{mPosX[i], mPosY[i]};
+        float distanceSquared;
+        const auto found = mFoodGrid.nearest(pos, mSeekDist, &distanceSquared);
+
+        if (found < 0) {  // nothing in sight, wander
+            steer(i, pos + mSeekDist * worker.mRand.nextVec2());
+            continue;
+        }
+
+        // only one vehicle gets to eat each item per tick, the lowest indexed
+        if (distanceSquared < mVehicleSize * mVehicleSize) {
+            const auto vehicle = static_cast<uint32_t>(i);
+            auto& claimed = mFoodClaimed[found];
+            auto current = claimed.load(std::memory_order_relaxed);
+            while (vehicle < current and not claimed.compare_exchange_weak(
+                    current, vehicle, std::memory_order_relaxed)) {}
+            worker.mContacts.emplace_back(vehicle, static_cast<uint32_t>(found));
+        }
+
+        steer(i, vec2{mFoodX[found], mFoodY[found]});
+    }
+}
+
+// feeds the vehicles that won their food item, then respawns eaten food and
+// clears eaten corpses
+void MassEcosystem::eatFood() {
+    for (const auto& worker : mWorkers) {
+        for (const auto& contact : worker.mContacts) {
+            const auto vehicle = contact.first;
+            const auto i = contact.second;
+            if (mFoodClaimed[i].load(std::memory_order_relaxed) != vehicle) { continue; }
+            mFoodClaimed[i].store(mNoClaim, std::memory_order_relaxed);
+
+            mEnergy[vehicle] = std::min(mEnergy[vehicle] + mFoodEnergy[i], mMaxEnergy);
+            if (i < mNumFood) {
+                respawnFood(i, mRand);
+            } else {
+                mFoodActive[i] = 0;
+            }
+        }
+    }
+}
+
+// mixes the seed, tick and chunk index with the splitmix64 finalizer, so that
+// the sequences of different ticks and chunks don't line up
+uint32_t MassEcosystem::chunkSeed(size_t chunk) const {
+    const auto mix = [] (uint64_t h) {
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+        return h ^ (h >> 31);
+    };
+    const auto h = mix(mix(mix(mSeed) + mTickCount) + chunk);
+    return static_cast<uint32_t>(h ^ (h >> 32));
+}
+
+// same steering and integration as Vehicle::arrive and Vehicle::update
+void MassEcosystem::steer(size_t i, const vec2& target) {
+    const auto pos = vec2{mPosX[i], mPosY[i]};
+    auto vel = vec2{mVelX[i], mVelY[i]};
+
+    auto desired = target - pos;
+    const auto d = ch::length(desired);
+    const auto proximity = 100.0f;
+    ch::setMagnitude(desired, d < proximity ?
+            lmap(d, 0.0f, proximity, 0.0f, mMaxSpeed) : mMaxSpeed);
+
+    auto force = desired - vel;
+    ch::limit(force, mMaxForce);
+    const auto acceleration = force / (mVehicleSize / 3.0f);
+
+    vel += acceleration;
+    ch::limit(vel, mMaxSpeed);
+    mEnergy[i] -= 0.2f + 0.1f * ch::length(acceleration) * mVehicleSize;
+
+    mPosX[i] = pos.x + vel.x;
+    mPosY[i] = pos.y + vel.y;
+    mVelX[i] = vel.x;
+    mVelY[i] = vel.y;
+}
+
+void MassEcosystem::respawnFood(uint32_t i, Rand& rand) {
+    auto pos = randPoint(rand);
+    if (rand.nextBool()) {
+        const auto& spawn = mFoodSpawns[rand.nextInt(static_cast<int32_t>(mFoodSpawns.size()))];
+        pos = spawn + vec2{rand.nextFloat(-180.0f, 180.0f), rand.nextFloat(-180.0f, 180.0f)};
+    }
+    mFoodX[i] = constrain(pos.x, mBounds.x1, mBounds.x2);
+    mFoodY[i] = constrain(pos.y, mBounds.y1, mBounds.y2);
+    mFoodBirthTick[i] = mTickCount;
+}
+
+// the gallery replaces its oldest food with probability 0.016 per tick
+void MassEcosystem::replaceOldestFood(Rand& rand) {
+    const auto expected = 0.016f * static_cast<float>(mNumFood) / 60.0f;
+    auto count = static_cast<size_t>(expected);
+    if (rand.nextFloat() < expected - static_cast<float>(count)) { ++count; }
+    if (count == 0) { return; }
+
+    mFoodOrder.resize(mNumFood);
+    for (uint32_t i = 0; i < mNumFood; ++i) { mFoodOrder[i] = i; }
+    std::nth_element(mFoodOrder.begin(), mFoodOrder.begin() + (count - 1), mFoodOrder.end(),
+            [this] (uint32_t lhs, uint32_t rhs) {
+                return mFoodBirthTick[lhs] < mFoodBirthTick[rhs];
+            });
+    for (size_t i = 0; i < count; ++i) { respawnFood(mFoodOrder[i], rand); }
+}
+
+void MassEcosystem::applyDeaths() {
+    auto dead = std::vector<uint32_t>{};
+    auto ready = std::vector<uint32_t>{};
+    for (const auto& worker : mWorkers) {
+        dead.insert(dead.end(), worker.mDead.begin(), worker.mDead.end());
+        ready.insert(ready.end(), worker.mReady.begin(), worker.mReady.end());
+    }
+
+    // oldest vehicles ready to reproduce get to replace the dead first
+    std::sort(ready.begin(), ready.end(), [this] (uint32_t lhs, uint32_t rhs) {
+        return mBirthTick[lhs] < mBirthTick[rhs];
+    });
+    auto parent = ready.cbegin();
+
+    for (const auto i : dead) {
+        // check how long it survived and if it broke the record
+        const auto lifetime = mTickCount - mBirthTick[i];
+        if (lifetime > mFittestLifetime) { mFittestLifetime = lifetime; }
+
+        // place a corpse at its last position
+        if (lifetime > 300 or mIsChild[i]) {
+            const auto c = mNumFood + mNextCorpse;
+            mNextCorpse = (mNextCorpse + 1) % (mFoodX.size() - mNumFood);
+            mFoodX[c] = constrain(mPosX[i], mBounds.x1, mBounds.x2);
+            mFoodY[c] = constrain(mPosY[i], mBounds.y1, mBounds.y2);
+            mFoodBirthTick[c] = mTickCount;
+            mFoodActive[c] = 1;
+        }
+
+        mVelX[i] = 0.0f;
+        mVelY[i] = 0.0f;
+        mBirthTick[i] = mTickCount;
+
+        if (parent != ready.cend()) {  // mitosis
+            const auto p = *parent++;
+            mPosX[i] = mPosX[p];
+            mPosY[i] = mPosY[p];
+            mIsChild[i] = 1;
+            mIsChild[p] = 1;
+
+            // inherit color and randomly mutate it
+            mColor[i] = mColor[p];
+            if (mRand.nextFloat() < 0.4f and mTickCount - mBirthTick[p] > 250) {
+                mColor[i] = mColor[i] + mRand.nextVec3() * vec3{0.7, 0.8, 0.5};
+            }
+
+            mEnergy[i] = mEnergy[p] * 0.75f;
+            mEnergy[p] = mEnergy[p] * 0.75f;
+
+        } else {  // make new vehicle at a random spawn point
+            const auto pos = randPoint(mRand);
+            mPosX[i] = pos.x;
+            mPosY[i] = pos.y;
+            mIsChild[i] = 0;
+            mColor[i] = sGreen;
+            mEnergy[i] = mRand.nextFloat(mMaxEnergy / 4.0f, mMaxEnergy / 2.0f);
+        }
+    }
+}
+
+vec2 MassEcosystem::randPoint(Rand& rand) const {
+    return vec2{rand.nextFloat(mBounds.x1, mBounds.x2), rand.nextFloat(mBounds.y1, mBounds.y2)};
+}
+
+
+void MassEcosystem::FoodGrid::setup(const Rectf& bounds, float cellSize) {
+    mBounds = bounds;
+    mCellSize = cellSize;
+    mNumCells = ivec2{static_cast<int>(glm::ceil(bounds.getWidth() / cellSize)) + 1,
+            static_cast<int>(glm::ceil(bounds.getHeight() / cellSize)) + 1};
+    mCellStart.assign(static_cast<size_t>(mNumCells.x) * mNumCells.y + 1, 0);
+}
+
+// two pass counting sort, count items per cell then scatter by prefix sum
+void MassEcosystem::FoodGrid::build(const std::vector<float>& xs,
+        const std::vector<float>& ys, const std::vector<uint8_t>& active) {
+    std::fill(mCellStart.begin(), mCellStart.end(), 0);
+    mCellOf.resize(xs.size());
+    for (size_t i = 0; i < xs.size(); ++i) {
+        if (not active[i]) { continue; }
+        const auto cell = toCell(vec2{xs[i], ys[i]});
+        mCellOf[i] = static_cast<uint32_t>(cell.x + mNumCells.x * cell.y);
+        ++mCellStart[mCellOf[i] + 1];
+    }
+    for (size_t c = 1; c < mCellStart.size(); ++c) { mCellStart[c] += mCellStart[c - 1]; }
+
+    const auto count = mCellStart.back();
+    mItems.resize(count);
+    mItemPositions.resize(count);
+    auto cursor = std::vector<uint32_t>(mCellStart.begin(), mCellStart.end() - 1);
+    for (size_t i = 0; i < xs.size(); ++i) {
+        if (not active[i]) { continue; }
+        const auto slot = cursor[mCellOf[i]]++;
+        mItems[slot] = static_cast<uint32_t>(i);
+        mItemPositions[slot] = vec2{xs[i], ys[i]};
+    }
+}
+
+// visits rings of cells around the query, any cell outside ring r is at least
+// r cells away so the search stops once the best candidate is closer than that
+int32_t MassEcosystem::FoodGrid::nearest(const vec2& pos, float maxDist,
+        float* distanceSquared) const {
+    const auto center = toCell(pos);
+    const auto maxRing = static_cast<int>(glm::ceil(maxDist / mCellSize));
+    auto best = -1;
+    auto bestDistSq = maxDist * maxDist;
+
+    const auto visit = [&] (int x, int y) {
+        const auto cell = static_cast<size_t>(x + mNumCells.x * y);
+        for (auto slot = mCellStart[cell]; slot < mCellStart[cell + 1]; ++slot) {
+            const auto d = mItemPositions[slot] - pos;
+            const auto distSq = d.x * d.x + d.y * d.y;
+            if (distSq < bestDistSq) {
+                bestDistSq = distSq;
+                best = static_cast<int32_t>(mItems[slot]);
+            }
+        }
+    };
+
+    for (int r = 0; r <= maxRing; ++r) {
+        const auto ringDist = static_cast<float>(r - 1) * mCellSize;
+        if (r > 0 and best >= 0 and bestDistSq <= ringDist * ringDist) { break; }
+
+        // stop once the ring lies entirely outside the grid
+        if (r > 0 and center.x - r < 0 and center.y - r < 0 and
+                center.x + r >= mNumCells.x and center.y + r >= mNumCells.y) { break; }
+
+        const auto minX = std::max(center.x - r, 0);
+        const auto maxX = std::min(center.x + r, mNumCells.x - 1);
+
+        // top and bottom rows, then the left and right columns between them
+        for (int x = minX; x <= maxX; ++x) {
+            if (center.y - r >= 0) { visit(x, center.y - r); }
+            if (r > 0 and center.y + r < mNumCells.y) { visit(x, center.y + r); }
+        }
+        if (r == 0) { continue; }
+        const auto minY = std::max(center.y - r + 1, 0);
+        const auto maxY = std::min(center.y + r - 1, mNumCells.y - 1);
+        for (int y = minY; y <= maxY; ++y) {
+            if (center.x - r >= 0) { visit(center.x - r, y); }
+            if (center.x + r < mNumCells.x) { visit(center.x + r, y); }
+        }
+    }
+
+    if (distanceSquared != nullptr) { *distanceSquared = bestDistSq; }
+    return best;
+}
+
+ivec2 MassEcosystem::FoodGrid::toCell(const vec2& pos) const {
+    const auto cell = (pos - mBounds.getUpperLeft()) / mCellSize;
+    return ivec2{constrain(static_cast<int>(glm::floor(cell.x)), 0, mNumCells.x - 1),
+            constrain(static_cast<int>(glm::floor(cell.y)), 0, mNumCells.y - 1)};
+}
+
+} // namespace ch
+
+#endif
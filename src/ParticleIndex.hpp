@@ -0,0 +1,324 @@
+// ParticleIndex.hpp
+
+#ifndef PARTICLEINDEX_HPP
+#define PARTICLEINDEX_HPP
+
+#include <algorithm>                    // min
+#include <array>
+#include <chrono>                       // steady_clock
+#include <limits>                       // numeric_limits
+#include <tuple>                        // tuple, get, tuple_size
+#include <type_traits>                  // decay_t
+#include <utility>                      // move, index_sequence
+#include <vector>
+#include "cinder/gl/gl.h"               // Rectf
+#include "cinder/Rand.h"
+#include "chGlobals.hpp"                // Tick
+#include "SpatialIndex.hpp"
+
+namespace ch {
+
+using namespace ci;
+
+// order matches the structures held by ParticleIndex
+enum SpatialBackend {
+    KD_TREE,
+    STATIC_KD_TREE,
+    BUCKET_KD_TREE,
+    QUADTREE,
+    GRID,
+    STATIC_GRID,
+    HASH_TABLE,
+    STATIC_HASH_TABLE,
+    BRUTE_FORCE,
+    NUM_SPATIAL_BACKENDS
+};
+
+// Spatial index over the ecosystem's particles that can switch structure at
+// runtime. Every backend is compiled in, queries are dispatched to the active
+// one with visit(). When auto tuning, the cost of each backend (build time plus
+// the query time reported each tick) is tracked, and every so often each is
+// probed for a few ticks so the choice follows the number of food and corpses.
+//
+// Otherwise the chosen backend is used, except that below a particle count
+// calibrated for that backend a vectorized brute force scan is used instead,
+// as it is cheaper than building and walking a tree for small scenes. The
+// count is measured at setup for the initial backend and on the first rebuild
+// after choosing another one. Going back to the chosen backend takes a quarter
+// more particles than leaving it, so that counts hovering around the crossover
+// don't switch structure every tick.
+class ParticleIndex {
+public:
+    using Entry = ParticleEntry;
+
+    void setup(const Rectf& worldBounds, size_t queriesPerTick);
+
+    void rebuild(const std::vector<Entry>& entries);
+    void beginRebuild(std::vector<Entry> entries);
+    bool swap();
+    void endTick(double querySeconds);
+
+    // calls fn with the active structure
+    template<typename Fn> void visit(Fn&& fn) const;
+
+    void setBackend(SpatialBackend backend);
+    SpatialBackend getBackend() const { return mBackend; }
+    SpatialBackend getActiveBackend() const { return mActive; }
+    const char* getBackendName(SpatialBackend backend) const;
+    void setAutoTune(bool autoTune);
+    bool getAutoTune() const { return mAutoTune; }
+    void setCrossover(bool crossover) { mCrossover = crossover; }
+    size_t getCrossoverSize() const { return mCrossoverSizes[mBackend]; }
+
+private:
+    using Indices = std::tuple<
+        SpatialIndex<sp::KdTree2<Particle*>>,
+        SpatialIndex<sp::StaticKdTree2<Particle*>>,
+        SpatialIndex<sp::BucketKdTree2<Particle*>>,
+        SpatialIndex<sp::OctTree2<Particle*>>,
+        SpatialIndex<sp::Grid2<Particle*>>,
+        SpatialIndex<sp::StaticGrid2<Particle*>>,
+        SpatialIndex<sp::HashTable2<Particle*>>,
+        SpatialIndex<sp::StaticHashTable2<Particle*>>,
+        SpatialIndex<sp::BruteForce2<Particle*>>>;
+    static_assert(std::tuple_size<Indices>::value == NUM_SPATIAL_BACKENDS,
+            "ParticleIndex needs one index per SpatialBackend");
+
+    template<typename Fn> void visitIndex(SpatialBackend backend, Fn&& fn);
+    template<typename Fn> void visitIndex(SpatialBackend backend, Fn&& fn) const;
+    template<typename Tuple, typename Fn, size_t... Is> static void dispatch(Tuple& indices,
+            SpatialBackend backend, Fn& fn, std::index_sequence<Is...>);
+    template<size_t I, typename Tuple, typename Fn> static void visitElement(Tuple& indices,
+            Fn& fn) { fn(std::get<I>(indices)); }
+    SpatialBackend chooseBackend(size_t numEntries);
+    void activate(SpatialBackend backend);
+    double getBuildSeconds() const;
+    void tune();
+
+    size_t calibrateCrossover(SpatialBackend backend) const;
+    template<class SpatialStruct> static double measureTick(const Rectf& worldBounds,
+            const std::vector<Entry>& entries, const std::vector<vec2>& queries);
+
+    const Tick mProbeInterval = 600;  // ticks between probing the other backends
+    const Tick mProbeTicks = 10;      // ticks spent measuring each backend
+
+    Indices mIndices;
+
+    SpatialBackend mBackend = KD_TREE;  // chosen by the user or the tuner
+    SpatialBackend mActive = KD_TREE;   // the one being built and queried
+    bool mSwitched = false;  // the active backend has no structure built yet
+
+    bool mCrossover = true;
+    Rectf mWorldBounds;
+    size_t mQueriesPerTick = 0;
+    // particle count from which each backend beats brute force, 0 until measured
+    std::array<size_t, NUM_SPATIAL_BACKENDS> mCrossoverSizes;
+
+    bool mAutoTune = false;
+    bool mProbing = false;
+    Tick mTicksOnBackend = 0;
+    std::array<double, NUM_SPATIAL_BACKENDS> mCost;  // moving average seconds per tick
+};
+
+
+void ParticleIndex::setup(const Rectf& worldBounds, size_t queriesPerTick) {
+    for (int backend = 0; backend < NUM_SPATIAL_BACKENDS; ++backend) {
+        visitIndex(static_cast<SpatialBackend>(backend),
+                [&worldBounds] (auto& index) { index.setup(worldBounds); });
+    }
+    mCost.fill(-1.0);
+    mSwitched = true;
+    mWorldBounds = worldBounds;
+    mQueriesPerTick = queriesPerTick;
+    mCrossoverSizes.fill(0);
+    mCrossoverSizes[mBackend] = calibrateCrossover(mBackend);
+}
+
+void ParticleIndex::rebuild(const std::vector<Entry>& entries) {
+    activate(chooseBackend(entries.size()));
+    visitIndex(mActive, [&entries] (auto& index) { index.rebuild(entries); });
+    mSwitched = false;
+}
+
+void ParticleIndex::beginRebuild(std::vector<Entry> entries) {
+    activate(chooseBackend(entries.size()));
+    visitIndex(mActive, [&entries] (auto& index) { index.beginRebuild(std::move(entries)); });
+    mSwitched = false;
+}
+
+// returns false if the caller needs to rebuild, as after switching backend
+bool ParticleIndex::swap() {
+    if (mSwitched) { return false; }
+    auto swapped = false;
+    visitIndex(mActive, [&swapped] (auto& index) { swapped = index.swap(); });
+    return swapped;
+}
+
+template<typename Fn>
+void ParticleIndex::visit(Fn&& fn) const {
+    visitIndex(mActive, [&fn] (const auto& index) { fn(index.get()); });
+}
+
+template<typename Fn>
+void ParticleIndex::visitIndex(SpatialBackend backend, Fn&& fn) {
+    dispatch(mIndices, backend, fn, std::make_index_sequence<NUM_SPATIAL_BACKENDS>{});
+}
+
+template<typename Fn>
+void ParticleIndex::visitIndex(SpatialBackend backend, Fn&& fn) const {
+    dispatch(mIndices, backend, fn, std::make_index_sequence<NUM_SPATIAL_BACKENDS>{});
+}
+
+// calls fn with the index of the backend through a table generated from the
+// tuple, so a new backend only needs adding to the enum and to Indices
+template<typename Tuple, typename Fn, size_t... Is>
+void ParticleIndex::dispatch(Tuple& indices, SpatialBackend backend, Fn& fn,
+        std::index_sequence<Is...>) {
+    using Visitor = void (*)(Tuple&, Fn&);
+    static const Visitor visitors[] = {&visitElement<Is, Tuple, Fn>...};
+    if (backend >= 0 and backend < NUM_SPATIAL_BACKENDS) { visitors[backend](indices, fn); }
+}
+
+double ParticleIndex::getBuildSeconds() const {
+    auto seconds = 0.0;
+    visitIndex(mActive, [&seconds] (const auto& index) { seconds = index.getBuildSeconds(); });
+    return seconds;
+}
+
+const char* ParticleIndex::getBackendName(SpatialBackend backend) const {
+    auto name = "";
+    visitIndex(backend, [&name] (const auto& index) {
+        name = SpatialTraits<typename std::decay_t<decltype(index)>::Struct>::name();
+    });
+    return name;
+}
+
+// takes effect from the next rebuild
+void ParticleIndex::setBackend(SpatialBackend backend) {
+    mBackend = backend;
+    mTicksOnBackend = 0;
+}
+
+void ParticleIndex::setAutoTune(bool autoTune) {
+    mAutoTune = autoTune;
+    mProbing = false;
+    mTicksOnBackend = 0;
+}
+
+// the tuner measures every backend itself, so only cross over when not tuning
+SpatialBackend ParticleIndex::chooseBackend(size_t numEntries) {
+    if (not mCrossover or mAutoTune or mBackend == BRUTE_FORCE) { return mBackend; }
+
+    auto& crossoverSize = mCrossoverSizes[mBackend];
+    if (crossoverSize == 0) { crossoverSize = calibrateCrossover(mBackend); }
+
+    // leave brute force only once clearly past the crossover
+    const auto threshold = mActive == BRUTE_FORCE ? crossoverSize * 5 / 4 : crossoverSize;
+    return numEntries < threshold ? BRUTE_FORCE : mBackend;
+}
+
+void ParticleIndex::activate(SpatialBackend backend) {
+    if (backend == mActive) { return; }
+    mActive = backend;
+    mSwitched = true;
+}
+
+// records the cost of the tick on the active backend, then lets the tuner
+// decide which backend the next tick uses
+void ParticleIndex::endTick(double querySeconds) {
+    const auto cost = getBuildSeconds() + querySeconds;
+    auto& average = mCost[mActive];
+    average = average < 0.0 ? cost : 0.9 * average + 0.1 * cost;
+    ++mTicksOnBackend;
+
+    if (mAutoTune) { tune(); }
+}
+
+void ParticleIndex::tune() {
+    if (not mProbing) {
+        if (mTicksOnBackend < mProbeInterval) { return; }
+
+        // start measuring every backend afresh from the first
+        mProbing = true;
+        mCost.fill(-1.0);
+        setBackend(KD_TREE);
+        return;
+    }
+
+    if (mTicksOnBackend < mProbeTicks) { return; }
+
+    if (mBackend + 1 < NUM_SPATIAL_BACKENDS) {
+        setBackend(static_cast<SpatialBackend>(mBackend + 1));
+        return;
+    }
+
+    // all measured, settle on the cheapest
+    auto cheapest = KD_TREE;
+    for (int backend = 0; backend < NUM_SPATIAL_BACKENDS; ++backend) {
+        if (mCost[backend] >= 0.0 and mCost[backend] < mCost[cheapest]) {
+            cheapest = static_cast<SpatialBackend>(backend);
+        }
+    }
+    mProbing = false;
+    setBackend(cheapest);
+}
+
+// times a rebuild plus a tick's worth of nearest neighbour queries on random
+// particles, doubling the count until the backend beats brute force
+size_t ParticleIndex::calibrateCrossover(SpatialBackend backend) const {
+    const size_t maxCount = 4096;
+    auto rand = Rand{};
+
+    auto queries = std::vector<vec2>{};
+    for (size_t i = 0; i < mQueriesPerTick; ++i) {
+        queries.emplace_back(rand.nextFloat(mWorldBounds.x1, mWorldBounds.x2),
+                rand.nextFloat(mWorldBounds.y1, mWorldBounds.y2));
+    }
+
+    auto entries = std::vector<Entry>{};
+    for (size_t count = 16; count < maxCount; count *= 2) {
+        while (entries.size() < count) {
+            entries.emplace_back(vec2{rand.nextFloat(mWorldBounds.x1, mWorldBounds.x2),
+                    rand.nextFloat(mWorldBounds.y1, mWorldBounds.y2)}, nullptr);
+        }
+
+        const auto bruteForce = measureTick<sp::BruteForce2<Particle*>>(mWorldBounds,
+                entries, queries);
+        auto tree = 0.0;
+        visitIndex(backend, [&] (const auto& index) {
+            using SpatialStruct = typename std::decay_t<decltype(index)>::Struct;
+            tree = measureTick<SpatialStruct>(mWorldBounds, entries, queries);
+        });
+        if (tree < bruteForce) { return count; }
+    }
+
+    return maxCount;
+}
+
+// best of a few runs, to keep scheduling noise out of the result
+template<class SpatialStruct>
+double ParticleIndex::measureTick(const Rectf& worldBounds,
+        const std::vector<Entry>& entries, const std::vector<vec2>& queries) {
+    auto spatialStruct = SpatialTraits<SpatialStruct>::create(worldBounds);
+    auto best = std::numeric_limits<double>::max();
+    auto checksum = 0.0f;
+
+    for (int run = 0; run < 5; ++run) {
+        const auto start = std::chrono::steady_clock::now();
+        SpatialTraits<SpatialStruct>::build(*spatialStruct, entries);
+        for (const auto& query : queries) {
+            auto distanceSquared = 0.0f;
+            spatialStruct->nearestNeighborSearch(query, &distanceSquared);
+            checksum += distanceSquared;
+        }
+        best = std::min(best, std::chrono::duration<double>{
+                std::chrono::steady_clock::now() - start}.count());
+    }
+
+    // keep the queries from being optimised away
+    return checksum >= 0.0f ? best : std::numeric_limits<double>::max();
+}
+
+} // namespace ch
+
+#endif
@@ -0,0 +1,251 @@
+// SpatialIndex.hpp
+
+#ifndef SPATIALINDEX_HPP
+#define SPATIALINDEX_HPP
+
+#include <algorithm>                    // min
+#include <cassert>
+#include <chrono>                       // steady_clock
+#include <future>                       // async, future
+#include <memory>                       // unique_ptr, make_unique
+#include <utility>                      // pair, swap, move
+#include <vector>
+#include "cinder/gl/gl.h"               // vec2, Rectf
+#include "sp/BruteForce.h"
+#include "sp/BucketKdTree.h"
+#include "sp/Grid.h"
+#include "sp/HashTable.h"
+#include "sp/KdTree.h"
+#include "sp/OctTree.h"
+#include "sp/StaticGrid.h"
+#include "sp/StaticHashTable.h"
+#include "sp/StaticKdTree.h"
+#include "Particle.hpp"
+
+namespace ch {
+
+using namespace ci;
+
+using ParticleEntry = std::pair<vec2, Particle*>;
+
+// refills a structure one particle at a time
+template<class SpatialStruct>
+void insertEach(SpatialStruct& spatialStruct, const std::vector<ParticleEntry>& entries) {
+    spatialStruct.clear();
+    for (const auto& entry : entries) {
+        spatialStruct.insert(entry.first, entry.second);
+    }
+}
+
+// how each spatial structure is named, constructed for a world of the given
+// bounds (structures may still grow to fit particles outside of them) and
+// refilled with the particles of a tick
+template<class SpatialStruct> struct SpatialTraits {};
+
+template<>
+struct SpatialTraits<sp::KdTree2<Particle*>> {
+    static const char* name() { return "kd-tree"; }
+    static std::unique_ptr<sp::KdTree2<Particle*>> create(const Rectf& bounds) {
+        return std::make_unique<sp::KdTree2<Particle*>>();
+    }
+    static void build(sp::KdTree2<Particle*>& kdTree, const std::vector<ParticleEntry>& entries) {
+        kdTree.build(entries.cbegin(), entries.cend());  // balanced
+    }
+};
+
+template<>
+struct SpatialTraits<sp::StaticKdTree2<Particle*>> {
+    static const char* name() { return "static kd-tree"; }
+    static std::unique_ptr<sp::StaticKdTree2<Particle*>> create(const Rectf& bounds) {
+        return std::make_unique<sp::StaticKdTree2<Particle*>>();
+    }
+    static void build(sp::StaticKdTree2<Particle*>& kdTree, const std::vector<ParticleEntry>& entries) {
+        kdTree.build(entries.cbegin(), entries.cend());
+    }
+};
+
+template<>
+struct SpatialTraits<sp::BucketKdTree2<Particle*>> {
+    static const char* name() { return "bucket kd-tree"; }
+    static std::unique_ptr<sp::BucketKdTree2<Particle*>> create(const Rectf& bounds) {
+        return std::make_unique<sp::BucketKdTree2<Particle*>>(16);
+    }
+    static void build(sp::BucketKdTree2<Particle*>& kdTree, const std::vector<ParticleEntry>& entries) {
+        kdTree.build(entries.cbegin(), entries.cend());
+    }
+};
+
+template<>
+struct SpatialTraits<sp::OctTree2<Particle*>> {
+    static const char* name() { return "loose quadtree"; }
+    static std::unique_ptr<sp::OctTree2<Particle*>> create(const Rectf& bounds) {
+        return std::make_unique<sp::OctTree2<Particle*>>(
+                bounds.getUpperLeft(), bounds.getLowerRight(), 8, 8);
+    }
+    // moves the particles rather than rebuilding: the nth entry keeps handle n.
+    // The tree is only filled here, so its handles are 0 to size - 1. Surplus
+    // handles are removed highest first and insert reuses the last freed handle,
+    // so new entries get them back lowest first; removing in any other order
+    // would pair entries with the wrong handles. Particles that drifted within
+    // their loose cell cost a store, only those that left it are relinked
+    static void build(sp::OctTree2<Particle*>& octTree, const std::vector<ParticleEntry>& entries) {
+        using Handle = sp::OctTree2<Particle*>::Handle;
+        const auto numKept = std::min(octTree.size(), entries.size());
+        for (size_t i = 0; i < numKept; ++i) {
+            octTree.move(static_cast<Handle>(i), entries[i].first);
+            octTree.setData(static_cast<Handle>(i), entries[i].second);
+        }
+        for (auto i = octTree.size(); i > entries.size(); --i) {
+            octTree.remove(static_cast<Handle>(i - 1));
+        }
+        for (auto i = numKept; i < entries.size(); ++i) {
+            const auto handle = octTree.insert(entries[i].first, entries[i].second);
+            assert(handle == static_cast<Handle>(i) and "entries must keep their handle");
+            (void)handle;
+        }
+    }
+};
+
+template<>
+struct SpatialTraits<sp::Grid2<Particle*>> {
+    static const char* name() { return "grid"; }
+    static std::unique_ptr<sp::Grid2<Particle*>> create(const Rectf& bounds) {
+        // 128 unit bins, about the spacing of food at the gallery's density
+        return std::make_unique<sp::Grid2<Particle*>>(
+                bounds.getUpperLeft(), bounds.getLowerRight(), 7);
+    }
+    static void build(sp::Grid2<Particle*>& spatialStruct, const std::vector<ParticleEntry>& entries) {
+        insertEach(spatialStruct, entries);
+    }
+};
+
+template<>
+struct SpatialTraits<sp::StaticGrid2<Particle*>> {
+    static const char* name() { return "static grid"; }
+    static std::unique_ptr<sp::StaticGrid2<Particle*>> create(const Rectf& bounds) {
+        // same bins as the grid, particles outside of the world go in the border bins
+        return std::make_unique<sp::StaticGrid2<Particle*>>(
+                bounds.getUpperLeft(), bounds.getLowerRight(), 128.0f);
+    }
+    static void build(sp::StaticGrid2<Particle*>& grid, const std::vector<ParticleEntry>& entries) {
+        grid.build(entries.cbegin(), entries.cend());  // counting sort
+    }
+};
+
+template<>
+struct SpatialTraits<sp::HashTable2<Particle*>> {
+    static const char* name() { return "hash table"; }
+    static std::unique_ptr<sp::HashTable2<Particle*>> create(const Rectf& bounds) {
+        return std::make_unique<sp::HashTable2<Particle*>>(
+                bounds.getUpperLeft(), bounds.getLowerRight(), vec2{128.0f}, 509);
+    }
+    static void build(sp::HashTable2<Particle*>& spatialStruct, const std::vector<ParticleEntry>& entries) {
+        insertEach(spatialStruct, entries);
+    }
+};
+
+template<>
+struct SpatialTraits<sp::StaticHashTable2<Particle*>> {
+    static const char* name() { return "static hash table"; }
+    static std::unique_ptr<sp::StaticHashTable2<Particle*>> create(const Rectf& bounds) {
+        return std::make_unique<sp::StaticHashTable2<Particle*>>(vec2{128.0f});  // unbounded
+    }
+    static void build(sp::StaticHashTable2<Particle*>& hashTable, const std::vector<ParticleEntry>& entries) {
+        hashTable.build(entries.cbegin(), entries.cend());
+    }
+};
+
+template<>
+struct SpatialTraits<sp::BruteForce2<Particle*>> {
+    static const char* name() { return "brute force"; }
+    static std::unique_ptr<sp::BruteForce2<Particle*>> create(const Rectf& bounds) {
+        return std::make_unique<sp::BruteForce2<Particle*>>();
+    }
+    static void build(sp::BruteForce2<Particle*>& spatialStruct, const std::vector<ParticleEntry>& entries) {
+        insertEach(spatialStruct, entries);
+    }
+};
+
+// Double buffered spatial structure over the ecosystem's particles. The
+// structure for the next tick is built on a worker thread while the current
+// frame renders, then swapped in at the tick boundary so that construction
+// stays off the critical path.
+template<class SpatialStruct>
+class SpatialIndex {
+public:
+    using Entry = ParticleEntry;
+    using Struct = SpatialStruct;
+
+    ~SpatialIndex() { if (mBuild.valid()) { mBuild.wait(); } }
+
+    void setup(const Rectf& worldBounds);
+    const SpatialStruct& get() const { return *mFront; }
+    double getBuildSeconds() const { return mBuildSeconds; }  // of the current structure
+
+    void rebuild(const std::vector<Entry>& entries);
+    void beginRebuild(std::vector<Entry> entries);
+    bool swap();
+
+private:
+    void wait();
+    static double build(SpatialStruct& spatialStruct, const std::vector<Entry>& entries);
+
+    std::unique_ptr<SpatialStruct> mFront;  // queried by the current tick
+    std::unique_ptr<SpatialStruct> mBack;   // built for the next tick
+    std::vector<Entry> mPending;            // snapshot owned by the worker
+    std::future<double> mBuild;
+    double mBuildSeconds = 0.0;
+};
+
+
+template<class SpatialStruct>
+void SpatialIndex<SpatialStruct>::setup(const Rectf& worldBounds) {
+    wait();
+    mFront = SpatialTraits<SpatialStruct>::create(worldBounds);
+    mBack = SpatialTraits<SpatialStruct>::create(worldBounds);
+}
+
+
+// synchronously rebuilds the structure queried by the current tick
+template<class SpatialStruct>
+void SpatialIndex<SpatialStruct>::rebuild(const std::vector<Entry>& entries) {
+    wait();
+    mBuildSeconds = build(*mFront, entries);
+}
+
+// starts building the next tick's structure from a snapshot of the particles,
+// the snapshot only carries positions so the worker never touches the particles
+template<class SpatialStruct>
+void SpatialIndex<SpatialStruct>::beginRebuild(std::vector<Entry> entries) {
+    wait();
+    mPending = std::move(entries);
+    mBuild = std::async(std::launch::async, [this] { return build(*mBack, mPending); });
+}
+
+// waits for the pending build and makes it current, returns false if
+// there was nothing pending and the caller needs to rebuild itself
+template<class SpatialStruct>
+bool SpatialIndex<SpatialStruct>::swap() {
+    if (not mBuild.valid()) { return false; }
+    mBuildSeconds = mBuild.get();  // rethrows anything the worker threw
+    std::swap(mFront, mBack);
+    return true;
+}
+
+template<class SpatialStruct>
+void SpatialIndex<SpatialStruct>::wait() {
+    if (mBuild.valid()) { mBuild.get(); }
+}
+
+// returns the time taken in seconds, for tuning the choice of structure
+template<class SpatialStruct>
+double SpatialIndex<SpatialStruct>::build(SpatialStruct& spatialStruct,
+        const std::vector<Entry>& entries) {
+    const auto start = std::chrono::steady_clock::now();
+    SpatialTraits<SpatialStruct>::build(spatialStruct, entries);
+    return std::chrono::duration<double>{std::chrono::steady_clock::now() - start}.count();
+}
+
+} // namespace ch
+
+#endif
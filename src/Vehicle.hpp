@@ -41,8 +41,8 @@ public:
             mHistory = boost::circular_buffer<vec2>{mHistorySize};
     }
 
-    void update(const std::vector<Barrier>& barriers);
-    void update() override { update(std::vector<Barrier>{}); }
+    bool update(const BarrierTree& barriers);
+    void update() override { update(BarrierTree{}); }
     void draw() const override;
     void draw(gl::BatchRef batch) const;
 
@@ -87,8 +87,9 @@ private:
 };
 
 
-// updates the position of the vehicle
-void Vehicle::update(const std::vector<Barrier>& barriers) {
+// updates the position of the vehicle, returns true if it bounced off a barrier
+bool Vehicle::update(const BarrierTree& barriers) {
+    auto collided = false;
     mVelocity += mAcceleration;  // update the velocity
     ch::limit(mVelocity, mMaxSpeed);
     mVelocity *= mVelocityModifier;
@@ -100,19 +101,16 @@ void Vehicle::update(const std::vector<Barrier>& barriers) {
     mEnergy -= 0.2f;  // as time passes
     mEnergy -= 0.1f * ch::length(mAcceleration) * bSize;  // F = M * A
 
-    // do barrier collision detection
-    for (const auto& barrier : barriers) {
-        const auto trajectory = bPosition + mVelocity;
+    // do barrier collision detection, bouncing off the first barrier in the way
+    const auto trajectory = bPosition + mVelocity;
+    auto hitFraction = 0.0f;
+    if (const auto* hit = barriers.firstSegmentHit(bPosition, trajectory, &hitFraction)) {
+        const auto intersect = bPosition + hitFraction * mVelocity;
 
-        if (barrier.hasCrossed(bPosition, trajectory)) {
-            const auto intersect = barrier.intersectionPoint(bPosition, trajectory);
-
-            // bounce off barrier
-            mVelocity = barrier.reflectNormal(intersect - bPosition);
-            bPosition = intersect;// + (mVelocity * 0.1f);  // extra nudge to prevent flip-flop
-
-            //break;  // assume colliding with a single barrier only
-        }
+        // bounce off barrier
+        mVelocity = hit->getData()->reflectNormal(intersect - bPosition);
+        bPosition = intersect;// + (mVelocity * 0.1f);  // extra nudge to prevent flip-flop
+        collided = true;
     }
 
     // indicate if ready to reproduce
@@ -124,6 +122,7 @@ void Vehicle::update(const std::vector<Barrier>& barriers) {
 
     bPosition += mVelocity;
     mAcceleration = vec2{0, 0};  // reset acceleration to 0 each cycle
+    return collided;
 }
 
 void Vehicle::draw(gl::BatchRef batch) const {
@@ -0,0 +1,117 @@
+// chParallel.hpp
+
+#ifndef CHPARALLEL_HPP
+#define CHPARALLEL_HPP
+
+#include <algorithm>                    // min, max
+#include <condition_variable>
+#include <cstddef>                      // size_t
+#include <functional>                   // function
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ch {
+
+inline size_t numWorkers() {
+    return std::max<size_t>(1, std::thread::hardware_concurrency());
+}
+
+// keeps numWorkers - 1 threads alive between calls so that per tick work
+// doesn't pay for creating and joining threads, the calling thread is worker 0
+class WorkerPool {
+public:
+    explicit WorkerPool(size_t numWorkers = ch::numWorkers());
+    ~WorkerPool();
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    size_t size() const { return mThreads.size() + 1; }
+
+    // splits [0, count) into one contiguous chunk per worker and calls
+    // fn(begin, end, worker) for each, returns once every chunk is done
+    template<typename Fn>
+    void parallelFor(size_t count, Fn&& fn, size_t minChunk = 1024);
+
+private:
+    void workerLoop(size_t worker);
+
+    std::vector<std::thread> mThreads;
+    std::mutex mMutex;
+    std::condition_variable mStart;
+    std::condition_variable mDone;
+    std::function<void(size_t, size_t, size_t)> mTask;
+    size_t mCount = 0;
+    size_t mChunk = 0;
+    size_t mNumActive = 0;              // workers taking part in the current call
+    size_t mNumPending = 0;             // threads still running the current call
+    size_t mGeneration = 0;             // incremented by every call
+    bool mStop = false;
+};
+
+
+inline WorkerPool::WorkerPool(size_t numWorkers) {
+    mThreads.reserve(numWorkers - 1);
+    for (size_t worker = 1; worker < numWorkers; ++worker) {
+        mThreads.emplace_back([this, worker] { workerLoop(worker); });
+    }
+}
+
+inline WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock{mMutex};
+        mStop = true;
+    }
+    mStart.notify_all();
+    for (auto& thread : mThreads) { thread.join(); }
+}
+
+template<typename Fn>
+void WorkerPool::parallelFor(size_t count, Fn&& fn, size_t minChunk) {
+    const auto workers = std::min(size(), std::max<size_t>(1, count / minChunk));
+    const auto chunk = (count + workers - 1) / workers;
+    if (workers == 1) {
+        fn(0, count, 0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{mMutex};
+        mTask = [&fn] (size_t begin, size_t end, size_t worker) { fn(begin, end, worker); };
+        mCount = count;
+        mChunk = chunk;
+        mNumActive = workers;
+        mNumPending = workers - 1;
+        ++mGeneration;
+    }
+    mStart.notify_all();
+
+    fn(0, std::min(count, chunk), 0);
+
+    std::unique_lock<std::mutex> lock{mMutex};
+    mDone.wait(lock, [this] { return mNumPending == 0; });
+    mTask = nullptr;
+}
+
+inline void WorkerPool::workerLoop(size_t worker) {
+    auto generation = size_t{0};
+    std::unique_lock<std::mutex> lock{mMutex};
+    while (true) {
+        mStart.wait(lock, [this, generation] { return mStop or mGeneration != generation; });
+        if (mStop) { return; }
+        generation = mGeneration;
+        if (worker >= mNumActive) { continue; }
+
+        const auto begin = std::min(mCount, worker * mChunk);
+        const auto end = std::min(mCount, begin + mChunk);
+        lock.unlock();
+        mTask(begin, end, worker);
+        lock.lock();
+
+        if (--mNumPending == 0) { mDone.notify_one(); }
+    }
+}
+
+} // namespace ch
+
+#endif